@@ -38,7 +38,7 @@
 nodebus_declare_application(Container)
 
 Container::Container(int &argc, char **argv)
-	: SlaveApplication(argc, argv), m_jsonSerialiser(new IOChannel(STDOUT_FILENO)) {
+	: SlaveApplication(argc, argv), m_jsonSerialiser(new IOChannel(STDOUT_FILENO, IOChannel::WRITABLE | IOChannel::KEEP_MODE)) {
 }
 
 Container::~Container() {}
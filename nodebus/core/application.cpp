@@ -21,6 +21,7 @@
 #include <nodebus/core/common.h>
 #include "application.h"
 #include "logger.h"
+#include "executor.h"
 
 static void sigsegv_signal_handler(int sig) {
 
@@ -100,6 +101,7 @@ Application::~Application() {
 
 void Application::onAboutToQuit() {
 	QThreadPool::globalInstance()->waitForDone();
+	Executor::globalInstance()->waitForDone();
 }
 
 int Application::onExec() {
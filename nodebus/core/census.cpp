@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <common.h>
+#include "census.h"
+#include <mutex>
+#include <typeinfo>
+#include <QHash>
+#include <QList>
+
+namespace NodeBus {
+
+std::atomic_bool __nodebus_census_enabled(false);
+
+/// @brief Cache line size assumed by the shard padding
+#define NODEBUS_CENSUS_CACHE_LINE 64
+
+struct Census::Shard {
+	// Padded on both sides rather than aligned: new ignores alignas(64)
+	// before C++17, any line holding the counter stays within the shard
+	char head[NODEBUS_CENSUS_CACHE_LINE];
+	std::atomic<int_fast64_t> count;
+	char tail[NODEBUS_CENSUS_CACHE_LINE];
+	std::mutex lock;
+	QHash<const std::type_info*, qint64> types;
+	inline Shard(): count(0) {}
+};
+
+namespace {
+
+struct CensusRegistry {
+	std::mutex lock;
+	QList<Census::Shard*> shards;
+	/// @brief Shard collecting the counts of terminated threads
+	Census::Shard retired;
+};
+
+// Never deleted: shared data may still be released during static destruction
+CensusRegistry &__census_registry() {
+	static CensusRegistry *registry = new CensusRegistry();
+	return *registry;
+}
+
+thread_local Census::Shard *__census_shard = nullptr;
+
+struct CensusShardGuard {
+	~CensusShardGuard() {
+		Census::Shard *shard = __census_shard;
+		if (shard == nullptr) {
+			return;
+		}
+		CensusRegistry &registry = __census_registry();
+		{
+			std::lock_guard<std::mutex> _(registry.lock);
+			std::lock_guard<std::mutex> __(registry.retired.lock);
+			registry.shards.removeOne(shard);
+			registry.retired.count += shard->count;
+			for (auto it = shard->types.begin(); it != shard->types.end(); it++) {
+				registry.retired.types[it.key()] += it.value();
+			}
+		}
+		// Late releases on this thread go to the retired shard
+		__census_shard = &(registry.retired);
+		delete shard;
+	}
+};
+
+thread_local CensusShardGuard __census_shard_guard;
+
+}
+
+void __census_record(SharedData *data) {
+	Census::record(data);
+}
+
+inline Census::Shard &Census::shard() {
+	if (__census_shard == nullptr) {
+		Shard *shard = new Shard();
+		CensusRegistry &registry = __census_registry();
+		std::lock_guard<std::mutex> _(registry.lock);
+		registry.shards.append(shard);
+		__census_shard = shard;
+		// Touch the guard to get it destroyed on thread exit
+		(void)&__census_shard_guard;
+	}
+	return *__census_shard;
+}
+
+void Census::setEnabled(bool enabled) {
+	__nodebus_census_enabled = enabled;
+}
+
+bool Census::isEnabled() {
+	return __nodebus_census_enabled;
+}
+
+void Census::increment() {
+	shard().count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Census::decrement(SharedData *data) {
+	Shard &s = shard();
+	s.count.fetch_sub(1, std::memory_order_relaxed);
+	if (data->m_censusType != nullptr) {
+		std::lock_guard<std::mutex> _(s.lock);
+		s.types[data->m_censusType]--;
+	}
+}
+
+void Census::record(SharedData *data) {
+	if (data->m_censusType != nullptr) {
+		return;
+	}
+	data->m_censusType = &typeid(*data);
+	Shard &s = shard();
+	std::lock_guard<std::mutex> _(s.lock);
+	s.types[data->m_censusType]++;
+}
+
+qint64 Census::liveCount() {
+	CensusRegistry &registry = __census_registry();
+	std::lock_guard<std::mutex> _(registry.lock);
+	qint64 count = registry.retired.count;
+	for (auto it = registry.shards.begin(); it != registry.shards.end(); it++) {
+		count += (*it)->count;
+	}
+	return count;
+}
+
+QMap<QString, qint64> Census::typeCount() {
+	QHash<const std::type_info*, qint64> types;
+	CensusRegistry &registry = __census_registry();
+	{
+		std::lock_guard<std::mutex> _(registry.lock);
+		QList<Shard*> shards = registry.shards;
+		shards.append(&(registry.retired));
+		for (auto it = shards.begin(); it != shards.end(); it++) {
+			std::lock_guard<std::mutex> __((*it)->lock);
+			for (auto tit = (*it)->types.begin(); tit != (*it)->types.end(); tit++) {
+				types[tit.key()] += tit.value();
+			}
+		}
+	}
+	QMap<QString, qint64> result;
+	for (auto it = types.begin(); it != types.end(); it++) {
+		if (it.value() != 0) {
+			result[__demangle(it.key()->name())] += it.value();
+		}
+	}
+	return result;
+}
+
+QString Census::toString() {
+	QMap<QString, qint64> types = typeCount();
+	QMultiMap<qint64, QString> sorted;
+	for (auto it = types.begin(); it != types.end(); it++) {
+		sorted.insert(it.value(), it.key());
+	}
+	QString result;
+	for (auto it = sorted.end(); it != sorted.begin();) {
+		it--;
+		if (!result.isEmpty()) {
+			result.append(", ");
+		}
+		result.append(QString::number(it.key()) + " " + it.value());
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Shared data census
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_CENSUS_H
+#define NODEBUS_CENSUS_H
+
+#ifndef NODEBUS_EXPORT
+#define NODEBUS_EXPORT
+#endif
+
+#include <QMap>
+#include <QString>
+#include <nodebus/core/shareddata.h>
+
+namespace NodeBus {
+
+/**
+ * @brief Live shared data census
+ * 
+ * The live count is kept in per thread shards, so constructing and
+ * destroying shared data never touches a cache line shared with other
+ * threads. The per type census is only updated while enabled, and only
+ * counts data held at least once by a SharedPtr.
+ */
+class NODEBUS_EXPORT Census {
+public:
+	/**
+	 * @brief Enable or disable the per type census
+	 * 
+	 * @param enabled true to enable it
+	 */
+	static void setEnabled(bool enabled);
+	
+	/**
+	 * @brief Test if the per type census is enabled
+	 * 
+	 * @return true if it is enabled, otherwise false
+	 */
+	static bool isEnabled();
+	
+	/**
+	 * @brief Get the number of live shared data
+	 * 
+	 * @return the live count
+	 */
+	static qint64 liveCount();
+	
+	/**
+	 * @brief Get the number of live shared data per type
+	 * 
+	 * @return a map of live counts indexed by type name
+	 */
+	static QMap<QString, qint64> typeCount();
+	
+	/**
+	 * @brief Get the per type census as a string
+	 * 
+	 * @return a string like "12034 NodeBus::SocketChannel, 3 HttpPeer"
+	 */
+	static QString toString();
+	
+	/**
+	 * @brief Count a new shared data (called by SharedData constructor)
+	 */
+	static void increment();
+	
+	/**
+	 * @brief Uncount a shared data (called by SharedData destructor)
+	 * 
+	 * @param data shared data
+	 */
+	static void decrement(SharedData *data);
+	
+	/**
+	 * @brief Record the dynamic type of a shared data
+	 * 
+	 * @param data shared data
+	 */
+	static void record(SharedData *data);
+	
+	struct Shard;
+private:
+	static Shard &shard();
+};
+
+}
+
+#endif // NODEBUS_CENSUS_H
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Concurrent sharded hash map
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_CONCURRENTHASH_H
+#define NODEBUS_CONCURRENTHASH_H
+
+#include <atomic>
+#include <mutex>
+#include <QHash>
+#include <QList>
+#include <QPair>
+
+/// @brief Default number of shards, a power of two
+#define NODEBUS_CONCURRENTHASH_SHARDS 64
+
+namespace NodeBus {
+
+/**
+ * @brief Concurrent hash map
+ * 
+ * The entries are spread over independently locked shards, the threads
+ * only contend when they access the same shard, for a single hash table
+ * operation. The key hash is computed once per call: it selects the
+ * shard with its high bits and is stored along with the key, so the
+ * shard table never hashes the key again, neither on lookup nor on
+ * rehash.
+ * 
+ * keys() and entries() take a snapshot shard by shard: the entries
+ * changed meanwhile may or may not be part of it, but the iteration is
+ * safe.
+ */
+template <typename K, typename V> class ConcurrentHash {
+public:
+	/**
+	 * @brief ConcurrentHash constructor
+	 * @param shards number of shards, rounded up to a power of two
+	 */
+	ConcurrentHash(int shards = NODEBUS_CONCURRENTHASH_SHARDS);
+	~ConcurrentHash();
+	
+	/**
+	 * @brief Get a value
+	 * @param key key
+	 * @return the value, a default constructed one if not found
+	 */
+	V value(const K &key) const;
+	
+	/**
+	 * @brief Test if a key is mapped
+	 * @param key key
+	 * @return true if found, otherwise false
+	 */
+	bool contains(const K &key) const;
+	
+	/**
+	 * @brief Map a value, replace the current one if any
+	 * @param key key
+	 * @param value value
+	 */
+	void insert(const K &key, const V &value);
+	
+	/**
+	 * @brief Remove a key
+	 * @param key key
+	 * @return true if removed, otherwise false
+	 */
+	bool remove(const K &key);
+	
+	/**
+	 * @brief Remove a key if it is still mapped to a value
+	 * 
+	 * A new value mapped to the key concurrently is kept.
+	 * 
+	 * @param key key
+	 * @param value expected value, or anything comparable to it (ex: a
+	 * raw pointer for a shared pointer value)
+	 * @return true if removed, otherwise false
+	 */
+	template <typename X> bool remove(const K &key, const X &value);
+	
+	/**
+	 * @brief Remove all the entries
+	 */
+	void clear();
+	
+	/**
+	 * @brief Get the number of entries
+	 * @return the entry count, approximate while entries are inserted or removed
+	 */
+	int size() const;
+	
+	/**
+	 * @brief Get a snapshot of the keys
+	 * @return key list
+	 */
+	QList<K> keys() const;
+	
+	/**
+	 * @brief Get a snapshot of the entries
+	 * @return key and value list
+	 */
+	QList<QPair<K, V> > entries() const;
+	
+private:
+	struct Key {
+		K key;
+		uint hash;
+		
+		Key(const K &key, uint hash): key(key), hash(hash) {
+		}
+		
+		bool operator==(const Key &other) const {
+			return hash == other.hash && key == other.key;
+		}
+		
+		friend uint qHash(const Key &key) {
+			return key.hash;
+		}
+	};
+	
+	struct Shard {
+		mutable std::mutex lock;
+		QHash<Key, V> table;
+		/// @brief The locks of two shards never share a cache line
+		char padding[64];
+	};
+	
+	Shard &shardOf(uint hash) const;
+	
+	Shard *m_shards;
+	int m_bits;
+	std::atomic<int> m_size;
+	
+	ConcurrentHash(const ConcurrentHash&);
+	ConcurrentHash &operator=(const ConcurrentHash&);
+};
+
+template <typename K, typename V>
+ConcurrentHash<K, V>::ConcurrentHash(int shards): m_bits(0), m_size(0) {
+	while ((1 << m_bits) < shards) {
+		m_bits++;
+	}
+	m_shards = new Shard[1 << m_bits];
+}
+
+template <typename K, typename V>
+ConcurrentHash<K, V>::~ConcurrentHash() {
+	delete[] m_shards;
+}
+
+template <typename K, typename V>
+inline typename ConcurrentHash<K, V>::Shard &ConcurrentHash<K, V>::shardOf(uint hash) const {
+	// Fibonacci hashing: the high bits, independent of the table buckets
+	return m_shards[m_bits == 0 ? 0 : (quint32(hash * 2654435769U) >> (32 - m_bits))];
+}
+
+template <typename K, typename V>
+V ConcurrentHash<K, V>::value(const K &key) const {
+	Key k(key, qHash(key));
+	Shard &shard = shardOf(k.hash);
+	std::lock_guard<std::mutex> _(shard.lock);
+	return shard.table.value(k);
+}
+
+template <typename K, typename V>
+bool ConcurrentHash<K, V>::contains(const K &key) const {
+	Key k(key, qHash(key));
+	Shard &shard = shardOf(k.hash);
+	std::lock_guard<std::mutex> _(shard.lock);
+	return shard.table.contains(k);
+}
+
+template <typename K, typename V>
+void ConcurrentHash<K, V>::insert(const K &key, const V &value) {
+	Key k(key, qHash(key));
+	Shard &shard = shardOf(k.hash);
+	V previous;
+	{
+		std::lock_guard<std::mutex> _(shard.lock);
+		typename QHash<Key, V>::iterator it = shard.table.find(k);
+		if (it == shard.table.end()) {
+			shard.table.insert(k, value);
+			m_size++;
+			return;
+		}
+		// Released out of the lock, its destructor may be heavy
+		previous = it.value();
+		it.value() = value;
+	}
+}
+
+template <typename K, typename V>
+bool ConcurrentHash<K, V>::remove(const K &key) {
+	Key k(key, qHash(key));
+	Shard &shard = shardOf(k.hash);
+	V previous;
+	{
+		std::lock_guard<std::mutex> _(shard.lock);
+		typename QHash<Key, V>::iterator it = shard.table.find(k);
+		if (it == shard.table.end()) {
+			return false;
+		}
+		previous = it.value();
+		shard.table.erase(it);
+		m_size--;
+	}
+	return true;
+}
+
+template <typename K, typename V> template <typename X>
+bool ConcurrentHash<K, V>::remove(const K &key, const X &value) {
+	Key k(key, qHash(key));
+	Shard &shard = shardOf(k.hash);
+	V previous;
+	{
+		std::lock_guard<std::mutex> _(shard.lock);
+		typename QHash<Key, V>::iterator it = shard.table.find(k);
+		if (it == shard.table.end() || !(it.value() == value)) {
+			return false;
+		}
+		previous = it.value();
+		shard.table.erase(it);
+		m_size--;
+	}
+	return true;
+}
+
+template <typename K, typename V>
+void ConcurrentHash<K, V>::clear() {
+	for (int i = 0; i < (1 << m_bits); i++) {
+		QHash<Key, V> table;
+		{
+			std::lock_guard<std::mutex> _(m_shards[i].lock);
+			table.swap(m_shards[i].table);
+			m_size -= table.size();
+		}
+	}
+}
+
+template <typename K, typename V>
+inline int ConcurrentHash<K, V>::size() const {
+	return m_size.load(std::memory_order_relaxed);
+}
+
+template <typename K, typename V>
+QList<K> ConcurrentHash<K, V>::keys() const {
+	QList<K> res;
+	res.reserve(size());
+	for (int i = 0; i < (1 << m_bits); i++) {
+		std::lock_guard<std::mutex> _(m_shards[i].lock);
+		for (typename QHash<Key, V>::const_iterator it = m_shards[i].table.constBegin(); it != m_shards[i].table.constEnd(); it++) {
+			res.append(it.key().key);
+		}
+	}
+	return res;
+}
+
+template <typename K, typename V>
+QList<QPair<K, V> > ConcurrentHash<K, V>::entries() const {
+	QList<QPair<K, V> > res;
+	res.reserve(size());
+	for (int i = 0; i < (1 << m_bits); i++) {
+		std::lock_guard<std::mutex> _(m_shards[i].lock);
+		for (typename QHash<Key, V>::const_iterator it = m_shards[i].table.constBegin(); it != m_shards[i].table.constEnd(); it++) {
+			res.append(qMakePair(it.key().key, it.value()));
+		}
+	}
+	return res;
+}
+
+}
+
+#endif // NODEBUS_CONCURRENTHASH_H
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "cpuset.h"
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace NodeBus {
+
+CpuSet CpuSet::parse(const QString &list) {
+	QList<int> cpus;
+	QStringList ranges = list.trimmed().split(',', QString::SkipEmptyParts);
+	for (auto it = ranges.begin(); it != ranges.end(); it++) {
+		bool ok1, ok2 = true;
+		QString range = it->trimmed();
+		int first = range.section('-', 0, 0).toInt(&ok1);
+		int last = range.contains('-') ? range.section('-', 1, 1).toInt(&ok2) : first;
+		if (!ok1 || !ok2 || first < 0 || last < first) {
+			throw CpuSetException("Invalid CPU list '" + list + "'");
+		}
+		for (int cpu = first; cpu <= last; cpu++) {
+			if (!cpus.contains(cpu)) {
+				cpus.append(cpu);
+			}
+		}
+	}
+	return CpuSet(cpus);
+}
+
+CpuSet CpuSet::ofNode(int node) {
+	QFile file("/sys/devices/system/node/node" + QString::number(node) + "/cpulist");
+	if (node < 0 || !file.open(QIODevice::ReadOnly)) {
+		return CpuSet();
+	}
+	return parse(QString::fromLatin1(file.readAll()));
+}
+
+int CpuSet::nodeOfCpu(int cpu) {
+	QStringList entries = QDir("/sys/devices/system/cpu/cpu" + QString::number(cpu)).entryList(QStringList("node*"));
+	if (entries.isEmpty()) {
+		return -1;
+	}
+	bool ok;
+	int node = entries.first().mid(4).toInt(&ok);
+	return ok ? node : -1;
+}
+
+int CpuSet::nodeOfInterface(const QString &name) {
+	QFile file("/sys/class/net/" + name + "/device/numa_node");
+	if (!file.open(QIODevice::ReadOnly)) {
+		return -1;
+	}
+	bool ok;
+	// -1 on the single node machines
+	int node = QString::fromLatin1(file.readAll()).trimmed().toInt(&ok);
+	return ok ? node : -1;
+}
+
+bool CpuSet::pin() const {
+	if (m_cpus.isEmpty()) {
+		return true;
+	}
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (auto it = m_cpus.begin(); it != m_cpus.end(); it++) {
+		if (*it < CPU_SETSIZE) {
+			CPU_SET(*it, &set);
+		}
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+QString CpuSet::toString() const {
+	QStringList ranges;
+	for (int i = 0; i < m_cpus.size();) {
+		int j = i;
+		while (j + 1 < m_cpus.size() && m_cpus[j + 1] == m_cpus[j] + 1) {
+			j++;
+		}
+		ranges.append(i == j ? QString::number(m_cpus[i]) : QString::number(m_cpus[i]) + "-" + QString::number(m_cpus[j]));
+		i = j + 1;
+	}
+	return ranges.join(",");
+}
+
+}
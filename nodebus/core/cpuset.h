@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : CPU set
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_CPUSET_H
+#define NODEBUS_CPUSET_H
+
+#ifndef NODEBUS_EXPORT
+#define NODEBUS_EXPORT
+#endif
+
+#include <nodebus/core/exception.h>
+#include <QList>
+#include <QString>
+
+namespace NodeBus {
+
+nodebus_declare_exception(CpuSetException, Exception);
+
+/**
+ * @brief Set of CPUs a thread is pinned to
+ * 
+ * The NUMA topology is read from sysfs. A thread pinned to the CPUs of a
+ * node gets its memory from this node: the kernel allocates a page on the
+ * node of the thread touching it first, thread local pools and buffers
+ * are therefore local once their thread is pinned.
+ */
+class NODEBUS_EXPORT CpuSet {
+public:
+	/**
+	 * @brief Empty set, a thread pinned to it is left unpinned
+	 */
+	CpuSet();
+	
+	/**
+	 * @brief CpuSet constructor
+	 * @param cpus CPU indexes
+	 */
+	CpuSet(const QList<int> &cpus);
+	
+	/**
+	 * @brief Parse a CPU list
+	 * @param list list in the kernel format (ex: "0-3,8,10-11")
+	 * @return the CPU set, empty if the list is empty
+	 * @throw CpuSetException on syntax error
+	 */
+	static CpuSet parse(const QString &list);
+	
+	/**
+	 * @brief Get the CPUs of a NUMA node
+	 * @param node node index
+	 * @return the CPU set, empty if unknown
+	 */
+	static CpuSet ofNode(int node);
+	
+	/**
+	 * @brief Get the NUMA node of a CPU
+	 * @param cpu CPU index
+	 * @return node index, -1 if unknown
+	 */
+	static int nodeOfCpu(int cpu);
+	
+	/**
+	 * @brief Get the NUMA node a network interface is attached to
+	 * @param name interface name (ex: "eth0")
+	 * @return node index, -1 if unknown
+	 */
+	static int nodeOfInterface(const QString &name);
+	
+	bool isEmpty() const;
+	int count() const;
+	int at(int i) const;
+	
+	/**
+	 * @brief Get the NUMA node of the set
+	 * @return node of the first CPU, -1 if unknown or empty
+	 */
+	int node() const;
+	
+	/**
+	 * @brief Pin the calling thread
+	 * @return true if pinned or if the set is empty, false on failure
+	 */
+	bool pin() const;
+	
+	/**
+	 * @brief Format the set as a CPU list
+	 * @return list in the kernel format
+	 */
+	QString toString() const;
+	
+private:
+	QList<int> m_cpus;
+};
+
+inline CpuSet::CpuSet() {
+}
+
+inline CpuSet::CpuSet(const QList<int> &cpus): m_cpus(cpus) {
+}
+
+inline bool CpuSet::isEmpty() const {
+	return m_cpus.isEmpty();
+}
+
+inline int CpuSet::count() const {
+	return m_cpus.size();
+}
+
+inline int CpuSet::at(int i) const {
+	return m_cpus.at(i);
+}
+
+inline int CpuSet::node() const {
+	return m_cpus.isEmpty() ? -1 : nodeOfCpu(m_cpus.first());
+}
+
+}
+
+#endif // NODEBUS_CPUSET_H
@@ -58,6 +58,7 @@ public:\
 };
 
 #include <nodebus/core/sharedptr.h>
+#include <nodebus/core/objectpool.h>
 
 namespace NodeBus {
 
@@ -65,6 +66,7 @@ class Logger;
 
 class NODEBUS_EXPORT ExceptionData: public SharedData {
 	ExceptionData(const SharedData&);
+	nodebus_declare_pooled(ExceptionData)
 public:
 	/// @brief Message
 	QString message;
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "executor.h"
+#include "logger.h"
+#include <QQueue>
+#include <QThread>
+
+namespace NodeBus {
+
+class Executor::Worker: public QThread {
+public:
+	Worker(Executor *executor, int index, int cpu);
+	
+	Executor *m_executor;
+	int m_index;
+	/// @brief CPU the worker is pinned to, -1 for none
+	int m_cpu;
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	QQueue<QRunnable*> m_queue;
+	/// @brief Queue depth, read without the lock by the thieves
+	std::atomic<int> m_depth;
+	/// @brief Out of tasks, waiting or about to wait
+	bool m_sleeping;
+	bool m_wakeup;
+	bool m_stop;
+	std::atomic<quint64> m_executed;
+	std::atomic<quint64> m_stolen;
+	
+protected:
+	virtual void run();
+	
+private:
+	bool pop(QRunnable *&task);
+};
+
+Executor::Worker::Worker(Executor *executor, int index, int cpu): m_executor(executor), m_index(index), m_cpu(cpu), m_depth(0),
+m_sleeping(false), m_wakeup(false), m_stop(false), m_executed(0), m_stolen(0) {
+}
+
+bool Executor::Worker::pop(QRunnable *&task) {
+	std::lock_guard<std::mutex> _(m_lock);
+	if (m_queue.isEmpty()) {
+		return false;
+	}
+	task = m_queue.dequeue();
+	m_depth--;
+	return true;
+}
+
+void Executor::Worker::run() {
+	if (m_cpu != -1 && !CpuSet(QList<int>() << m_cpu).pin()) {
+		logWarn() << "Executor: failed to pin worker " << m_index << " to CPU " << m_cpu;
+	}
+	for (;;) {
+		QRunnable *task;
+		if (!pop(task) && !m_executor->steal(this, task)) {
+			// Announced before the last scan: a task queued meanwhile to a
+			// busy worker wakes this one up
+			{
+				std::lock_guard<std::mutex> _(m_lock);
+				m_sleeping = true;
+			}
+			m_executor->m_idle++;
+			bool found = m_executor->steal(this, task);
+			std::unique_lock<std::mutex> locker(m_lock);
+			if (!found) {
+				m_cond.wait(locker, [this] { return !m_queue.isEmpty() || m_wakeup || m_stop; });
+			}
+			m_sleeping = false;
+			m_wakeup = false;
+			bool stop = !found && m_stop && m_queue.isEmpty();
+			locker.unlock();
+			m_executor->m_idle--;
+			if (stop) {
+				return;
+			}
+			if (!found) {
+				continue;
+			}
+		}
+		bool autoDelete = task->autoDelete();
+		task->run();
+		if (autoDelete) {
+			delete task;
+		}
+		m_executed++;
+		m_executor->done();
+	}
+}
+
+CpuSet Executor::s_globalCpus;
+
+Executor::Executor(int threadCount, const CpuSet &cpus): m_next(0), m_idle(0), m_pending(0) {
+	if (threadCount <= 0) {
+		threadCount = cpus.isEmpty() ? QThread::idealThreadCount() : cpus.count();
+	}
+	for (int i = 0; i < threadCount; i++) {
+		m_workers.append(new Worker(this, i, cpus.isEmpty() ? -1 : cpus.at(i % cpus.count())));
+	}
+	// Started once the list is complete, the thieves walk through it
+	for (auto it = m_workers.begin(); it != m_workers.end(); it++) {
+		(*it)->start();
+	}
+}
+
+Executor::~Executor() {
+	waitForDone();
+	for (auto it = m_workers.begin(); it != m_workers.end(); it++) {
+		{
+			std::lock_guard<std::mutex> _((*it)->m_lock);
+			(*it)->m_stop = true;
+		}
+		(*it)->m_cond.notify_one();
+	}
+	for (auto it = m_workers.begin(); it != m_workers.end(); it++) {
+		(*it)->wait();
+		delete *it;
+	}
+}
+
+void Executor::start(QRunnable *task, uint affinity) {
+	m_pending++;
+	Worker *worker = m_workers[(affinity == ANY ? m_next++ : affinity) % m_workers.size()];
+	bool sleeping;
+	{
+		std::lock_guard<std::mutex> _(worker->m_lock);
+		worker->m_queue.enqueue(task);
+		worker->m_depth++;
+		sleeping = worker->m_sleeping;
+	}
+	if (sleeping) {
+		worker->m_cond.notify_one();
+	} else if (m_idle > 0) {
+		// The preferred worker is busy, let an idle one steal the task
+		wakeIdle();
+	}
+}
+
+bool Executor::steal(Worker *thief, QRunnable *&task) {
+	int count = m_workers.size();
+	for (int i = 1; i < count; i++) {
+		Worker *victim = m_workers[(thief->m_index + i) % count];
+		if (victim->m_depth == 0) {
+			continue;
+		}
+		std::lock_guard<std::mutex> _(victim->m_lock);
+		if (victim->m_queue.isEmpty()) {
+			continue;
+		}
+		// The oldest task, which waited the most
+		task = victim->m_queue.dequeue();
+		victim->m_depth--;
+		thief->m_stolen++;
+		return true;
+	}
+	return false;
+}
+
+void Executor::wakeIdle() {
+	for (auto it = m_workers.begin(); it != m_workers.end(); it++) {
+		Worker *worker = *it;
+		std::unique_lock<std::mutex> locker(worker->m_lock);
+		if (worker->m_sleeping && !worker->m_wakeup) {
+			worker->m_wakeup = true;
+			locker.unlock();
+			worker->m_cond.notify_one();
+			return;
+		}
+	}
+}
+
+void Executor::done() {
+	if (--m_pending == 0) {
+		std::lock_guard<std::mutex> _(m_doneLock);
+		m_doneCond.notify_all();
+	}
+}
+
+void Executor::waitForDone() {
+	std::unique_lock<std::mutex> locker(m_doneLock);
+	m_doneCond.wait(locker, [this] { return m_pending == 0; });
+}
+
+QVariantMap Executor::stats() {
+	QVariantMap res;
+	QVariantList workers;
+	quint64 executed = 0, stolen = 0;
+	for (auto it = m_workers.begin(); it != m_workers.end(); it++) {
+		QVariantMap worker;
+		worker["queued"] = (*it)->m_depth.load();
+		worker["executed"] = (qulonglong)(*it)->m_executed.load();
+		worker["stolen"] = (qulonglong)(*it)->m_stolen.load();
+		if ((*it)->m_cpu != -1) {
+			worker["cpu"] = (*it)->m_cpu;
+		}
+		executed += (*it)->m_executed;
+		stolen += (*it)->m_stolen;
+		workers.append(worker);
+	}
+	res["threads"] = m_workers.size();
+	res["idle"] = m_idle.load();
+	res["pending"] = (qulonglong)m_pending.load();
+	res["executed"] = (qulonglong)executed;
+	res["stolen"] = (qulonglong)stolen;
+	res["workers"] = workers;
+	return res;
+}
+
+Executor *Executor::globalInstance() {
+	// Never destroyed: the workers may outlive the static objects
+	static Executor *instance = new Executor(0, s_globalCpus);
+	return instance;
+}
+
+void Executor::setGlobalCpus(const CpuSet &cpus) {
+	s_globalCpus = cpus;
+}
+
+}
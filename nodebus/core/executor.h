@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Work-stealing executor
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_EXECUTOR_H
+#define NODEBUS_EXECUTOR_H
+
+#ifndef NODEBUS_EXPORT
+#define NODEBUS_EXPORT
+#endif
+
+#include <nodebus/core/cpuset.h>
+#include <QRunnable>
+#include <QVariant>
+#include <QVector>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace NodeBus {
+
+/**
+ * @brief Work-stealing executor
+ * 
+ * Each worker owns a task queue. A task is queued to the worker selected
+ * by its affinity key, so the successive tasks of a connection tend to
+ * run on the same worker and find its buffers and parser state in cache.
+ * A worker which runs out of tasks steals the oldest task of the other
+ * queues before going to sleep, so the affinity never leaves a task
+ * waiting while a worker is idle.
+ * 
+ * Tasks are deleted after running if QRunnable::autoDelete() is set.
+ * 
+ * Given a CPU set, each worker is pinned to one of its CPUs.
+ */
+class NODEBUS_EXPORT Executor {
+public:
+	/// @brief Affinity key of the tasks without any preferred worker
+	static const uint ANY = ~0U;
+	
+	/**
+	 * @brief Executor constructor
+	 * 
+	 * @param threadCount number of workers, one per CPU of the set or
+	 * QThread::idealThreadCount() if 0 or less
+	 * @param cpus CPUs the workers are pinned to, none if empty
+	 */
+	Executor(int threadCount = 0, const CpuSet &cpus = CpuSet());
+	
+	/**
+	 * @brief Executor destructor, waits for the queued tasks
+	 */
+	~Executor();
+	
+	/**
+	 * @brief Queue a task
+	 * 
+	 * @param task task to run
+	 * @param affinity affinity key (ex: a connection hash) or ANY
+	 */
+	void start(QRunnable *task, uint affinity = ANY);
+	
+	/**
+	 * @brief Wait for all the queued tasks to be done
+	 */
+	void waitForDone();
+	
+	/**
+	 * @brief Get the number of workers
+	 * 
+	 * @return the worker count
+	 */
+	int threadCount();
+	
+	/**
+	 * @brief Get the queue metrics
+	 * 
+	 * @return per worker queue depth, executed and stolen task counts
+	 */
+	QVariantMap stats();
+	
+	/**
+	 * @brief Get the executor shared by the peers
+	 * 
+	 * @return the global executor
+	 */
+	static Executor *globalInstance();
+	
+	/**
+	 * @brief Set the CPUs the global executor workers are pinned to
+	 * 
+	 * Must be called before the first globalInstance() call.
+	 * 
+	 * @param cpus CPU set, none if empty
+	 */
+	static void setGlobalCpus(const CpuSet &cpus);
+	
+private:
+	class Worker;
+	
+	bool steal(Worker *thief, QRunnable *&task);
+	void wakeIdle();
+	void done();
+	
+	QVector<Worker*> m_workers;
+	/// @brief Round robin index of the tasks without affinity
+	std::atomic<uint> m_next;
+	std::atomic<int> m_idle;
+	/// @brief Queued and running task count
+	std::atomic<quint64> m_pending;
+	std::mutex m_doneLock;
+	std::condition_variable m_doneCond;
+	static CpuSet s_globalCpus;
+};
+
+inline int Executor::threadCount() {
+	return m_workers.size();
+}
+
+}
+
+#endif // NODEBUS_EXECUTOR_H
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Correlation id table
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_IDTABLE_H
+#define NODEBUS_IDTABLE_H
+
+#include <QVector>
+#include <qglobal.h>
+
+namespace NodeBus {
+
+/**
+ * @brief Open addressing table indexed by 64-bit correlation ids
+ * 
+ * Meant for sequential ids: the id is its own hash, consecutive ids fill
+ * consecutive slots and a lookup is a single probe in the common case.
+ * Collisions are resolved by linear probing. A removal leaves a
+ * tombstone, so that it never walks the run of the following ids, the
+ * tombstones are dropped when the table is rehashed. Each entry has an
+ * expiration time, expired entries are removed by expire().
+ * 
+ * The table is not synchronized. The ids 0 and ~0 are reserved.
+ */
+template <typename T> class IdTable {
+public:
+	/**
+	 * @brief IdTable constructor
+	 * @param capacity initial capacity, rounded up to a power of two
+	 */
+	IdTable(int capacity = 16);
+	
+	/**
+	 * @brief Insert an entry
+	 * @param id correlation id, neither 0 nor ~0
+	 * @param value value
+	 * @param expires expiration time
+	 */
+	void insert(quint64 id, const T &value, qint64 expires);
+	
+	/**
+	 * @brief Extract an entry
+	 * @param id correlation id, never found if reserved
+	 * @param value destination
+	 * @return true if found, otherwise false
+	 */
+	bool take(quint64 id, T &value);
+	
+	/**
+	 * @brief Remove an entry
+	 * @param id correlation id, never found if reserved
+	 * @return true if found, otherwise false
+	 */
+	bool remove(quint64 id);
+	
+	/**
+	 * @brief Remove the expired entries
+	 * @param now current time
+	 * @return number of entries removed
+	 */
+	int expire(qint64 now);
+	
+	/**
+	 * @brief Get the number of entries
+	 * @return entry count
+	 */
+	int size() const;
+	
+	/**
+	 * @brief Get the number of slots
+	 * @return slot count
+	 */
+	int capacity() const;
+	
+private:
+	static const quint64 EMPTY = 0;
+	static const quint64 DELETED = ~quint64(0);
+	
+	struct Slot {
+		quint64 id;
+		qint64 expires;
+		T value;
+		Slot(): id(0), expires(0) {
+		}
+	};
+	
+	int find(quint64 id) const;
+	void removeAt(int index);
+	void rehash();
+	
+	QVector<Slot> m_slots;
+	int m_mask;
+	int m_size;
+	int m_deleted;
+};
+
+template <typename T>
+IdTable<T>::IdTable(int capacity): m_size(0), m_deleted(0) {
+	int size = 8;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	m_slots.resize(size);
+	m_mask = size - 1;
+}
+
+template <typename T>
+inline int IdTable<T>::find(quint64 id) const {
+	// Would match the free slots and tombstones, ids may come from the network
+	if (id == EMPTY || id == DELETED) {
+		return -1;
+	}
+	const Slot *slots = m_slots.constData();
+	for (int i = int(id & m_mask); slots[i].id != EMPTY; i = (i + 1) & m_mask) {
+		if (slots[i].id == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+template <typename T>
+void IdTable<T>::insert(quint64 id, const T &value, qint64 expires) {
+	Q_ASSERT(id != EMPTY && id != DELETED);
+	// Load factor, tombstones included, kept under 3/4
+	if ((m_size + m_deleted + 1) * 4 > (m_mask + 1) * 3) {
+		rehash();
+	}
+	Slot *slots = m_slots.data();
+	int i = int(id & m_mask), free = -1;
+	for (; slots[i].id != EMPTY && slots[i].id != id; i = (i + 1) & m_mask) {
+		if (slots[i].id == DELETED && free == -1) {
+			free = i;
+		}
+	}
+	if (slots[i].id == EMPTY) {
+		if (free != -1) {
+			i = free;
+			m_deleted--;
+		}
+		m_size++;
+	}
+	slots[i].id = id;
+	slots[i].expires = expires;
+	slots[i].value = value;
+}
+
+template <typename T>
+bool IdTable<T>::take(quint64 id, T &value) {
+	int i = find(id);
+	if (i == -1) {
+		return false;
+	}
+	value = m_slots[i].value;
+	removeAt(i);
+	return true;
+}
+
+template <typename T>
+bool IdTable<T>::remove(quint64 id) {
+	int i = find(id);
+	if (i == -1) {
+		return false;
+	}
+	removeAt(i);
+	return true;
+}
+
+template <typename T>
+inline void IdTable<T>::removeAt(int index) {
+	Slot &slot = m_slots[index];
+	slot.id = DELETED;
+	slot.value = T();
+	m_size--;
+	m_deleted++;
+}
+
+template <typename T>
+int IdTable<T>::expire(qint64 now) {
+	int count = 0;
+	for (int i = 0; i <= m_mask; i++) {
+		quint64 id = m_slots[i].id;
+		if (id != EMPTY && id != DELETED && m_slots[i].expires <= now) {
+			removeAt(i);
+			count++;
+		}
+	}
+	return count;
+}
+
+template <typename T>
+void IdTable<T>::rehash() {
+	QVector<Slot> old;
+	old.swap(m_slots);
+	// Grown unless the live entries fill less than a quarter of the
+	// capacity: the tombstones are then only dropped once in a while
+	m_slots.resize(m_size * 4 > old.size() ? old.size() * 2 : old.size());
+	m_mask = m_slots.size() - 1;
+	m_size = 0;
+	m_deleted = 0;
+	for (int i = 0; i < old.size(); i++) {
+		if (old[i].id != EMPTY && old[i].id != DELETED) {
+			insert(old[i].id, old[i].value, old[i].expires);
+		}
+	}
+}
+
+template <typename T>
+inline int IdTable<T>::size() const {
+	return m_size;
+}
+
+template <typename T>
+inline int IdTable<T>::capacity() const {
+	return m_mask + 1;
+}
+
+}
+
+#endif // NODEBUS_IDTABLE_H
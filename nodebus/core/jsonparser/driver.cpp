@@ -55,5 +55,12 @@ QVariant Driver::parse() {
 	return *result;
 }
 
+QVariantMap Driver::allocatorCalls() {
+	QVariantMap res;
+	res["jsonparser::Driver"] = (qulonglong)NodeBus::ObjectPool<Driver>::allocatorCalls();
+	res["jsonparser::Scanner"] = (qulonglong)NodeBus::ObjectPool<Scanner>::allocatorCalls();
+	return res;
+}
+
 }
 
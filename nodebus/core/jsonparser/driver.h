@@ -20,6 +20,7 @@
 #define JSONPARSER_DRIVER_H
 
 #include <nodebus/core/datastream.h>
+#include <nodebus/core/objectpool.h>
 #include <QVariant>
 
 namespace jsonparser {
@@ -36,11 +37,18 @@ class r;
  * This library is released under the GNU Lesser General Public version 2.1
  */
 class Driver {
+	nodebus_declare_pooled(Driver)
 public:
 	typedef char (*getc_t)(void *);
 	Driver(NodeBus::DataStream &dataStream);
 	~Driver();
 	QVariant parse();
+	
+	/**
+	 * @brief Get the global allocator calls of the driver and scanner pools
+	 * @return call counts indexed by type name
+	 */
+	static QVariantMap allocatorCalls();
 private:
 	QString lastError;
 	Scanner &scanner;
@@ -31,6 +31,7 @@
 #endif
 
 #include <nodebus/core/datastream.h>
+#include <nodebus/core/objectpool.h>
 #include <parser.hh>
 
 /**
@@ -46,6 +47,7 @@ namespace jsonparser {
  * This library is released under the GNU Lesser General Public version 2.1
  */
 class Scanner : public jsonparserFlexLexer {
+	nodebus_declare_pooled(Scanner)
 public:
 	Scanner(NodeBus::DataStream &dataStream);
 
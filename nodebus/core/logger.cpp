@@ -17,6 +17,7 @@
  */
 
 #include <nodebus/core/logger.h>
+#include <nodebus/core/census.h>
 #include <stdio.h>
 #include <stdarg.h>
 
@@ -87,16 +88,14 @@ Logger &Logger::operator<<(Exception &e) {
 	return *this;
 }
 
-extern std::atomic_uint_fast64_t __nodebus_shared_data_count;
-
 void __log_data_ref_init(void* data) {
 	logFinest() << "SharedPtr::init   " << __demangle(typeid(*(SharedData*)data).name()) 
-	<< "[" << toHexString(data) << "] (count=" << __nodebus_shared_data_count << ")";
+	<< "[" << toHexString(data) << "] (count=" << Census::liveCount() << ")";
 }
 
 void __log_data_ref_delete(void* data) {
 	logFinest() << "SharedPtr::delete " << __demangle(typeid(*(SharedData*)data).name()) 
-	<< "[" << toHexString(data) << "] (count=" << (__nodebus_shared_data_count-1) << ")";
+	<< "[" << toHexString(data) << "] (count=" << (Census::liveCount()-1) << ")";
 }
 
 }
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Lock-free multiple producer single consumer queue
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_MPSCQUEUE_H
+#define NODEBUS_MPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+#include <stddef.h>
+#include <nodebus/core/objectpool.h>
+
+namespace NodeBus {
+
+/**
+ * @brief Lock-free multiple producer single consumer queue
+ * 
+ * Intrusive linked list with a stub node (D. Vyukov): push() is wait-free
+ * and can be called from any thread, pop() must only be called by one
+ * thread at a time. A value pushed concurrently may be seen by the
+ * consumer only once its push() has returned.
+ */
+template <typename T> class MPSCQueue {
+public:
+	MPSCQueue();
+	~MPSCQueue();
+	
+	/**
+	 * @brief Append a value
+	 * 
+	 * @param value value to append
+	 */
+	void push(const T &value);
+	
+	/**
+	 * @brief Extract the oldest value
+	 * 
+	 * @param value destination
+	 * @return false if the queue is empty
+	 */
+	bool pop(T &value);
+	
+	/**
+	 * @brief Test if the queue is empty, from the consumer point of view
+	 * 
+	 * Same restriction as pop(): the stub node may be released by a
+	 * concurrent pop(), the producers must use size() instead.
+	 * 
+	 * @return true if empty, otherwise false
+	 */
+	bool isEmpty();
+	
+	/**
+	 * @brief Get the number of queued values, from any thread
+	 * 
+	 * A value is counted before push() links it, pop() may not return it yet.
+	 * The count is relaxed: a caller ordering it with other atomics, as
+	 * a producer checking a drain token, needs a sequentially consistent fence.
+	 * 
+	 * @return the value count, approximate while values are pushed or popped
+	 */
+	size_t size();
+	
+	/**
+	 * @brief Get the number of node allocations from the global allocator
+	 * 
+	 * The nodes are pooled, shared by all the queues of the same value type.
+	 * 
+	 * @return the allocation count
+	 */
+	static uint64_t allocatorCalls();
+	
+private:
+	struct Node {
+		nodebus_declare_pooled(Node)
+		std::atomic<Node*> next;
+		T value;
+		Node(): next(nullptr) {}
+	};
+	
+	MPSCQueue(const MPSCQueue&);
+	MPSCQueue &operator=(const MPSCQueue&);
+	
+	/// @brief Last pushed node, shared by the producers
+	std::atomic<Node*> m_head;
+	/// @brief Stub node of the consumer, its successor is the oldest value
+	Node *m_tail;
+	std::atomic<size_t> m_size;
+};
+
+template <typename T>
+inline MPSCQueue<T>::MPSCQueue(): m_size(0) {
+	m_tail = new Node();
+	m_head.store(m_tail, std::memory_order_relaxed);
+}
+
+template <typename T>
+MPSCQueue<T>::~MPSCQueue() {
+	T value;
+	while (pop(value));
+	delete m_tail;
+}
+
+template <typename T>
+void MPSCQueue<T>::push(const T &value) {
+	Node *node = new Node();
+	node->value = value;
+	m_size.fetch_add(1, std::memory_order_relaxed);
+	Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+	// The consumer sees the node once linked
+	prev->next.store(node, std::memory_order_release);
+}
+
+template <typename T>
+bool MPSCQueue<T>::pop(T &value) {
+	Node *next = m_tail->next.load(std::memory_order_acquire);
+	if (next == nullptr) {
+		return false;
+	}
+	// The node becomes the stub
+	value = std::move(next->value);
+	next->value = T();
+	delete m_tail;
+	m_tail = next;
+	m_size.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
+
+template <typename T>
+inline bool MPSCQueue<T>::isEmpty() {
+	return m_tail->next.load(std::memory_order_acquire) == nullptr;
+}
+
+template <typename T>
+inline size_t MPSCQueue<T>::size() {
+	return m_size.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+inline uint64_t MPSCQueue<T>::allocatorCalls() {
+	return ObjectPool<Node>::allocatorCalls();
+}
+
+}
+
+#endif // NODEBUS_MPSCQUEUE_H
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Object pool
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_OBJECTPOOL_H
+#define NODEBUS_OBJECTPOOL_H
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stddef.h>
+
+/// @brief Maximum number of free blocks kept by each thread
+#define NODEBUS_OBJECTPOOL_LOCAL_SIZE 256
+/// @brief Number of blocks moved between a thread and the global overflow list
+#define NODEBUS_OBJECTPOOL_BATCH_SIZE 64
+/// @brief Maximum number of free blocks kept in the global overflow list
+#define NODEBUS_OBJECTPOOL_GLOBAL_SIZE 4096
+
+/**
+ * @brief Declare class level new/delete operators backed by an object pool
+ * 
+ * Must be used inside the class declaration. Derived classes with a
+ * different size fall back to the global allocator.
+ */
+#define nodebus_declare_pooled(cname) \
+public:\
+	inline static void *operator new(size_t size) {\
+		return NodeBus::ObjectPool<cname>::allocate(size);\
+	}\
+	\
+	inline static void operator delete(void *ptr, size_t size) {\
+		NodeBus::ObjectPool<cname>::release(ptr, size);\
+	}
+
+namespace NodeBus {
+
+/**
+ * @brief Fixed size object pool
+ * 
+ * Released blocks are kept in a thread local free list. When it exceeds
+ * NODEBUS_OBJECTPOOL_LOCAL_SIZE entries, a batch is moved to a global
+ * overflow list where other threads (e.g. the ones allocating objects
+ * released by a worker) pick them up.
+ */
+template <typename T> class ObjectPool {
+public:
+	/**
+	 * @brief Allocate a block
+	 * 
+	 * @param size requested size
+	 * @return the block address
+	 */
+	static void *allocate(size_t size);
+	
+	/**
+	 * @brief Release a block
+	 * 
+	 * @param ptr block address
+	 * @param size block size
+	 */
+	static void release(void *ptr, size_t size);
+	
+	/**
+	 * @brief Get the number of calls to the global allocator
+	 * 
+	 * @return the allocation count
+	 */
+	static uint64_t allocatorCalls();
+	
+	/**
+	 * @brief Get the number of calls to the global deallocator
+	 * 
+	 * @return the deallocation count
+	 */
+	static uint64_t deallocatorCalls();
+	
+private:
+	struct Block {
+		Block *next;
+	};
+	
+	struct LocalList {
+		Block *head;
+		size_t count;
+		LocalList();
+		~LocalList();
+	};
+	
+	static const size_t BLOCK_SIZE = sizeof(T) < sizeof(Block) ? sizeof(Block) : sizeof(T);
+	
+	static LocalList &local();
+	static void pushGlobal(LocalList &list, size_t count);
+	static void popGlobal(LocalList &list);
+	
+	/// @brief Set once the thread local list is destroyed, on thread exit
+	static thread_local bool s_localDestroyed;
+	static std::mutex s_lock;
+	static Block *s_head;
+	static size_t s_count;
+	static std::atomic_uint_fast64_t s_allocatorCalls;
+	static std::atomic_uint_fast64_t s_deallocatorCalls;
+};
+
+template <typename T> thread_local bool ObjectPool<T>::s_localDestroyed = false;
+template <typename T> std::mutex ObjectPool<T>::s_lock;
+template <typename T> typename ObjectPool<T>::Block *ObjectPool<T>::s_head = nullptr;
+template <typename T> size_t ObjectPool<T>::s_count = 0;
+template <typename T> std::atomic_uint_fast64_t ObjectPool<T>::s_allocatorCalls(0);
+template <typename T> std::atomic_uint_fast64_t ObjectPool<T>::s_deallocatorCalls(0);
+
+template <typename T>
+inline ObjectPool<T>::LocalList::LocalList(): head(nullptr), count(0) {
+}
+
+template <typename T>
+ObjectPool<T>::LocalList::~LocalList() {
+	pushGlobal(*this, count);
+	s_localDestroyed = true;
+}
+
+template <typename T>
+inline typename ObjectPool<T>::LocalList &ObjectPool<T>::local() {
+	static thread_local LocalList list;
+	return list;
+}
+
+template <typename T>
+void ObjectPool<T>::pushGlobal(LocalList &list, size_t count) {
+	std::lock_guard<std::mutex> _(s_lock);
+	while (count > 0 && list.head != nullptr) {
+		Block *block = list.head;
+		list.head = block->next;
+		list.count--;
+		count--;
+		if (s_count < NODEBUS_OBJECTPOOL_GLOBAL_SIZE) {
+			block->next = s_head;
+			s_head = block;
+			s_count++;
+		} else {
+			s_deallocatorCalls.fetch_add(1, std::memory_order_relaxed);
+			::operator delete(block);
+		}
+	}
+}
+
+template <typename T>
+void ObjectPool<T>::popGlobal(LocalList &list) {
+	std::lock_guard<std::mutex> _(s_lock);
+	for (size_t i = 0; i < NODEBUS_OBJECTPOOL_BATCH_SIZE && s_head != nullptr; i++) {
+		Block *block = s_head;
+		s_head = block->next;
+		s_count--;
+		block->next = list.head;
+		list.head = block;
+		list.count++;
+	}
+}
+
+template <typename T>
+void *ObjectPool<T>::allocate(size_t size) {
+	if (size != sizeof(T)) {
+		return ::operator new(size);
+	}
+	if (s_localDestroyed) {
+		// Thread exit or static destruction: the local list is gone
+		s_allocatorCalls.fetch_add(1, std::memory_order_relaxed);
+		return ::operator new(BLOCK_SIZE);
+	}
+	LocalList &list = local();
+	if (list.head == nullptr) {
+		popGlobal(list);
+		if (list.head == nullptr) {
+			s_allocatorCalls.fetch_add(1, std::memory_order_relaxed);
+			return ::operator new(BLOCK_SIZE);
+		}
+	}
+	Block *block = list.head;
+	list.head = block->next;
+	list.count--;
+	return block;
+}
+
+template <typename T>
+void ObjectPool<T>::release(void *ptr, size_t size) {
+	if (ptr == nullptr) {
+		return;
+	}
+	if (size != sizeof(T)) {
+		::operator delete(ptr);
+		return;
+	}
+	if (s_localDestroyed) {
+		s_deallocatorCalls.fetch_add(1, std::memory_order_relaxed);
+		::operator delete(ptr);
+		return;
+	}
+	LocalList &list = local();
+	Block *block = static_cast<Block*>(ptr);
+	block->next = list.head;
+	list.head = block;
+	list.count++;
+	if (list.count > NODEBUS_OBJECTPOOL_LOCAL_SIZE) {
+		pushGlobal(list, NODEBUS_OBJECTPOOL_BATCH_SIZE);
+	}
+}
+
+template <typename T>
+inline uint64_t ObjectPool<T>::allocatorCalls() {
+	return s_allocatorCalls;
+}
+
+template <typename T>
+inline uint64_t ObjectPool<T>::deallocatorCalls() {
+	return s_deallocatorCalls;
+}
+
+}
+
+#endif // NODEBUS_OBJECTPOOL_H
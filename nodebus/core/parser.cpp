@@ -72,6 +72,10 @@ Parser::Parser(DataStream &dataStream, FileFormat format)
 	}
 }
 
+QVariantMap Parser::allocatorCalls() {
+	return jsonparser::Driver::allocatorCalls();
+}
+
 QVariant Parser::parse(const QByteArray& data, FileFormat format) {
 	QByteArray byteArray(data);
 	QBuffer buf(&byteArray);
@@ -31,6 +31,7 @@
 #include <nodebus/core/global.h>
 #include <nodebus/core/datastream.h>
 #include <QByteArray>
+#include <QVariant>
 
 #ifndef NODEBUS_EXPORT
 #define NODEBUS_EXPORT
@@ -85,6 +86,12 @@ public:
 	 */
 	static QVariant parse(const QByteArray &data, FileFormat format = JSON);
 	
+	/**
+	 * @brief Get the global allocator calls of the JSON parser pools
+	 * @return call counts indexed by type name
+	 */
+	static QVariantMap allocatorCalls();
+	
 private:
 	bool parseBCON(QVariant &res, QString* key);
 	template <typename T> T read();
@@ -19,16 +19,55 @@
 #include <common.h>
 #include "logger.h"
 #include "shareddata.h"
+#include "census.h"
 
 namespace NodeBus {
 
-std::atomic_uint_fast64_t __nodebus_shared_data_count;
-
-SharedData::SharedData(): ptrNbRef(0) {
-	__nodebus_shared_data_count++;
+SharedData::SharedData(): ptrNbRef(0), m_weakRef(nullptr), m_censusType(nullptr) {
+	Census::increment();
 }
 SharedData::~SharedData() {
-	__nodebus_shared_data_count--;
+	SharedDataWeakRef *ref = m_weakRef.load();
+	if (ref != nullptr) {
+		ref->detach();
+		ref->release();
+	}
+	Census::decrement(this);
+}
+
+SharedDataWeakRef *SharedData::weakRef() {
+	SharedDataWeakRef *ref = m_weakRef.load();
+	if (ref == nullptr) {
+		SharedDataWeakRef *newRef = new SharedDataWeakRef(this);
+		if (m_weakRef.compare_exchange_strong(ref, newRef)) {
+			ref = newRef;
+		} else {
+			delete newRef;
+		}
+	}
+	ref->nbRef++;
+	return ref;
+}
+
+SharedData *SharedDataWeakRef::acquire() {
+	SharedData *data = nullptr;
+	while (m_lock.test_and_set(std::memory_order_acquire));
+	if (m_data != nullptr) {
+		// The data is alive as long as at least one strong reference remains
+		uint_fast16_t count = m_data->ptrNbRef.load();
+		while (count != 0 && !m_data->ptrNbRef.compare_exchange_weak(count, count + 1));
+		if (count != 0) {
+			data = m_data;
+		}
+	}
+	m_lock.clear(std::memory_order_release);
+	return data;
+}
+
+void SharedDataWeakRef::detach() {
+	while (m_lock.test_and_set(std::memory_order_acquire));
+	m_data = nullptr;
+	m_lock.clear(std::memory_order_release);
 }
 
 }
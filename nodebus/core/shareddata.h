@@ -20,10 +20,56 @@
 #define NODEBUS_SHAREDDATA_H
 
 #include <atomic>
+#include <typeinfo>
 
 namespace NodeBus {
 
+class SharedData;
+
+/**
+ * @brief Weak reference control block
+ * 
+ * Allocated on demand by the first weak pointer and shared between
+ * the data and every weak pointer referring to it. It outlives the
+ * data until the last weak pointer is released.
+ */
+class SharedDataWeakRef {
+public:
+	/// @brief Reference count (the data holds one reference itself)
+	std::atomic_uint_fast32_t nbRef;
+	
+	/**
+	 * @brief Weak reference constructor
+	 * 
+	 * @param data referred data
+	 */
+	SharedDataWeakRef(SharedData *data);
+	
+	/**
+	 * @brief Try to acquire a strong reference on the referred data
+	 * 
+	 * @return the data address with its reference count incremented or
+	 * nullptr if the data is being destroyed
+	 */
+	SharedData *acquire();
+	
+	/**
+	 * @brief Detach the referred data (called on data destruction)
+	 */
+	void detach();
+	
+	/**
+	 * @brief Release one reference, delete this block on the last one
+	 */
+	void release();
+private:
+	SharedData *m_data;
+	std::atomic_flag m_lock;
+};
+
 class SharedData {
+	friend class SharedDataWeakRef;
+	friend class Census;
 public:
 	/// @brief Reference count
 	std::atomic_uint_fast16_t ptrNbRef;
@@ -37,11 +83,30 @@ public:
 	 * @brief Shared data destructor
 	 */ 
 	virtual ~SharedData();
+	
+	/**
+	 * @brief Get the weak reference control block, allocate it if needed
+	 * 
+	 * @return the control block with its reference count incremented
+	 */
+	SharedDataWeakRef *weakRef();
 private:
 	SharedData(const SharedData& other);
     SharedData &operator=(const SharedData &);
+	std::atomic<SharedDataWeakRef*> m_weakRef;
+	const std::type_info *m_censusType;
 };
 
+inline SharedDataWeakRef::SharedDataWeakRef(SharedData *data): nbRef(1), m_data(data) {
+	m_lock.clear();
+}
+
+inline void SharedDataWeakRef::release() {
+	if (nbRef.fetch_sub(1) == 1) {
+		delete this;
+	}
+}
+
 // inline SharedData::SharedData(): ref(0) {
 // }
 // inline SharedData::~SharedData() {
@@ -189,6 +189,8 @@ extern void __raise_InvalidClassException();
 extern void __raise_NullPointerException();
 void __log_data_ref_init(void* data);
 void __log_data_ref_delete(void* data);
+void __census_record(SharedData *data);
+extern std::atomic_bool __nodebus_census_enabled;
 
 #ifdef NODEBUS_SHAREDPTR_DEBUG
 #define __NODEBUS_SHAREDPTR_DEBUG_NEW() if (m_data->ptrNbRef == 0) __log_data_ref_init(m_data)
@@ -198,6 +200,9 @@ void __log_data_ref_delete(void* data);
 #define __NODEBUS_SHAREDPTR_DEBUG_DEL()
 #endif
 
+#define __NODEBUS_SHAREDPTR_CENSUS_NEW() \
+	if (__nodebus_census_enabled.load(std::memory_order_relaxed) && m_data->ptrNbRef == 0) __census_record(m_data)
+
 template <typename T>
 inline SharedPtr<T>::SharedPtr(): m_data(nullptr) {}
 template <typename T>
@@ -216,6 +221,7 @@ inline SharedPtr<T>::SharedPtr(T* data): m_data(data) {
 			__raise_InvalidClassException();
 		}
 		__NODEBUS_SHAREDPTR_DEBUG_NEW();
+		__NODEBUS_SHAREDPTR_CENSUS_NEW();
 		m_data->ptrNbRef++;
 	}
 }
@@ -226,6 +232,7 @@ inline SharedPtr<T>::SharedPtr(const SharedPtr< T >& other): m_data(other.m_data
 			__raise_InvalidClassException();
 		}
 		__NODEBUS_SHAREDPTR_DEBUG_NEW();
+		__NODEBUS_SHAREDPTR_CENSUS_NEW();
 		m_data->ptrNbRef++;
 	}
 }
@@ -237,6 +244,7 @@ inline SharedPtr<T>::SharedPtr(const SharedPtr< X >& other): m_data((T*)(other.d
 			__raise_InvalidClassException();
 		}
 		__NODEBUS_SHAREDPTR_DEBUG_NEW();
+		__NODEBUS_SHAREDPTR_CENSUS_NEW();
 		m_data->ptrNbRef++;
 	}
 }
@@ -269,6 +277,7 @@ SharedPtr<T>& SharedPtr<T>::operator=(const SharedPtr<X>& other) {
 	m_data = (T*)(other.data());
 	if (m_data != nullptr) {
 		__NODEBUS_SHAREDPTR_DEBUG_NEW();
+		__NODEBUS_SHAREDPTR_CENSUS_NEW();
 		m_data->ptrNbRef++;
 	}
 	return *this;
@@ -289,6 +298,7 @@ SharedPtr<T>& SharedPtr<T>::operator=(const T *data) {
 	m_data = const_cast<T*>(data);
 	if (m_data != nullptr) {
 		__NODEBUS_SHAREDPTR_DEBUG_NEW();
+		__NODEBUS_SHAREDPTR_CENSUS_NEW();
 		m_data->ptrNbRef++;
 	}
 	return *this;
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Coroutine task
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_TASK_H
+#define NODEBUS_TASK_H
+
+#ifdef NODEBUS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace NodeBus {
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+/**
+ * @brief Resume the awaiting coroutine once a task is done
+ */
+struct TaskFinalAwaiter {
+	bool await_ready() noexcept {
+		return false;
+	}
+	
+	template <typename P>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+		std::coroutine_handle<> continuation = handle.promise().m_continuation;
+		return continuation ? continuation : std::noop_coroutine();
+	}
+	
+	void await_resume() noexcept {
+	}
+};
+
+struct TaskPromiseBase {
+	std::coroutine_handle<> m_continuation;
+	std::exception_ptr m_exception;
+	
+	std::suspend_always initial_suspend() noexcept {
+		return {};
+	}
+	
+	TaskFinalAwaiter final_suspend() noexcept {
+		return {};
+	}
+	
+	void unhandled_exception() {
+		m_exception = std::current_exception();
+	}
+};
+
+template <typename T>
+struct TaskPromise: public TaskPromiseBase {
+	T m_value;
+	
+	Task<T> get_return_object();
+	
+	void return_value(T value) {
+		m_value = std::move(value);
+	}
+	
+	T result() {
+		if (m_exception) {
+			std::rethrow_exception(m_exception);
+		}
+		return std::move(m_value);
+	}
+};
+
+template <>
+struct TaskPromise<void>: public TaskPromiseBase {
+	Task<void> get_return_object();
+	
+	void return_void() {
+	}
+	
+	void result() {
+		if (m_exception) {
+			std::rethrow_exception(m_exception);
+		}
+	}
+};
+
+}
+
+/**
+ * @brief Lazily started coroutine
+ * 
+ * A task runs when it is awaited by another coroutine, which is resumed
+ * once the task is done (symmetric transfer, no stack growth). The value
+ * returned by the task, or the exception it throws, is given to the
+ * awaiting coroutine. A root task is driven by resume().
+ */
+template <typename T>
+class Task {
+public:
+	typedef detail::TaskPromise<T> promise_type;
+	typedef std::coroutine_handle<promise_type> Handle;
+	
+	Task(): m_handle(nullptr) {
+	}
+	
+	explicit Task(Handle handle): m_handle(handle) {
+	}
+	
+	Task(Task &&other) noexcept: m_handle(std::exchange(other.m_handle, nullptr)) {
+	}
+	
+	Task &operator=(Task &&other) noexcept {
+		if (this != &other) {
+			if (m_handle) {
+				m_handle.destroy();
+			}
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+	
+	~Task() {
+		if (m_handle) {
+			m_handle.destroy();
+		}
+	}
+	
+	/**
+	 * @brief Test if the task is done
+	 * @return true once the task returned or threw
+	 */
+	bool isDone() const {
+		return !m_handle || m_handle.done();
+	}
+	
+	/**
+	 * @brief Start or resume a root task
+	 */
+	void resume() {
+		m_handle.resume();
+	}
+	
+	/**
+	 * @brief Get the result of a done task
+	 * @return the returned value
+	 * @throw the exception thrown by the task
+	 */
+	T result() {
+		return m_handle.promise().result();
+	}
+	
+	bool await_ready() const noexcept {
+		return false;
+	}
+	
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+		m_handle.promise().m_continuation = awaiting;
+		return m_handle;
+	}
+	
+	T await_resume() {
+		return m_handle.promise().result();
+	}
+	
+private:
+	Task(const Task&) = delete;
+	Task &operator=(const Task&) = delete;
+	
+	Handle m_handle;
+};
+
+template <typename T>
+inline Task<T> detail::TaskPromise<T>::get_return_object() {
+	return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object() {
+	return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+}
+
+#endif // NODEBUS_COROUTINES
+
+#endif // NODEBUS_TASK_H
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NODEBUS_WEAKPTR_H
+#define NODEBUS_WEAKPTR_H
+
+#include <nodebus/core/sharedptr.h>
+
+namespace NodeBus {
+
+/**
+ * @brief NodeBus : Weak pointer
+ * 
+ * Refers to a shared data without holding it. It is used to break
+ * reference cycles between shared data: the pointed data is deleted as soon
+ * as its last SharedPtr is released, and the weak pointer becomes null.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+template <typename T> class WeakPtr {
+	SharedDataWeakRef *m_ref;
+public:
+	/**
+	 * @brief Default weak pointer constructor
+	 */
+	WeakPtr();
+	
+	/**
+	 * @brief Weak pointer constructor from a shared pointer
+	 * 
+	 * @param other shared pointer
+	 */
+	template<class X>
+	WeakPtr(const SharedPtr<X> &other);
+	
+	/**
+	 * @brief Weak pointer constructor from a data address
+	 * 
+	 * @param data address to a data
+	 */
+	WeakPtr(T *data);
+	
+	/**
+	 * @brief Weak pointer copy constructor
+	 * 
+	 * @param other pointer
+	 */
+	WeakPtr(const WeakPtr<T> &other);
+	
+	/**
+	 * @brief Weak pointer destructor
+	 */
+	~WeakPtr();
+	
+	/**
+	 * @brief Affectation operator
+	 * 
+	 * @param other pointer
+	 * @return a reference to the pointer
+	 */
+	WeakPtr<T> &operator= (const WeakPtr<T>& other);
+	
+	/**
+	 * @brief Affectation operator
+	 * 
+	 * @param other shared pointer
+	 * @return a reference to the pointer
+	 */
+	template<class X>
+	WeakPtr<T> &operator= (const SharedPtr<X>& other);
+	
+	/**
+	 * @brief Update the internal pointer to a given data address
+	 * 
+	 * @param data data address
+	 * @return a reference to the pointer
+	 */
+	WeakPtr<T> &operator= (T *data);
+	
+	/**
+	 * @brief Get a shared pointer to the referred data
+	 * 
+	 * @return a shared pointer to the data or a null pointer if the data
+	 * has been released
+	 */
+	SharedPtr<T> lock() const;
+	
+	/**
+	 * @brief Test if the referred data has been released
+	 * 
+	 * @return true if the data is no longer available, otherwise false
+	 */
+	bool isNull() const;
+	
+private:
+	void reset(SharedData *data);
+};
+
+template <typename T>
+inline WeakPtr<T>::WeakPtr(): m_ref(nullptr) {}
+template <typename T>
+template <typename X>
+inline WeakPtr<T>::WeakPtr(const SharedPtr<X> &other): m_ref(nullptr) {
+	if (other.data() != nullptr && dynamic_cast<const T*>(other.data()) == nullptr) {
+		__raise_InvalidClassException();
+	}
+	reset(const_cast<X*>(other.data()));
+}
+template <typename T>
+inline WeakPtr<T>::WeakPtr(T *data): m_ref(nullptr) {
+	reset(data);
+}
+template <typename T>
+inline WeakPtr<T>::WeakPtr(const WeakPtr<T> &other): m_ref(other.m_ref) {
+	if (m_ref != nullptr) {
+		m_ref->nbRef++;
+	}
+}
+template <typename T>
+inline WeakPtr<T>::~WeakPtr() {
+	if (m_ref != nullptr) {
+		m_ref->release();
+	}
+}
+template <typename T>
+inline void WeakPtr<T>::reset(SharedData *data) {
+	SharedDataWeakRef *ref = (data == nullptr) ? nullptr : data->weakRef();
+	if (m_ref != nullptr) {
+		m_ref->release();
+	}
+	m_ref = ref;
+}
+template <typename T>
+inline WeakPtr<T> &WeakPtr<T>::operator=(const WeakPtr<T> &other) {
+	if (other.m_ref != nullptr) {
+		other.m_ref->nbRef++;
+	}
+	if (m_ref != nullptr) {
+		m_ref->release();
+	}
+	m_ref = other.m_ref;
+	return *this;
+}
+template <typename T>
+template <typename X>
+inline WeakPtr<T> &WeakPtr<T>::operator=(const SharedPtr<X> &other) {
+	if (other.data() != nullptr && dynamic_cast<const T*>(other.data()) == nullptr) {
+		__raise_InvalidClassException();
+	}
+	reset(const_cast<X*>(other.data()));
+	return *this;
+}
+template <typename T>
+inline WeakPtr<T> &WeakPtr<T>::operator=(T *data) {
+	reset(data);
+	return *this;
+}
+template <typename T>
+SharedPtr<T> WeakPtr<T>::lock() const {
+	SharedPtr<T> ptr;
+	if (m_ref == nullptr) {
+		return ptr;
+	}
+	SharedData *data = m_ref->acquire();
+	if (data != nullptr) {
+		ptr = static_cast<T*>(data);
+		// Drop the reference taken by acquire(), ptr keeps its own one
+		data->ptrNbRef--;
+	}
+	return ptr;
+}
+template <typename T>
+inline bool WeakPtr<T>::isNull() const {
+	return lock() == nullptr;
+}
+
+}
+
+#endif // NODEBUS_WEAKPTR_H
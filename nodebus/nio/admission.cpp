@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "admission.h"
+#include <QMap>
+#include <QMutex>
+#include <limits>
+#include <time.h>
+
+namespace NodeBus {
+
+static QMutex s_registryLock;
+static QMap<QString, Admission*> s_registry;
+
+Admission::Admission(const QString &name, int limit, int target, int interval)
+: m_name(name), m_limit(limit), m_target(qint64(target) * 1000), m_interval(qint64(interval) * 1000),
+m_queued(0), m_intervalEnd(now() + m_interval), m_minDelay(std::numeric_limits<qint64>::max()), m_lastMinDelay(0),
+m_overloaded(false), m_dispatched(0), m_shed(0), m_deferred(0) {
+	QMutexLocker _(&s_registryLock);
+	s_registry.insert(m_name, this);
+}
+
+Admission::~Admission() {
+	QMutexLocker _(&s_registryLock);
+	if (s_registry.value(m_name) == this) {
+		s_registry.remove(m_name);
+	}
+}
+
+qint64 Admission::enqueue() {
+	m_queued++;
+	return m_target > 0 ? now() : 0;
+}
+
+bool Admission::dequeue(qint64 queuedAt) {
+	m_queued--;
+	m_dispatched++;
+	if (m_target == 0) {
+		return false;
+	}
+	qint64 time = now();
+	qint64 delay = time - queuedAt;
+	qint64 min = m_minDelay.load(std::memory_order_relaxed);
+	while (delay < min && !m_minDelay.compare_exchange_weak(min, delay, std::memory_order_relaxed));
+	qint64 end = m_intervalEnd.load(std::memory_order_relaxed);
+	if (time >= end && m_intervalEnd.compare_exchange_strong(end, time + m_interval)) {
+		// Closed by a single thread: a delay which never goes below the
+		// target over a whole interval is a standing queue, not a burst
+		min = m_minDelay.exchange(std::numeric_limits<qint64>::max());
+		m_lastMinDelay = min;
+		m_overloaded = min > m_target;
+	}
+	// Only the tasks waiting longer than the target are shed
+	return m_overloaded.load(std::memory_order_relaxed) && delay > m_target;
+}
+
+QVariantMap Admission::stats() {
+	QVariantMap res;
+	res["queued"] = m_queued.load();
+	res["dispatched"] = (qulonglong)m_dispatched.load();
+	res["shed"] = (qulonglong)m_shed.load();
+	res["deferred"] = (qulonglong)m_deferred.load();
+	res["overloaded"] = isOverloaded();
+	res["min-delay"] = (qlonglong)m_lastMinDelay.load();
+	return res;
+}
+
+QVariantMap Admission::allStats() {
+	QMutexLocker _(&s_registryLock);
+	QVariantMap res;
+	for (auto it = s_registry.begin(); it != s_registry.end(); it++) {
+		res[it.key()] = it.value()->stats();
+	}
+	return res;
+}
+
+qint64 Admission::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Admission control
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_ADMISSION_H
+#define NODEBUS_ADMISSION_H
+
+#include <nodebus/core/sharedptr.h>
+#include <QString>
+#include <QVariant>
+#include <atomic>
+
+/// @brief Default queue delay target in milliseconds
+#define NODEBUS_ADMISSION_TARGET 5
+/// @brief Default queue delay measurement interval in milliseconds
+#define NODEBUS_ADMISSION_INTERVAL 100
+
+namespace NodeBus {
+
+/**
+ * @brief Admission control of a listener
+ * 
+ * Bounds the peer tasks queued to the executor and tells when they must
+ * be shed. The overload is detected from the time the tasks wait in the
+ * queue rather than from its length (CoDel): the listener is overloaded
+ * once the minimum queue delay over an interval exceeds the target, a
+ * queue which is only full because of a burst drains within the target.
+ * While overloaded, the tasks which waited longer than the target are
+ * shed and the new connections are deferred.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+class Admission: public SharedData {
+public:
+	/**
+	 * @brief Admission constructor
+	 * @param name listener name, key of the statistics
+	 * @param limit maximum number of queued tasks, 0 for no limit
+	 * @param target queue delay target in milliseconds, 0 to disable the
+	 * delay based shedding
+	 * @param interval queue delay measurement interval in milliseconds
+	 */
+	Admission(const QString &name, int limit = 0, int target = NODEBUS_ADMISSION_TARGET,
+		int interval = NODEBUS_ADMISSION_INTERVAL);
+	
+	/**
+	 * @brief Admission destructor
+	 */
+	virtual ~Admission();
+	
+	/**
+	 * @brief Account a task queued to the executor
+	 * @return queuing time to give to dequeue()
+	 */
+	qint64 enqueue();
+	
+	/**
+	 * @brief Account a task leaving the queue to run
+	 * @param queuedAt time returned by enqueue()
+	 * @return true if the task must be shed, otherwise false
+	 */
+	bool dequeue(qint64 queuedAt);
+	
+	/**
+	 * @brief Test if the queue limit is reached
+	 * @return true if full, otherwise false
+	 */
+	bool isFull();
+	
+	/**
+	 * @brief Test if the queue delay stays above the target
+	 * 
+	 * An empty queue is never overloaded: the state is only updated when
+	 * tasks leave the queue.
+	 * 
+	 * @return true if overloaded, otherwise false
+	 */
+	bool isOverloaded();
+	
+	/**
+	 * @brief Count a shed task
+	 */
+	void countShed();
+	
+	/**
+	 * @brief Count a deferred connection accept
+	 */
+	void countDeferred();
+	
+	/**
+	 * @brief Get the counters of this listener
+	 * @return queued, dispatched, shed and deferred counts, overload state,
+	 * last interval minimum queue delay in microseconds
+	 */
+	QVariantMap stats();
+	
+	/**
+	 * @brief Get the counters of all the listeners
+	 * @return statistics per listener name
+	 */
+	static QVariantMap allStats();
+	
+	/**
+	 * @brief Get the monotonic time
+	 * @return time in microseconds
+	 */
+	static qint64 now();
+	
+private:
+	QString m_name;
+	int m_limit;
+	qint64 m_target;
+	qint64 m_interval;
+	std::atomic<int> m_queued;
+	std::atomic<qint64> m_intervalEnd;
+	std::atomic<qint64> m_minDelay;
+	std::atomic<qint64> m_lastMinDelay;
+	std::atomic<bool> m_overloaded;
+	std::atomic<quint64> m_dispatched;
+	std::atomic<quint64> m_shed;
+	std::atomic<quint64> m_deferred;
+};
+
+inline bool Admission::isFull() {
+	return m_limit > 0 && m_queued.load(std::memory_order_relaxed) >= m_limit;
+}
+
+inline bool Admission::isOverloaded() {
+	return m_overloaded.load(std::memory_order_relaxed) && m_queued.load(std::memory_order_relaxed) > 0;
+}
+
+inline void Admission::countShed() {
+	m_shed++;
+}
+
+inline void Admission::countDeferred() {
+	m_deferred++;
+}
+
+typedef SharedPtr<Admission> AdmissionPtr;
+
+}
+
+#endif // NODEBUS_ADMISSION_H
@@ -35,9 +35,20 @@ Channel::Channel(): m_active(true) {
 }
 
 Channel::~Channel() {
-	auto list = m_keys.values();
+	cancelKeys();
+}
+
+void Channel::cancelKeys() {
+	QList<WeakPtr<SelectionKey> > list;
+	{
+		QMutexLocker _(&m_keysLock);
+		list = m_keys.values();
+	}
 	for (auto it = list.begin(); it != list.end(); it++) {
-		(*it)->cancel();
+		SelectionKeyPtr key = it->lock();
+		if (key != nullptr) {
+			key->cancel();
+		}
 	}
 }
 
@@ -46,25 +57,53 @@ void Channel::closeChannel() {
 		return;
 	}
 	m_active = false;
-	auto list = m_keys.values();
-	for (auto it = list.begin(); it != list.end(); it++) {
-		(*it)->cancel();
+	cancelKeys();
+	closeFd();
+}
+
+void Channel::shutdownChannel() {
+	if (!m_active) {
+		return;
 	}
+	m_active = false;
+	cancelKeys();
+	shutdownFd();
+}
+
+void Channel::shutdownFd() {
 	closeFd();
 }
 
 SelectionKeyPtr Channel::registerTo(Selector& selector, int options, GenericPtr attachement) {
-	if (m_keys.contains(&selector)) {
-		m_keys[&selector]->cancel();
+	SelectionKeyPtr key = keyFor(selector);
+	if (key != nullptr && key->isValid()) {
+		key->attach(attachement);
+		key->addInterestOps(options);
+		return key;
 	}
 	return new SelectionKey(selector, this, options, attachement);
 }
 
-SharedPtr< SelectionKey > Channel::keyFor(Selector& selector) {
-	if (m_keys.contains(&selector)) {
-		return m_keys[&selector];
+bool Channel::armKeys(int ops) {
+	bool armed = false;
+	QList<WeakPtr<SelectionKey> > list;
+	{
+		QMutexLocker _(&m_keysLock);
+		list = m_keys.values();
 	}
-	return nullptr;
+	for (auto it = list.begin(); it != list.end(); it++) {
+		SelectionKeyPtr key = it->lock();
+		if (key != nullptr && key->isValid()) {
+			key->addInterestOps(ops);
+			armed = true;
+		}
+	}
+	return armed;
+}
+
+SharedPtr< SelectionKey > Channel::keyFor(Selector& selector) {
+	QMutexLocker _(&m_keysLock);
+	return m_keys.value(&selector).lock();
 }
 
 }
@@ -22,7 +22,10 @@
 #include <nodebus/core/shareddata.h>
 #include <nodebus/core/exception.h>
 #include <nodebus/core/sharedptr.h>
+#include <nodebus/core/weakptr.h>
 #include <nodebus/nio/selector.h>
+#include <QMutex>
+#include <QMap>
 
 /**
  * @namespace
@@ -57,6 +60,10 @@ public:
 	/**
 	 * @brief Register this channel to the given selector
 	 * 
+	 * The selection key persists across selections: registering again
+	 * arms the existing key for the given operations in addition to the
+	 * ones already armed instead of creating a new one.
+	 * 
 	 * @param selector Reference to the selector
 	 * @param options SelectionKey::Flag
 	 * @param attachement Pointer to an optional attachement
@@ -74,13 +81,38 @@ public:
 	
 protected:
 	virtual void closeChannel();
+	
+	/**
+	 * @brief Close this channel, the file descriptor is kept until it is released
+	 * 
+	 * For a close decided by another thread than the owner of the channel:
+	 * a concurrent read gets an end of file instead of reading from a
+	 * reused descriptor.
+	 */
+	void shutdownChannel();
+	
+	/**
+	 * @brief Arm all the selection keys of this channel for the given operations
+	 * @param ops SelectionKey::Flag combination
+	 * @return false if the channel is not registered to any selector
+	 */
+	bool armKeys(int ops);
 	virtual int &fd() = 0;
 	virtual void closeFd() = 0;
+	
+	/**
+	 * @brief Stop the I/O on the file descriptor, closed once the channel is released
+	 */
+	virtual void shutdownFd();
 	virtual void updateStatus(int events) = 0;
 	bool m_active;
 	
 private:
-	QMap<Selector*, SharedPtr<SelectionKey> > m_keys;
+	void cancelKeys();
+	
+	/// @brief Keys of the selectors, locked after the selector
+	QMutex m_keysLock;
+	QMap<Selector*, WeakPtr<SelectionKey> > m_keys;
 };
 
 typedef SharedPtr<Channel> ChannelPtr;
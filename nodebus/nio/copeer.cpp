@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "copeer.h"
+
+#ifdef NODEBUS_COROUTINES
+
+#include <nodebus/core/executor.h>
+#include <nodebus/nio/selectionkey.h>
+#include <nodebus/nio/selector.h>
+
+namespace NodeBus {
+
+CoPeer::CoPeer(SocketChannelPtr socket)
+: Peer(socket), m_waiting(nullptr), m_wakeups(0), m_waitOutput(0), m_wakeTimer(this) {
+}
+
+CoPeer::~CoPeer() {
+}
+
+void CoPeer::process() {
+	// Already running in another worker, which resumes once more for us
+	if (m_wakeups.fetchAndAddOrdered(1) != 0) {
+		return;
+	}
+	int count = 1;
+	do {
+		if (m_main.isDone() && m_waiting == nullptr) {
+			m_main = run();
+			m_main.resume();
+		} else if (m_waiting != nullptr) {
+			std::exchange(m_waiting, nullptr).resume();
+		}
+		if (m_main.isDone()) {
+			// Left acquired: there is nothing to resume anymore
+			m_wakeTimer.cancel();
+			m_main.result();
+			cancel();
+			return;
+		}
+	} while ((count = m_wakeups.fetchAndAddOrdered(-count) - count) > 0);
+}
+
+bool CoPeer::waitsForOutput() {
+	return m_waitOutput != 0;
+}
+
+qint64 CoPeer::deadline(int msecs) {
+	return msecs < 0 ? -1 : TimerWheel::now() + msecs;
+}
+
+bool CoPeer::wait(int ops, qint64 deadline) {
+	TimerWheel *wheel = timers();
+	if (deadline != -1) {
+		qint64 left = deadline - TimerWheel::now();
+		if (left <= 0) {
+			return false;
+		}
+		m_wakeTimer.start(*wheel, left);
+	}
+	if (ops != 0) {
+		SocketChannelPtr socket = m_socket;
+		if (socket == nullptr) {
+			throw EOFException("Closed channel");
+		}
+		if (ops & SelectionKey::OP_READ) {
+			startIdleTimer(*wheel);
+		}
+		socket->registerTo(*wheel->selector(), ops, PeerPtr(this));
+	}
+	return true;
+}
+
+Task<bool> CoPeer::readable(int msecs) {
+	qint64 end = deadline(msecs);
+	for (;;) {
+		SocketChannelPtr socket = m_socket;
+		if (socket == nullptr) {
+			throw EOFException("Closed channel");
+		}
+		if (socket->available() > 0) {
+			co_return true;
+		}
+		if (!wait(SelectionKey::OP_READ, end)) {
+			co_return false;
+		}
+		co_await Suspend{this};
+		stopIdleTimer();
+		m_wakeTimer.cancel();
+	}
+}
+
+Task<bool> CoPeer::writable(int msecs) {
+	qint64 end = deadline(msecs);
+	bool result = true;
+	m_waitOutput = 1;
+	for (;;) {
+		SocketChannelPtr socket = m_socket;
+		if (socket == nullptr || !socket->isSaturated()) {
+			break;
+		}
+		if (!wait(SelectionKey::OP_WRITE, end)) {
+			result = false;
+			break;
+		}
+		co_await Suspend{this};
+		m_wakeTimer.cancel();
+	}
+	m_waitOutput = 0;
+	co_return result;
+}
+
+Task<bool> CoPeer::messageAvailable(char delimiter, int msecs) {
+	qint64 end = deadline(msecs);
+	for (;;) {
+		SocketChannelPtr socket = m_socket;
+		if (socket == nullptr) {
+			throw EOFException("Closed channel");
+		}
+		if (socket->contains(delimiter) || socket->available() >= socket->bufferSize()) {
+			co_return true;
+		}
+		if (!wait(SelectionKey::OP_READ, end)) {
+			co_return false;
+		}
+		co_await Suspend{this};
+		stopIdleTimer();
+		m_wakeTimer.cancel();
+	}
+}
+
+Task<> CoPeer::sleep(int msecs) {
+	qint64 end = deadline(qMax(msecs, 0));
+	while (wait(0, end)) {
+		co_await Suspend{this};
+	}
+}
+
+CoPeer::WakeTimer::WakeTimer(CoPeer *peer): m_peer(peer) {
+}
+
+CoPeer::WakeTimer::~WakeTimer() {
+	release();
+}
+
+void CoPeer::WakeTimer::timeout() {
+	// The peer may be released concurrently
+	PeerPtr peer = m_peer.lock();
+	if (peer != nullptr && peer->isActive()) {
+		Executor::globalInstance()->start(new Peer::Task(peer));
+	}
+}
+
+}
+
+#endif // NODEBUS_COROUTINES
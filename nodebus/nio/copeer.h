@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Coroutine based peer
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_COPEER_H
+#define NODEBUS_COPEER_H
+
+#ifdef NODEBUS_COROUTINES
+
+#include <nodebus/core/task.h>
+#include <nodebus/nio/peer.h>
+#include <QAtomicInt>
+
+namespace NodeBus {
+
+/**
+ * @brief Peer written as a coroutine
+ * 
+ * The connection is handled sequentially by run(), which awaits the
+ * channel readiness instead of returning to the reactor. process() is the
+ * entry point the reactor tasks call, as for any peer: it starts the
+ * coroutine, then resumes it where it waits. The coroutine is resumed by
+ * one worker at a time, the awaitables check their condition again on
+ * each resumption.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+class CoPeer: public Peer {
+public:
+	/**
+	 * @brief CoPeer constructor
+	 * @param socket peer socket
+	 */
+	CoPeer(SocketChannelPtr socket);
+	
+	/**
+	 * @brief CoPeer destructor
+	 */
+	virtual ~CoPeer();
+	
+	/**
+	 * @brief Start or resume the coroutine
+	 * @throw Exception thrown by the coroutine, the connection is closed
+	 */
+	virtual void process();
+	
+	virtual bool waitsForOutput();
+	
+protected:
+	/**
+	 * @brief Connection coroutine, the connection is closed once it returns
+	 */
+	virtual Task<> run() = 0;
+	
+	/**
+	 * @brief Wait for received data
+	 * @param msecs timeout in milliseconds, -1 for none
+	 * @return true if data is available, false on timeout
+	 * @throw EOFException if the connection is closed
+	 */
+	Task<bool> readable(int msecs = -1);
+	
+	/**
+	 * @brief Wait for the output queue to be no longer saturated
+	 * @param msecs timeout in milliseconds, -1 for none
+	 * @return true if writable, false on timeout
+	 */
+	Task<bool> writable(int msecs = -1);
+	
+	/**
+	 * @brief Wait for a complete message
+	 * 
+	 * The message is complete once the delimiter is received, or once the
+	 * read buffer is full, so that the parser never blocks the worker.
+	 * 
+	 * @param delimiter message delimiter
+	 * @param msecs timeout in milliseconds, -1 for none
+	 * @return true if a message is available, false on timeout
+	 * @throw EOFException if the connection is closed
+	 */
+	Task<bool> messageAvailable(char delimiter = '\n', int msecs = -1);
+	
+	/**
+	 * @brief Suspend the coroutine
+	 * @param msecs delay in milliseconds
+	 */
+	Task<> sleep(int msecs);
+	
+private:
+	class WakeTimer: public Timer {
+	public:
+		WakeTimer(CoPeer *peer);
+		virtual ~WakeTimer();
+	protected:
+		virtual void timeout();
+	private:
+		WeakPtr<Peer> m_peer;
+	};
+	
+	/**
+	 * @brief Suspend the running awaitable until the next resumption
+	 */
+	struct Suspend {
+		CoPeer *m_peer;
+		
+		bool await_ready() const noexcept {
+			return false;
+		}
+		
+		void await_suspend(std::coroutine_handle<> handle) noexcept {
+			m_peer->m_waiting = handle;
+		}
+		
+		void await_resume() const noexcept {
+		}
+	};
+	
+	static qint64 deadline(int msecs);
+	bool wait(int ops, qint64 deadline);
+	
+	Task<> m_main;
+	std::coroutine_handle<> m_waiting;
+	/// @brief Resumptions requested, the first requester resumes for all
+	QAtomicInt m_wakeups;
+	QAtomicInt m_waitOutput;
+	WakeTimer m_wakeTimer;
+};
+
+}
+
+#endif // NODEBUS_COROUTINES
+
+#endif // NODEBUS_COPEER_H
@@ -21,6 +21,10 @@
 #include <sys/ioctl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <QString>
 
 #define THROW_IOEXP_ON_ERR(exp) \
@@ -28,60 +32,89 @@
 
 namespace NodeBus {
 
-IOChannel::IOChannel(int fd, int flags) : m_fd(fd), m_closeOnDelete(flags & CLOSE_ON_DELETE)
+IOChannel::IOChannel(int fd, int flags) : m_fd(fd), m_closeOnDelete(flags & CLOSE_ON_DELETE), m_fdShutdown(false) {
 #ifdef WIN32
 	
 #else //WIN32
-, m_epfd(-1)
-#endif //WIN32
-{
-#ifdef WIN32
-	
-#else //WIN32
-	THROW_IOEXP_ON_ERR(m_epfd = epoll_create1(0));
-	bzero(&m_event, sizeof(epoll_event));
-	m_event.data.fd = m_fd;
-	m_event.events = EPOLLIN | EPOLLET;
-	if (flags & READABLE) {
-		THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_ADD, m_fd, &m_event));
+	if (!(flags & KEEP_MODE)) {
+		int fl;
+		THROW_IOEXP_ON_ERR(fl = ::fcntl(m_fd, F_GETFL));
+		THROW_IOEXP_ON_ERR(::fcntl(m_fd, F_SETFL, fl | O_NONBLOCK));
 	}
 #endif //WIN32
 }
 
 IOChannel::~IOChannel() {
 	if (m_closeOnDelete && isOpen()) {
-		close();
+		// No selector key left to flush the output, never wait for the peer
+		closeNow();
+	}
+	if (m_fdShutdown) {
+		::close(m_fd);
 	}
-#ifdef WIN32
-	
-#else //WIN32
-	::close(m_epfd);
-#endif //WIN32
 }
 
 size_t IOChannel::s_read(char *buffer, size_t maxlen) {
 	ssize_t ret;
 	ret = ::read(m_fd, buffer, maxlen);
+	if (ret == 0 && maxlen > 0) {
+		throw EOFException();
+	}
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+	THROW_IOEXP_ON_ERR(ret);
+	return ret;
+}
+
+size_t IOChannel::s_readv(const struct iovec *iov, int iovcnt) {
+	ssize_t ret;
+	ret = ::readv(m_fd, iov, iovcnt);
+	if (ret == 0) {
+		throw EOFException();
+	}
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+	THROW_IOEXP_ON_ERR(ret);
+	return ret;
+}
+
+size_t IOChannel::s_write(const char *buffer, size_t len) {
+	ssize_t ret;
+	ret = ::write(m_fd, buffer, len);
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
 	THROW_IOEXP_ON_ERR(ret);
 	return ret;
 }
 
-void IOChannel::s_write(const char *buffer, size_t len) {
-	int ret = 0;
-	while (len > 0) {
-		THROW_IOEXP_ON_ERR(ret = ::write(m_fd, buffer, len));
-		len -= ret;
-		buffer += ret;
+size_t IOChannel::s_writev(const struct iovec *iov, int iovcnt, bool more) {
+	Q_UNUSED(more);
+	ssize_t ret;
+	ret = ::writev(m_fd, iov, iovcnt);
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
 	}
+	THROW_IOEXP_ON_ERR(ret);
+	return ret;
 }
 
 void IOChannel::closeFd() {
 	::close(m_fd);
 }
 
+void IOChannel::shutdownFd() {
+	if (::shutdown(m_fd, SHUT_RDWR) == -1 && errno == ENOTSOCK) {
+		closeFd();
+		return;
+	}
+	m_fdShutdown = true;
+}
+
 size_t IOChannel::s_available() {
 	size_t result;
-	s_waitForReadyRead(0);
 	THROW_IOEXP_ON_ERR(::ioctl(m_fd, FIONREAD, &result));
 	return result;
 }
@@ -90,18 +123,44 @@ bool IOChannel::s_waitForReadyRead(int timeout) {
 #ifdef WIN32
 	throw UnsupportedOperationException();
 #else //WIN32
-	int ret;
-	THROW_IOEXP_ON_ERR(ret = epoll_wait(m_epfd, m_events,1 ,timeout));
-	if (ret != 1) {
+	return s_wait(POLLIN | POLLRDHUP, timeout);
+#endif //WIN32
+}
+
+bool IOChannel::s_waitForReadyWrite(int timeout) {
+#ifdef WIN32
+	throw UnsupportedOperationException();
+#else //WIN32
+	return s_wait(POLLOUT, timeout);
+#endif //WIN32
+}
+
+bool IOChannel::s_wait(short events, int timeout) {
+#ifdef WIN32
+	throw UnsupportedOperationException();
+#else //WIN32
+	struct pollfd pfd;
+	pfd.fd = m_fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	int ret = ::poll(&pfd, 1, timeout);
+	if (ret == -1 && errno == EINTR) {
 		return false;
 	}
-	if (m_events[0].events & EPOLLHUP) {
-		throw EOFException();
+	THROW_IOEXP_ON_ERR(ret);
+	if (ret == 0) {
+		return false;
 	}
-	if (m_events[0].events & EPOLLERR) {
-		throw IOException(QString() + __FILE__ + ":" + __LINE__ + ": " + strerror(errno));
+	if (pfd.revents & POLLERR) {
+		int error = 0;
+		socklen_t len = sizeof error;
+		if (::getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error != 0) {
+			errno = error;
+		}
+		throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + QString::fromLocal8Bit(strerror(errno)));
 	}
-	return m_events[0].events & EPOLLIN;
+	// On hang up the next read or write reports the end of file or the error
+	return true;
 #endif //WIN32
 }
 
@@ -109,7 +168,11 @@ void IOChannel::updateStatus(int events) {
 #ifdef WIN32
 	
 #else //WIN32
-	if (events & EPOLLIN) {
+	// Closed on hang-up unless data remains to be read: the one-shot key
+	// is not armed again and would pin the channel and its attachment
+	if (events & EPOLLERR) {
+		close();
+	} else if (events & (EPOLLIN | EPOLLHUP)) {
 		int result;
 		if (::ioctl(m_fd, FIONREAD, &result) == -1 || result == 0) {
 			close();
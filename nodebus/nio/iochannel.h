@@ -23,6 +23,7 @@
 	
 #else //WIN32
 #	include <sys/epoll.h>
+#	include <poll.h>
 #endif //WIN32
 #include <nodebus/core/shareddata.h>
 #include <nodebus/nio/streamchannel.h>
@@ -44,10 +45,15 @@ public:
 	enum Flags {
 		CLOSE_ON_DELETE = 0x01,
 		READABLE = 0x02,
-		WRITABLE = 0x04
+		WRITABLE = 0x04,
+		/// @brief Keep the file descriptor mode (ex: standard streams shared with the parent process)
+		KEEP_MODE = 0x08
 	};
 	/**
 	 * @brief AbstractChannel constructor
+	 * 
+	 * The file descriptor is switched to non-blocking mode unless KEEP_MODE is set.
+	 * 
 	 * @param fd a valid file descriptor
 	 * @throw IOException on error
 	 */
@@ -61,22 +67,22 @@ public:
 protected:
 	virtual int &fd();
 	virtual void closeFd();
+	virtual void shutdownFd();
 	virtual void updateStatus(int events);
 	virtual size_t s_available();
 	virtual size_t s_read(char *buffer, size_t maxlen);
-	virtual void s_write(const char *buffer, size_t len);
+	virtual size_t s_readv(const struct iovec *iov, int iovcnt);
+	virtual size_t s_write(const char *buffer, size_t len);
+	virtual size_t s_writev(const struct iovec *iov, int iovcnt, bool more);
 	bool s_waitForReadyRead(int timeout);
+	bool s_waitForReadyWrite(int timeout);
 	int m_fd;
 	bool m_closeOnDelete;
+	/// @brief Shut down, to close on delete
+	bool m_fdShutdown;
 
 private:
-#ifdef WIN32
-	
-#else //WIN32
-	int m_epfd;
-	epoll_event m_event;
-	epoll_event m_events[1];
-#endif //WIN32
+	bool s_wait(short events, int timeout);
 };
 
 inline int &IOChannel::fd() {
@@ -25,7 +25,7 @@
 
 namespace NodeBus {
 
-Peer::Peer(SocketChannelPtr socket): m_socket(socket) {
+Peer::Peer(SocketChannelPtr socket): m_socket(socket), m_idleTimer(this), m_idleTimeout(0), m_timers(nullptr) {
 	connect(socket.data(), SIGNAL(closed()), this, SLOT(cancel()));
 }
 
@@ -35,6 +35,10 @@ Peer::~Peer() {
 
 void Peer::Task::run() {
 	try {
+		if (m_admission != nullptr && m_admission->dequeue(m_queuedAt) && m_peer->shed()) {
+			m_admission->countShed();
+			return;
+		}
 		m_peer->process();
 		return;
 	} catch (EOFException &e) {
@@ -53,7 +57,15 @@ void Peer::Task::run() {
 	}
 }
 
+void Peer::startIdleTimer(TimerWheel &timers) {
+	m_timers = &timers;
+	if (m_idleTimeout > 0) {
+		m_idleTimer.start(timers, m_idleTimeout);
+	}
+}
+
 void Peer::cancel() {
+	m_idleTimer.cancel();
 	if (m_socket == nullptr) {
 		return;
 	}
@@ -61,4 +73,21 @@ void Peer::cancel() {
 	m_socket = nullptr;
 }
 
+Peer::IdleTimer::IdleTimer(Peer *peer): m_peer(peer) {
+}
+
+Peer::IdleTimer::~IdleTimer() {
+	release();
+}
+
+void Peer::IdleTimer::timeout() {
+	// The peer may be released concurrently
+	PeerPtr peer = m_peer.lock();
+	if (peer == nullptr) {
+		return;
+	}
+	logFine() << __demangle(typeid(*peer).name()) << " Close peer connection after the idle timeout";
+	peer->cancel();
+}
+
 }
@@ -29,8 +29,12 @@
 #define NODEBUS_PEER_H
 
 #include <nodebus/core/sharedptr.h>
+#include <nodebus/core/objectpool.h>
+#include <nodebus/core/weakptr.h>
 #include <nodebus/nio/streamchannel.h>
 #include <nodebus/nio/socketchannel.h>
+#include <nodebus/nio/timerwheel.h>
+#include <nodebus/nio/admission.h>
 #include <qt4/QtCore/QRunnable>
 #include <QVariant>
 
@@ -42,15 +46,52 @@ public:
 	
 	class Factory: public SharedData {
 	public:
+		Factory();
 		virtual SharedPtr<Peer> build(SocketChannelPtr channel) = 0;
+		
+		/**
+		 * @brief Set the idle timeout of the built peers
+		 * @param msecs time in milliseconds without any received data
+		 * before the connection is closed, 0 to disable it
+		 */
+		void setIdleTimeout(int msecs);
+		
+		/**
+		 * @brief Get the idle timeout of the built peers
+		 * @return time in milliseconds, 0 if disabled
+		 */
+		int idleTimeout();
+		
+		/**
+		 * @brief Set the admission control of the built peers
+		 * @param admission admission control, nullptr for none
+		 */
+		void setAdmission(AdmissionPtr admission);
+		
+		/**
+		 * @brief Get the admission control of the built peers
+		 * @return admission control, nullptr if none
+		 */
+		AdmissionPtr admission();
+	private:
+		int m_idleTimeout;
+		AdmissionPtr m_admission;
 	};
 	
 	class Task: public QRunnable {
+		nodebus_declare_pooled(Task)
 	public:
-		Task(SharedPtr<Peer> peer);
+		/**
+		 * @brief Task constructor
+		 * @param peer peer to process
+		 * @param admission admission control accounting the task, nullptr for none
+		 */
+		Task(SharedPtr<Peer> peer, AdmissionPtr admission = nullptr);
 		virtual void run();
 	private:
 		SharedPtr<Peer> m_peer;
+		AdmissionPtr m_admission;
+		qint64 m_queuedAt;
 	};
 	
 	/**
@@ -65,22 +106,141 @@ public:
 	
 	bool isActive();
 	
+	/**
+	 * @brief Tell if the peer waits for its output queue to drain
+	 * 
+	 * The reactor then runs process() on the writable events too.
+	 * 
+	 * @return true if waiting, otherwise false
+	 */
+	virtual bool waitsForOutput();
+	
+	/**
+	 * @brief Refuse the pending work on overload
+	 * 
+	 * Called instead of process() when the admission control sheds the
+	 * task. The peer must answer at once without blocking.
+	 * 
+	 * @return true if shed, false if the peer cannot shed its work, which
+	 * is then processed anyway
+	 */
+	virtual bool shed();
+	
+	/**
+	 * @brief Set the admission control accounting the peer tasks
+	 * @param admission admission control, nullptr for none
+	 */
+	void setAdmission(AdmissionPtr admission);
+	
+	/**
+	 * @brief Get the admission control accounting the peer tasks
+	 * @return admission control, nullptr if none
+	 */
+	AdmissionPtr admission();
+	
+	/**
+	 * @brief Set the idle timeout
+	 * @param msecs time in milliseconds, 0 to disable it
+	 */
+	void setIdleTimeout(int msecs);
+	
+	/**
+	 * @brief Arm the idle timeout while waiting for data
+	 * @param timers wheel of the reactor the peer is registered to
+	 */
+	void startIdleTimer(TimerWheel &timers);
+	
+	/**
+	 * @brief Disarm the idle timeout while processing data
+	 */
+	void stopIdleTimer();
+	
 public slots:
 	virtual void cancel();
 	
 protected:
+	/**
+	 * @brief Get the timer wheel of the reactor the peer is registered to
+	 * @return the wheel, nullptr if not yet registered
+	 */
+	TimerWheel *timers();
+	
 	SocketChannelPtr m_socket;
+	
+private:
+	class IdleTimer: public Timer {
+	public:
+		IdleTimer(Peer *peer);
+		virtual ~IdleTimer();
+	protected:
+		virtual void timeout();
+	private:
+		WeakPtr<Peer> m_peer;
+	};
+	
+	IdleTimer m_idleTimer;
+	int m_idleTimeout;
+	TimerWheel *m_timers;
+	AdmissionPtr m_admission;
 };
 
 typedef SharedPtr<Peer> PeerPtr;
 
-inline Peer::Task::Task(SharedPtr< Peer > peer): m_peer(peer) {
+inline Peer::Factory::Factory(): m_idleTimeout(0) {
+}
+
+inline void Peer::Factory::setIdleTimeout(int msecs) {
+	m_idleTimeout = msecs;
+}
+
+inline int Peer::Factory::idleTimeout() {
+	return m_idleTimeout;
+}
+
+inline void Peer::Factory::setAdmission(AdmissionPtr admission) {
+	m_admission = admission;
+}
+
+inline AdmissionPtr Peer::Factory::admission() {
+	return m_admission;
+}
+
+inline Peer::Task::Task(SharedPtr< Peer > peer, AdmissionPtr admission)
+: m_peer(peer), m_admission(admission), m_queuedAt(admission != nullptr ? admission->enqueue() : 0) {
 }
 
 inline bool Peer::isActive() {
 	return m_socket != nullptr && m_socket->isOpen();
 }
 
+inline bool Peer::waitsForOutput() {
+	return false;
+}
+
+inline bool Peer::shed() {
+	return false;
+}
+
+inline void Peer::setAdmission(AdmissionPtr admission) {
+	m_admission = admission;
+}
+
+inline AdmissionPtr Peer::admission() {
+	return m_admission;
+}
+
+inline void Peer::setIdleTimeout(int msecs) {
+	m_idleTimeout = msecs;
+}
+
+inline void Peer::stopIdleTimer() {
+	m_idleTimer.cancel();
+}
+
+inline TimerWheel *Peer::timers() {
+	return m_timers;
+}
+
 }
 
 #endif // NODEBUS_PEER_H
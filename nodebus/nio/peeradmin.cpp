@@ -18,81 +18,105 @@
 
 #include "peeradmin.h"
 #include <typeinfo>
-#include <qt4/QtCore/qthreadpool.h>
 #include <nodebus/core/logger.h>
 #include <nodebus/nio/selectionkey.h>
-#include <nodebus/core/parser.h>
 
 namespace NodeBus {
 
 PeerAdmin::PeerAdmin(QObject* parent)
-: QThread(parent), m_enabled(true), m_selector() {
+: QObject(parent), m_reactorCount(0), m_listenNode(-1), m_next(0) {
 
 }
 
 PeerAdmin::~PeerAdmin() {
+	cancel();
+	for (auto it = m_reactors.begin(); it != m_reactors.end(); it++) {
+		(*it)->wait();
+		delete *it;
+	}
 }
 
-void PeerAdmin::run() {
-	try {
-		while (m_enabled) {
-			if (m_selector.select() && m_enabled) {
-				auto list = m_selector.selectedKeys();
-				for(auto it = list.begin(); it != list.end(); it++) {
-					SelectionKeyPtr key = *it;
-					if (!key->isValid()) {
-						continue;
-					}
-					if (key->channel().instanceof<ServerSocketChannel>()) {
-						processServer(key->channel(), key->attachment());
-					} else if (key->channel().instanceof<SocketChannel>()) {
-						processPeer(key->attachment());
-					}
-				}
-			}
-		}
-	} catch (ParserException &e) {
-		if (m_enabled) {
-			logFine() << __demangle(typeid(*this).name()) << " leaving main loop normally";
-		} else {
-			logCrit() << __demangle(typeid(*this).name()) << " leaving main loop after throwing an instance of '" << __demangle(typeid(e).name()) << "'";
-			if (!e.message().isEmpty())
-				logCrit() << "  what(): " << e.message();
-		}
-	} catch (Exception &e) {
-		logCrit() << __demangle(typeid(*this).name()) << " leaving main loop after throwing an instance of '" << __demangle(typeid(e).name()) << "'";
-		if (!e.message().isEmpty())
-			logCrit() << "  what(): " << e.message();
+void PeerAdmin::setReactorCount(int count) {
+	if (!m_reactors.isEmpty()) {
+		throw IllegalOperationException("Reactors already initialized");
 	}
-	cancel();
+	m_reactorCount = count;
 }
 
-void PeerAdmin::cancel() {
-	m_enabled = false;
-	//StdPeer::clearClientList();
-	m_selector.cancel();
+void PeerAdmin::setReactorCpus(const CpuSet &cpus) {
+	if (!m_reactors.isEmpty()) {
+		throw IllegalOperationException("Reactors already initialized");
+	}
+	m_reactorCpus = cpus;
 }
 
-void PeerAdmin::attach(ChannelPtr channel, GenericPtr attachement) {
-	channel->registerTo(m_selector, SelectionKey::OP_READ, attachement);
+void PeerAdmin::setListenNode(int node) {
+	m_listenNode = node;
+}
+
+void PeerAdmin::init() {
+	if (!m_reactors.isEmpty()) {
+		return;
+	}
+	int count = m_reactorCount > 0 ? m_reactorCount :
+		m_reactorCpus.isEmpty() ? QThread::idealThreadCount() : m_reactorCpus.count();
+	for (int i = 0; i < qMax(count, 1); i++) {
+		Reactor *reactor = new Reactor();
+		if (!m_reactorCpus.isEmpty()) {
+			reactor->setCpus(CpuSet(QList<int>() << m_reactorCpus.at(i % m_reactorCpus.count())));
+		}
+		connect(reactor, SIGNAL(finished()), this, SIGNAL(terminated()));
+		m_reactors.append(reactor);
+	}
+	logFine() << "PeerAdmin: " << m_reactors.size() << " reactor(s)";
 }
 
-void PeerAdmin::processPeer(PeerPtr peer) {
-	if (peer->isActive()) {
-		QThreadPool::globalInstance()->start(new Peer::Task(peer));
+void PeerAdmin::start() {
+	init();
+	for (auto it = m_reactors.begin(); it != m_reactors.end(); it++) {
+		(*it)->start();
 	}
 }
 
-void PeerAdmin::processServer(ServerSocketChannelPtr socket, SharedPtr< Peer::Factory > factory) {
-	try {
-		SocketChannelPtr clientSocket = socket->accept();
-		clientSocket->registerTo(m_selector, SelectionKey::OP_READ, factory->build(clientSocket));
-	} catch (Exception &e) {
-		logWarn() << __demangle(typeid(*this).name()) << " Close peer connection after throwing an instance of '" << __demangle(typeid(e).name()) << "'";
-		if (!e.message().isEmpty())
-			logWarn() << "  what(): " << e.message();
+void PeerAdmin::cancel() {
+	for (auto it = m_reactors.begin(); it != m_reactors.end(); it++) {
+		(*it)->cancel();
+	}
+}
+
+void PeerAdmin::attach(ChannelPtr channel, GenericPtr attachement) {
+	init();
+	if (channel.instanceof<ServerSocketChannel>()) {
+		ServerSocketChannelPtr server = channel;
+		QList<Reactor*> reactors;
+		for (auto it = m_reactors.begin(); it != m_reactors.end(); it++) {
+			if (m_listenNode == -1 || (*it)->node() == m_listenNode) {
+				reactors.append(*it);
+			}
+		}
+		if (reactors.isEmpty()) {
+			logWarn() << "PeerAdmin: no reactor on the NUMA node " << m_listenNode << ", listening on all of them";
+			reactors = m_reactors;
+		}
+		reactors.first()->attach(server, attachement);
+		for (int i = 1; i < reactors.size(); i++) {
+			ServerSocketChannelPtr copy = server->duplicate();
+			if (copy == nullptr) {
+				logWarn() << "PeerAdmin: " << server->name() << " can't be shared between reactors";
+				break;
+			}
+			reactors[i]->attach(copy, attachement);
+		}
+		return;
+	}
+	for (auto it = m_reactors.begin(); it != m_reactors.end(); it++) {
+		if ((*it)->owns(channel)) {
+			(*it)->attach(channel, attachement);
+			return;
+		}
 	}
-	socket->registerTo(m_selector, SelectionKey::OP_READ, factory);
+	uint index = (uint)(m_next.fetchAndAddRelaxed(1)) % m_reactors.size();
+	m_reactors[index]->attach(channel, attachement);
 }
 
 }
@@ -33,16 +33,16 @@
 #include <nodebus/nio/socketchannel.h>
 #include <nodebus/nio/selectionkey.h>
 #include <nodebus/nio/peer.h>
+#include <nodebus/nio/reactor.h>
 
 namespace NodeBus {
 
-class PeerAdmin : public QThread {
+class PeerAdmin : public QObject {
 	Q_OBJECT
 public:
 	
 	/**
 	 * @brief Server constructor.
-	 * @param fd File descriptor
 	 * @param parent Parent object
 	 */
 	PeerAdmin(QObject* parent=0);
@@ -50,22 +50,83 @@ public:
 	virtual ~PeerAdmin();
 	
 	/**
-	 * @brief Task main
+	 * @brief Set the number of reactors
+	 * 
+	 * Must be called before the first attach.
+	 * 
+	 * @param count reactor count, 0 for one reactor per core
 	 */
-	virtual void run();
+	void setReactorCount(int count);
 	
+	/**
+	 * @brief Set the CPUs the reactors are pinned to
+	 * 
+	 * Each reactor is pinned to one CPU of the set, one reactor per CPU
+	 * unless a reactor count is set. Must be called before the first
+	 * attach.
+	 * 
+	 * @param cpus CPU set, none if empty
+	 */
+	void setReactorCpus(const CpuSet &cpus);
+	
+	/**
+	 * @brief Set the NUMA node the listeners are served on
+	 * 
+	 * The server sockets are only registered to the reactors pinned to
+	 * this node (ex: the node of the network interface), so the
+	 * connections are accepted and handled there. All the reactors are
+	 * used if none is pinned to it.
+	 * 
+	 * @param node node index, -1 for any node
+	 */
+	void setListenNode(int node);
+	
+	/**
+	 * @brief Get the number of reactors
+	 * @return reactor count
+	 */
+	int reactorCount();
+	
+	/**
+	 * @brief Start the reactors
+	 */
+	void start();
+	
+	/**
+	 * @brief Register a channel
+	 * 
+	 * A server socket is registered to every reactor of the listen node,
+	 * through a SO_REUSEPORT bound duplicate when available. A socket is registered
+	 * to the reactor it is pinned to, or to the next one if it is new.
+	 * 
+	 * @param channel channel to register
+	 * @param attachement peer for a socket or peer factory for a server socket
+	 */
 	void attach(ChannelPtr channel, GenericPtr attachement=NULL);
-	void processPeer(PeerPtr client);
 	
 public slots:
 	void cancel();
+	
+signals:
+	/**
+	 * @brief Emitted when a reactor leaves its main loop
+	 */
+	void terminated();
+	
 private:
-	void processServer(ServerSocketChannelPtr socket, SharedPtr<Peer::Factory> factory);
+	void init();
 	
-	bool m_enabled;
-	Selector m_selector;
+	int m_reactorCount;
+	CpuSet m_reactorCpus;
+	int m_listenNode;
+	QList<Reactor*> m_reactors;
+	QAtomicInt m_next;
 };
 
+inline int PeerAdmin::reactorCount() {
+	return m_reactors.isEmpty() ? m_reactorCount : m_reactors.size();
+}
+
 }
 
 #endif // NODEBUS_PEERADMIN_H
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "reactor.h"
+#include <typeinfo>
+#include <nodebus/core/executor.h>
+#include <nodebus/core/logger.h>
+#include <nodebus/core/parser.h>
+#include <nodebus/core/weakptr.h>
+#include <nodebus/nio/sslsocketchannel.h>
+#include <atomic>
+
+namespace NodeBus {
+
+/**
+ * @brief Get the executor affinity key of a connection object
+ */
+static inline uint affinity(const void *ptr) {
+	// Heap blocks are aligned, drop the low bits
+	return uint(quintptr(ptr) >> 6);
+}
+
+/**
+ * @brief Connection handshake in progress, attached to the socket key
+ */
+class Reactor::Handshake: public SharedData {
+public:
+	class Timeout: public Timer {
+	public:
+		Timeout(SocketChannelPtr socket);
+		virtual ~Timeout();
+	protected:
+		virtual void timeout();
+	private:
+		WeakPtr<SocketChannel> m_socket;
+	};
+	
+	/**
+	 * @brief Handshake step, the cryptography is kept off the reactor thread
+	 */
+	class Task: public QRunnable {
+	public:
+		Task(Reactor *reactor, SocketChannelPtr socket, SharedPtr<Handshake> handshake);
+		virtual void run();
+	private:
+		Reactor *m_reactor;
+		SocketChannelPtr m_socket;
+		SharedPtr<Handshake> m_handshake;
+	};
+	
+	Handshake(SocketChannelPtr socket, SharedPtr<Peer::Factory> factory, qint64 start);
+	
+	SharedPtr<Peer::Factory> m_factory;
+	qint64 m_start;
+	Timeout m_timeout;
+};
+
+int Reactor::s_handshakeTimeout = NODEBUS_REACTOR_HANDSHAKE_TIMEOUT;
+static std::atomic<quint64> s_handshakeCompleted(0);
+static std::atomic<quint64> s_handshakeFailed(0);
+static std::atomic<quint64> s_handshakeTimedOut(0);
+/// @brief Sum of the completed handshake latencies in milliseconds
+static std::atomic<quint64> s_handshakeLatency(0);
+static std::atomic<quint64> s_handshakeMaxLatency(0);
+
+Reactor::Handshake::Handshake(SocketChannelPtr socket, SharedPtr<Peer::Factory> factory, qint64 start)
+: m_factory(factory), m_start(start), m_timeout(socket) {
+}
+
+Reactor::Handshake::Timeout::Timeout(SocketChannelPtr socket): m_socket(socket) {
+}
+
+Reactor::Handshake::Timeout::~Timeout() {
+	release();
+}
+
+Reactor::Handshake::Task::Task(Reactor *reactor, SocketChannelPtr socket, SharedPtr<Handshake> handshake)
+: m_reactor(reactor), m_socket(socket), m_handshake(handshake) {
+}
+
+void Reactor::Handshake::Task::run() {
+	m_reactor->stepHandshake(m_socket, m_handshake);
+}
+
+void Reactor::Handshake::Timeout::timeout() {
+	SocketChannelPtr socket = m_socket.lock();
+	if (socket == nullptr) {
+		return;
+	}
+	s_handshakeTimedOut++;
+	if (Logger::level() >= Logger::FINE) {
+		logFine() << "Reactor: handshake timeout from " << socket->name();
+	}
+	// Releases the handshake, this timer included
+	socket->close();
+}
+
+Reactor::Reactor(QObject* parent)
+: QThread(parent), m_enabled(true), m_selector(Selector::open()), m_resumeTimer(this) {
+}
+
+Reactor::~Reactor() {
+	// Armed on the wheel of the selector
+	m_resumeTimer.release();
+	delete m_selector;
+}
+
+Reactor::ResumeTimer::ResumeTimer(Reactor *reactor): m_reactor(reactor) {
+}
+
+Reactor::ResumeTimer::~ResumeTimer() {
+	release();
+}
+
+void Reactor::ResumeTimer::timeout() {
+	// Called from the reactor thread, as processServer()
+	auto list = m_reactor->m_deferred;
+	m_reactor->m_deferred.clear();
+	for (auto it = list.begin(); it != list.end(); it++) {
+		m_reactor->processServer(it->first, it->second);
+	}
+}
+
+void Reactor::run() {
+	if (!m_cpus.pin()) {
+		logWarn() << "Reactor: failed to pin to the CPUs " << m_cpus.toString();
+	}
+	try {
+		while (m_enabled) {
+			if (m_selector->select() && m_enabled) {
+				auto list = m_selector->selectedKeys();
+				for(auto it = list.begin(); it != list.end(); it++) {
+					SelectionKeyPtr key = *it;
+					ChannelPtr channel = key->channel();
+					if (channel == nullptr) {
+						continue;
+					}
+					// Read once, the key may be attached again meanwhile
+					GenericPtr attachment = key->attachment();
+					if (channel.instanceof<ServerSocketChannel>()) {
+						processServer(channel, attachment);
+						continue;
+					}
+					if (attachment.instanceof<Handshake>()) {
+						processHandshake(channel, attachment);
+						continue;
+					}
+					// Errors and hang-ups are reported to the peer as well
+					bool peerEvent = key->isReadable() || !key->isWritable();
+					if (key->isWritable()) {
+						processOutput(channel);
+						if (attachment.instanceof<Peer>() && attachment.cast<Peer>()->waitsForOutput()) {
+							peerEvent = true;
+						}
+					}
+					if (peerEvent && channel.instanceof<SocketChannel>()) {
+						processPeer(attachment);
+					}
+				}
+			}
+		}
+	} catch (ParserException &e) {
+		if (m_enabled) {
+			logFine() << __demangle(typeid(*this).name()) << " leaving main loop normally";
+		} else {
+			logCrit() << __demangle(typeid(*this).name()) << " leaving main loop after throwing an instance of '" << __demangle(typeid(e).name()) << "'";
+			if (!e.message().isEmpty())
+				logCrit() << "  what(): " << e.message();
+		}
+	} catch (Exception &e) {
+		logCrit() << __demangle(typeid(*this).name()) << " leaving main loop after throwing an instance of '" << __demangle(typeid(e).name()) << "'";
+		if (!e.message().isEmpty())
+			logCrit() << "  what(): " << e.message();
+	}
+	cancel();
+}
+
+void Reactor::cancel() {
+	m_enabled = false;
+	m_selector->cancel();
+}
+
+void Reactor::attach(ChannelPtr channel, GenericPtr attachement) {
+	// Armed before the registration, which may be selected at once
+	if (attachement.instanceof<Peer>()) {
+		attachement.cast<Peer>()->startIdleTimer(m_selector->timers());
+	}
+	channel->registerTo(*m_selector, SelectionKey::OP_READ, attachement);
+}
+
+void Reactor::processPeer(PeerPtr peer) {
+	peer->stopIdleTimer();
+	if (!peer->isActive()) {
+		return;
+	}
+	AdmissionPtr admission = peer->admission();
+	// Over the queue limit, the work is refused without being queued
+	if (admission != nullptr && admission->isFull() && peer->shed()) {
+		admission->countShed();
+		return;
+	}
+	// Same worker for the successive tasks of a connection when possible
+	Executor::globalInstance()->start(new Peer::Task(peer, admission), affinity(peer.data()));
+}
+
+void Reactor::processOutput(StreamChannelPtr channel) {
+	try {
+		channel->flush();
+	} catch (Exception &e) {
+		logWarn() << __demangle(typeid(*this).name()) << " Close peer connection after throwing an instance of '" << __demangle(typeid(e).name()) << "'";
+		if (!e.message().isEmpty())
+			logWarn() << "  what(): " << e.message();
+		channel->close();
+	}
+}
+
+void Reactor::processServer(ServerSocketChannelPtr socket, SharedPtr< Peer::Factory > factory) {
+	AdmissionPtr admission = factory->admission();
+	if (admission != nullptr && (admission->isOverloaded() || admission->isFull())) {
+		// Left in the backlog until the queue drains
+		admission->countDeferred();
+		m_deferred.append(qMakePair(socket, factory));
+		if (!m_resumeTimer.isActive()) {
+			m_resumeTimer.start(m_selector->timers(), NODEBUS_REACTOR_ACCEPT_DEFER);
+		}
+		return;
+	}
+	// Drain the backlog within a budget to keep serving the other channels,
+	// the level-triggered listener fires again if connections remain
+	for (int i = 0; i < NODEBUS_REACTOR_ACCEPT_BUDGET; i++) {
+		try {
+			SocketChannelPtr clientSocket = socket->accept();
+			if (clientSocket == nullptr) {
+				break;
+			}
+			if (!clientSocket.instanceof<SSLSocketChannel>()) {
+				startPeer(clientSocket, factory);
+				continue;
+			}
+			// The handshake must not block the reactor, wait for the client hello
+			SharedPtr<Handshake> handshake = new Handshake(clientSocket, factory, TimerWheel::now());
+			handshake->m_timeout.start(m_selector->timers(), s_handshakeTimeout);
+			clientSocket->registerTo(*m_selector, SelectionKey::OP_READ, handshake);
+		} catch (Exception &e) {
+			logWarn() << __demangle(typeid(*this).name()) << " Close peer connection after throwing an instance of '" << __demangle(typeid(e).name()) << "'";
+			if (!e.message().isEmpty())
+				logWarn() << "  what(): " << e.message();
+		}
+	}
+	if (socket->isExhausted()) {
+		// Still readable, polling it again would spin until a descriptor is released
+		m_deferred.append(qMakePair(socket, factory));
+		if (!m_resumeTimer.isActive()) {
+			m_resumeTimer.start(m_selector->timers(), NODEBUS_REACTOR_ACCEPT_DEFER);
+		}
+		return;
+	}
+	socket->registerTo(*m_selector, SelectionKey::OP_READ, factory);
+}
+
+void Reactor::processHandshake(SocketChannelPtr socket, SharedPtr<Handshake> handshake) {
+	Executor::globalInstance()->start(new Handshake::Task(this, socket, handshake), affinity(socket.data()));
+}
+
+void Reactor::stepHandshake(SocketChannelPtr socket, SharedPtr<Handshake> handshake) {
+	int ops;
+	try {
+		ops = socket->handshake();
+	} catch (Exception &e) {
+		handshake->m_timeout.cancel();
+		s_handshakeFailed++;
+		if (Logger::level() >= Logger::FINE) {
+			logFine() << "Reactor: handshake failure from " << socket->name() << ": " << e.message();
+		}
+		socket->close();
+		return;
+	}
+	if (ops != 0) {
+		socket->registerTo(*m_selector, ops, handshake);
+		return;
+	}
+	handshake->m_timeout.cancel();
+	quint64 latency = TimerWheel::now() - handshake->m_start;
+	s_handshakeCompleted++;
+	s_handshakeLatency += latency;
+	quint64 max = s_handshakeMaxLatency.load();
+	while (latency > max && !s_handshakeMaxLatency.compare_exchange_weak(max, latency));
+	startPeer(socket, handshake->m_factory);
+}
+
+void Reactor::startPeer(SocketChannelPtr socket, SharedPtr<Peer::Factory> factory) {
+	PeerPtr peer = factory->build(socket);
+	peer->setIdleTimeout(factory->idleTimeout());
+	peer->setAdmission(factory->admission());
+	peer->startIdleTimer(m_selector->timers());
+	// Application data may have been read along with the end of the handshake
+	if (socket.instanceof<SSLSocketChannel>() && socket->available() > 0) {
+		processPeer(peer);
+		return;
+	}
+	socket->registerTo(*m_selector, SelectionKey::OP_READ, peer);
+}
+
+void Reactor::setHandshakeTimeout(int msecs) {
+	s_handshakeTimeout = msecs;
+}
+
+QVariantMap Reactor::handshakeStats() {
+	QVariantMap res;
+	quint64 completed = s_handshakeCompleted.load();
+	res["completed"] = (qulonglong)completed;
+	res["failed"] = (qulonglong)s_handshakeFailed.load();
+	res["timed-out"] = (qulonglong)s_handshakeTimedOut.load();
+	res["mean-latency"] = completed == 0 ? 0.0 : double(s_handshakeLatency.load()) / completed;
+	res["max-latency"] = (qulonglong)s_handshakeMaxLatency.load();
+	return res;
+}
+
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus : Reactor
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+#ifndef NODEBUS_REACTOR_H
+#define NODEBUS_REACTOR_H
+
+#include <QThread>
+#include <QList>
+#include <QPair>
+#include <QVariant>
+#include <nodebus/nio/serversocketchannel.h>
+#include <nodebus/nio/socketchannel.h>
+#include <nodebus/nio/selectionkey.h>
+#include <nodebus/nio/selector.h>
+#include <nodebus/core/cpuset.h>
+#include <nodebus/nio/peer.h>
+
+/// @brief Maximum number of connections accepted per listener readiness event
+#define NODEBUS_REACTOR_ACCEPT_BUDGET 64
+/// @brief Default connection handshake timeout in milliseconds
+#define NODEBUS_REACTOR_HANDSHAKE_TIMEOUT 10000
+/// @brief Delay before accepting again on an overloaded listener in milliseconds
+#define NODEBUS_REACTOR_ACCEPT_DEFER 50
+
+namespace NodeBus {
+
+/**
+ * @brief Reactor thread
+ * 
+ * Owns a selector and dispatches the readiness events of its channels.
+ * Connections accepted by a reactor stay registered to it for their
+ * whole lifetime. The selector engine is the Selector default one.
+ * 
+ * The handshake of an accepted TLS connection is driven by the selector,
+ * its steps run on the global thread pool and the peer is built once it
+ * completes.
+ * 
+ * A listener with an admission control stops accepting while it is
+ * overloaded and sheds the peer tasks over its queue limit.
+ */
+class Reactor : public QThread {
+public:
+	/**
+	 * @brief Reactor constructor
+	 * @param parent Parent object
+	 */
+	Reactor(QObject* parent=0);
+	
+	virtual ~Reactor();
+	
+	/**
+	 * @brief Reactor main loop
+	 */
+	virtual void run();
+	
+	/**
+	 * @brief Register a channel to this reactor
+	 * @param channel channel to register
+	 * @param attachement peer for a socket or peer factory for a server socket
+	 */
+	void attach(ChannelPtr channel, GenericPtr attachement=NULL);
+	
+	/**
+	 * @brief Test if a channel is registered to this reactor
+	 * @param channel channel
+	 * @return true if registered, otherwise false
+	 */
+	bool owns(ChannelPtr channel);
+	
+	/**
+	 * @brief Get the timer wheel of this reactor
+	 * 
+	 * The timer callbacks are called from the reactor thread.
+	 * 
+	 * @return the timer wheel
+	 */
+	TimerWheel &timers();
+	
+	/**
+	 * @brief Set the CPUs the reactor thread is pinned to
+	 * 
+	 * Must be called before start().
+	 * 
+	 * @param cpus CPU set, none if empty
+	 */
+	void setCpus(const CpuSet &cpus);
+	
+	/**
+	 * @brief Get the NUMA node of the reactor
+	 * @return node index, -1 if not pinned or unknown
+	 */
+	int node();
+	
+	/**
+	 * @brief Leave the main loop
+	 */
+	void cancel();
+	
+	/**
+	 * @brief Set the time allowed to complete a connection handshake
+	 * @param msecs time in milliseconds
+	 */
+	static void setHandshakeTimeout(int msecs);
+	
+	/**
+	 * @brief Get the handshake metrics of all the reactors
+	 * @return completed, failed and timed out counts, mean and max latency in milliseconds
+	 */
+	static QVariantMap handshakeStats();
+	
+private:
+	class Handshake;
+	
+	/**
+	 * @brief Register again the deferred listeners
+	 */
+	class ResumeTimer: public Timer {
+	public:
+		ResumeTimer(Reactor *reactor);
+		virtual ~ResumeTimer();
+	protected:
+		virtual void timeout();
+	private:
+		Reactor *m_reactor;
+	};
+	
+	void processServer(ServerSocketChannelPtr socket, SharedPtr<Peer::Factory> factory);
+	void processHandshake(SocketChannelPtr socket, SharedPtr<Handshake> handshake);
+	void stepHandshake(SocketChannelPtr socket, SharedPtr<Handshake> handshake);
+	void startPeer(SocketChannelPtr socket, SharedPtr<Peer::Factory> factory);
+	void processPeer(PeerPtr peer);
+	void processOutput(StreamChannelPtr channel);
+	
+	bool m_enabled;
+	Selector *m_selector;
+	CpuSet m_cpus;
+	/// @brief Listeners waiting for the overload to end, only used by the reactor thread
+	QList<QPair<ServerSocketChannelPtr, SharedPtr<Peer::Factory> > > m_deferred;
+	ResumeTimer m_resumeTimer;
+	static int s_handshakeTimeout;
+};
+
+inline bool Reactor::owns(ChannelPtr channel) {
+	return channel->keyFor(*m_selector) != nullptr;
+}
+
+inline TimerWheel &Reactor::timers() {
+	return m_selector->timers();
+}
+
+inline void Reactor::setCpus(const CpuSet &cpus) {
+	m_cpus = cpus;
+}
+
+inline int Reactor::node() {
+	return m_cpus.node();
+}
+
+}
+
+#endif // NODEBUS_REACTOR_H
@@ -27,23 +27,74 @@
 namespace NodeBus {
 
 SelectionKey::SelectionKey(Selector &selector, SharedPtr<Channel> channel, int events, GenericPtr attachement)
-: m_selector(selector), m_channel(channel), m_events(0), m_attachement(attachement) {
+: m_selector(selector), m_channel(channel), m_interest(0), m_events(0), m_attachement(attachement) {
 	QMutexLocker _(&(selector.m_synchronize));
 	selector.put(this, events & (SelectionKey::OP_READ | SelectionKey::OP_WRITE));
+	QMutexLocker keys(&(channel->m_keysLock));
 	channel->m_keys[&selector] = this;
 }
 
 SelectionKey::~SelectionKey() {
 }
 
+void SelectionKey::interestOps(int ops) {
+	QMutexLocker _(&(m_selector.m_synchronize));
+	if (!isValid()) {
+		throw IOException("Cancelled selection key");
+	}
+	m_selector.rearm(this, ops & (SelectionKey::OP_READ | SelectionKey::OP_WRITE));
+}
+
+void SelectionKey::addInterestOps(int ops) {
+	QMutexLocker _(&(m_selector.m_synchronize));
+	if (!isValid()) {
+		throw IOException("Cancelled selection key");
+	}
+	ops &= SelectionKey::OP_READ | SelectionKey::OP_WRITE;
+	if ((m_interest | ops) != m_interest) {
+		m_selector.rearm(this, m_interest | ops);
+	}
+}
+
 void SelectionKey::cancel() {
 	if (!isValid()) {
 		return;
 	}
+	// The selector may hold the last reference to this key
+	SelectionKeyPtr self(this);
+	// Released once unlocked, it may be the last reference to the channel
+	SharedPtr<Channel> channel;
 	QMutexLocker _(&(m_selector.m_synchronize));
+	if (m_channel == nullptr) {
+		return;
+	}
 	m_selector.remove(this);
-	m_channel->m_keys.remove(&m_selector);
+	{
+		QMutexLocker keys(&(m_channel->m_keysLock));
+		m_channel->m_keys.remove(&m_selector);
+	}
+	channel = m_channel;
 	m_channel = nullptr;
 }
+
+bool SelectionKey::isValid() {
+	QMutexLocker _(&(m_selector.m_synchronize));
+	return m_channel != nullptr;
+}
+
+SharedPtr<Channel> SelectionKey::channel() {
+	QMutexLocker _(&(m_selector.m_synchronize));
+	return m_channel;
+}
+
+void SelectionKey::attach(GenericPtr obj) {
+	QMutexLocker _(&(m_selector.m_synchronize));
+	m_attachement = obj;
+}
+
+GenericPtr SelectionKey::attachment() {
+	QMutexLocker _(&(m_selector.m_synchronize));
+	return m_attachement;
+}
 	
 }
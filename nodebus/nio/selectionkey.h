@@ -22,6 +22,7 @@
 #include <nodebus/core/shareddata.h>
 #include <nodebus/core/exception.h>
 #include <nodebus/core/sharedptr.h>
+#include <nodebus/core/objectpool.h>
 
 #ifdef WIN32
 
@@ -47,6 +48,7 @@ class Selector;
 class SelectionKey : public SharedData {
 	friend class Channel;
 	friend class Selector;
+	nodebus_declare_pooled(SelectionKey)
 public:
 	enum Flag {
 		OP_READ
@@ -98,8 +100,30 @@ public:
 	 */
 	bool isValid();
 	
+	/**
+	 * @brief Get the operations this key is currently armed for
+	 * @return SelectionKey::Flag combination, 0 once the key has been selected
+	 */
+	int interestOps();
+	
+	/**
+	 * @brief Re-arm this key for the given operations
+	 * @param ops SelectionKey::Flag combination
+	 */
+	void interestOps(int ops);
+	
+	/**
+	 * @brief Arm this key for the given operations in addition to the armed ones
+	 * @param ops SelectionKey::Flag combination
+	 */
+	void addInterestOps(int ops);
+	
 	/**
 	 * @brief Attach the given object to this key
+	 * 
+	 * Synchronized with the selector: a registered key may be selected
+	 * while it is attached again.
+	 * 
 	 * @param obj pointer
 	 */
 	void attach(GenericPtr obj);
@@ -118,6 +142,7 @@ private:
 	
 	Selector &m_selector;
 	SharedPtr<Channel> m_channel;
+	int m_interest;
 	int m_events;
 	GenericPtr m_attachement;
 };
@@ -130,20 +155,8 @@ inline bool SelectionKey::isWritable() {
 	return m_events & OP_WRITE;
 }
 
-inline bool SelectionKey::isValid() {
-	return m_channel != nullptr;
-}
-
-inline void SelectionKey::attach(GenericPtr obj) {
-	m_attachement = obj;
-}
-
-inline GenericPtr SelectionKey::attachment() {
-	return m_attachement;
-}
-
-inline SharedPtr< Channel > SelectionKey::channel() {
-	return m_channel;
+inline int SelectionKey::interestOps() {
+	return m_interest;
 }
 
 typedef SharedPtr<SelectionKey> SelectionKeyPtr;
@@ -20,8 +20,10 @@
 #include "selectionkey.h"
 #include <nodebus/core/logger.h>
 #include "serversocketchannel.h"
+#include "uringselector.h"
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -32,84 +34,204 @@
 
 namespace NodeBus {
 
-Selector::Selector() : m_enabled(true), m_synchronize(QMutex::Recursive) {
+Selector::Engine Selector::s_defaultEngine = Selector::EPOLL;
+
+Selector::Selector() : Selector(true) {
+}
+
+Selector::Selector(bool epoll) : m_enabled(true), m_synchronize(QMutex::Recursive), m_timers(this) {
 #ifdef WIN32
 	
 #else //WIN32
-	THROW_IOEXP_ON_ERR(m_epfd = epoll_create1(0));
+	m_epfd = -1;
+	m_events = nullptr;
+	THROW_IOEXP_ON_ERR(m_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+	if (!epoll) {
+		return;
+	}
+	THROW_IOEXP_ON_ERR(m_epfd = epoll_create1(EPOLL_CLOEXEC));
+	bzero(&m_event, sizeof(epoll_event));
+	m_event.data.fd = m_wakeupFd;
+	m_event.events = EPOLLIN;
+	THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_ADD, m_wakeupFd, &m_event));
 	m_events = new epoll_event[NODEBUS_SELECTOR_EPOLL_EVENT_SIZE];
 #endif //WIN32
 }
 
+Selector *Selector::open(Engine engine) {
+#ifdef NODEBUS_HAVE_IO_URING
+	if (engine == URING_SQPOLL) {
+		try {
+			return new URingSelector(true);
+		} catch (IOException &e) {
+			logWarn() << "io_uring submission thread is not available, falling back to io_uring: " << e.message();
+			engine = URING;
+		}
+	}
+	if (engine == URING) {
+		try {
+			return new URingSelector(false);
+		} catch (IOException &e) {
+			logWarn() << "io_uring is not available, falling back to epoll: " << e.message();
+		}
+	}
+#else //NODEBUS_HAVE_IO_URING
+	if (engine != EPOLL) {
+		logWarn() << "io_uring support not built, falling back to epoll";
+	}
+#endif //NODEBUS_HAVE_IO_URING
+	return new Selector();
+}
+
+Selector *Selector::open() {
+	return open(s_defaultEngine);
+}
+
+void Selector::setDefaultEngine(Engine engine) {
+	s_defaultEngine = engine;
+}
+
+const char *Selector::engineName() {
+	return "epoll";
+}
+
 Selector::~Selector() {
 	QMutexLocker locker(&m_synchronize);
-	auto list = m_keys.values();
+	auto list = m_keys;
 	for (auto it = list.begin(); it != list.end(); it++) {
-		(*it)->cancel();
+		if (*it != nullptr) {
+			(*it)->cancel();
+		}
 	}
 #ifdef WIN32
 	
 #else //WIN32
 	delete[] m_events;
-	::close(m_epfd);
+	::close(m_wakeupFd);
+	if (m_epfd != -1) {
+		::close(m_epfd);
+	}
 #endif //WIN32
 }
 
 bool Selector::select(int timeout) {
 	QMutexLocker locker(&m_synchronize);
+	m_pendingKeys.clear();
+	locker.unlock();
 #ifdef WIN32
 	
 #else //WIN32
-	ssize_t ret = 0, fdc;
-	m_pendingKeys.clear();
-	locker.unlock();
-	while (m_enabled && timeout != 0) {
-		locker.relock();
-		ret = epoll_wait(m_epfd, m_events,NODEBUS_SELECTOR_EPOLL_EVENT_SIZE ,1);
-		if (errno == EINTR) {
-			ret = 0;
+	ssize_t ret, fdc;
+	while (m_enabled) {
+		ret = epoll_wait(m_epfd, m_events, NODEBUS_SELECTOR_EPOLL_EVENT_SIZE, waitTimeout(timeout));
+		if (ret == -1 && errno == EINTR) {
 			continue;
 		}
 		THROW_IOEXP_ON_ERR(ret);
-		if (ret > 0) {
-			for (ssize_t i = 0; i < ret; i++) {
-				fdc = m_events[i].data.fd;
-				THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_DEL, fdc, NULL));
-				if (!m_keys.contains(fdc)) {
-					continue;
-				}
-				SelectionKeyPtr key = m_keys[fdc];
-				m_keys.remove(fdc);
-				key->channel()->m_keys.remove(this);
-				key->channel()->updateStatus(m_events[i].events);
-				key->m_events = m_events[i].events;
-				m_pendingKeys.append(key);
+		locker.relock();
+		for (ssize_t i = 0; i < ret; i++) {
+			fdc = m_events[i].data.fd;
+			if (fdc == m_wakeupFd) {
+				eventfd_t value;
+				eventfd_read(m_wakeupFd, &value);
+				continue;
 			}
-			return true;
+			selected(fdc, m_events[i].events);
 		}
-		timeout--;
-		locker.unlock();
+		bool found = updateSelectedKeys(locker);
+		m_timers.run(TimerWheel::now());
+		return found;
 	}
 #endif //WIN32
 	return false;
 }
 
+void Selector::selected(int fd, int events) {
+	if (fd >= m_keys.size() || m_keys[fd] == nullptr) {
+		return;
+	}
+	SelectionKeyPtr key = m_keys[fd];
+	// The one-shot registration is now disabled until re-armed,
+	// the operations which are not ready stay armed
+	int remaining = key->m_interest & ~events;
+	key->m_interest = 0;
+	key->m_events = events;
+	if (remaining != 0 && !(events & (EPOLLERR | EPOLLHUP))) {
+		rearm(key, remaining);
+	}
+	m_pendingKeys.append(key);
+}
+
+bool Selector::updateSelectedKeys(QMutexLocker &locker) {
+	auto list = m_pendingKeys;
+	locker.unlock();
+	// Status updates may close channels: not under the selector lock
+	for (auto it = list.begin(); it != list.end(); it++) {
+		ChannelPtr channel = (*it)->channel();
+		if (channel != nullptr) {
+			channel->updateStatus((*it)->m_events);
+		}
+	}
+	return !list.isEmpty();
+}
+
+int Selector::waitTimeout(int timeout) {
+	int next = m_timers.timeout();
+	if (next == -1 || (timeout != -1 && timeout < next)) {
+		return timeout;
+	}
+	return next;
+}
+
+void Selector::setInterest(const SelectionKeyPtr &key, int events) {
+	key->m_interest = events;
+}
+
+int Selector::keyFd(const SelectionKeyPtr &key) {
+	return key->channel()->fd();
+}
+
 QList< SelectionKeyPtr > Selector::selectedKeys() {
 	QMutexLocker _(&m_synchronize);
 	return m_pendingKeys;
 }
 
+void Selector::wakeup() {
+#ifdef WIN32
+	
+#else //WIN32
+	THROW_IOEXP_ON_ERR(eventfd_write(m_wakeupFd, 1));
+#endif //WIN32
+}
 
 void Selector::put(const SelectionKeyPtr& key, int events) {
 	QMutexLocker _(&m_synchronize);
 #ifdef WIN32
 	
 #else //WIN32
-	m_keys[key->channel()->fd()] = key;
+	int fd = key->channel()->fd();
+	if (fd >= m_keys.size()) {
+		m_keys.resize(qMax(fd + 1, m_keys.size() * 2));
+	}
+	m_keys[fd] = key;
+	key->m_interest = events;
+	bzero(&m_event, sizeof(epoll_event));
+	m_event.data.fd = fd;
+	m_event.events = events | EPOLLONESHOT;
+	THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_ADD, fd, &m_event));
+#endif //WIN32
+}
+
+void Selector::rearm(const SelectionKeyPtr& key, int events) {
+	QMutexLocker _(&m_synchronize);
+#ifdef WIN32
+	
+#else //WIN32
+	key->m_interest = events;
 	bzero(&m_event, sizeof(epoll_event));
 	m_event.data.fd = key->channel()->fd();
-	m_event.events = events | EPOLLET;
-	THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_ADD, m_event.data.fd, &m_event));
+	m_event.events = events | EPOLLONESHOT;
+	THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_MOD, m_event.data.fd, &m_event));
 #endif //WIN32
 }
 
@@ -118,8 +240,11 @@ void Selector::remove(const SelectionKeyPtr& key) {
 #ifdef WIN32
 	
 #else //WIN32
-	m_keys.remove(key->channel()->fd());
-	THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_DEL, key->channel()->fd(), NULL));
+	int fd = key->channel()->fd();
+	if (fd < m_keys.size()) {
+		m_keys[fd] = nullptr;
+	}
+	THROW_IOEXP_ON_ERR(epoll_ctl (m_epfd, EPOLL_CTL_DEL, fd, NULL));
 #endif //WIN32
 }
 
@@ -21,12 +21,15 @@
 
 #include <nodebus/core/exception.h>
 #include <nodebus/core/sharedptr.h>
+#include <nodebus/nio/timerwheel.h>
 #ifdef WIN32
 	
 #else //WIN32
 #	include <sys/epoll.h>
 #endif //WIN32
 #include <QMap>
+#include <QVector>
+#include <QMutex>
 
 /**
  * @namespace
@@ -47,10 +50,49 @@ class Selector {
 	friend class Channel;
 public:
 	/**
-	 * @brief Selector constructor
+	 * @brief I/O engines
+	 */
+	enum Engine {
+		EPOLL,
+		/// @brief io_uring poll requests, falls back to EPOLL if unavailable
+		URING,
+		/// @brief URING with a kernel submission thread, falls back to URING
+		URING_SQPOLL
+	};
+	
+	/**
+	 * @brief Selector constructor (epoll engine)
+	 * @throw IOException on error
 	 */
 	Selector();
 	
+	/**
+	 * @brief Create a selector
+	 * @param engine I/O engine, falls back to EPOLL if not supported
+	 * @return a new selector
+	 * @throw IOException on error
+	 */
+	static Selector *open(Engine engine);
+	
+	/**
+	 * @brief Create a selector using the default engine
+	 * @return a new selector
+	 * @throw IOException on error
+	 */
+	static Selector *open();
+	
+	/**
+	 * @brief Set the engine used by open()
+	 * @param engine I/O engine
+	 */
+	static void setDefaultEngine(Engine engine);
+	
+	/**
+	 * @brief Get the engine name
+	 * @return "epoll", "io_uring" or "io_uring-sqpoll"
+	 */
+	virtual const char *engineName();
+	
 	/**
 	 * @brief Selector destructor
 	 */
@@ -58,30 +100,90 @@ public:
 	
 	/**
 	 * @brief Select the ready channels for respertive designed operations
+	 * 
+	 * Block until at least one channel is ready, the timeout or a timer
+	 * expires or the selector is woken up. The expired timers are run
+	 * before returning.
+	 * 
 	 * @param timeout time in milliseconds or -1 for an undefined time
+	 * @return true if some keys have been selected, otherwise false
 	 */
 	virtual bool select(int timeout = -1);
 	
+	/**
+	 * @brief Get the timer wheel
+	 * 
+	 * The expired timer callbacks are called by select(), after the
+	 * selected keys update.
+	 * 
+	 * @return the timer wheel of this selector
+	 */
+	TimerWheel &timers();
+	
 	/**
 	 * @brief Get selected keys
 	 * @param return the key list
 	 */
 	QList< SharedPtr<SelectionKey> > selectedKeys();
 	
+	/**
+	 * @brief Wake up a thread blocked in select()
+	 */
+	virtual void wakeup();
+	
 	/**
 	 * @brief Cancel the selector
 	 */
 	virtual void cancel();
 
-private:
+protected:
+	/**
+	 * @brief Constructor for the alternative engines
+	 * @param epoll create the epoll instance
+	 */
+	explicit Selector(bool epoll);
+	
+	/**
+	 * @brief Handle a readiness event, the lock must be held
+	 * @param fd file descriptor
+	 * @param events ready events
+	 */
+	void selected(int fd, int events);
 	
 	/**
-	 * @brief Register or update a channel to this selector
-	 * @param channel channel to register or update
-	 * @param flags
+	 * @brief Release the lock and update the status of the selected channels
+	 * @return true if some keys have been selected
+	 */
+	bool updateSelectedKeys(QMutexLocker &locker);
+	
+	/**
+	 * @brief Get the wait time bounded by the next timer expiration
+	 * @param timeout time in milliseconds or -1 for an undefined time
+	 * @return time in milliseconds or -1 for an undefined time
+	 */
+	int waitTimeout(int timeout);
+	
+	void setInterest(const SharedPtr<SelectionKey> &key, int events);
+	int keyFd(const SharedPtr<SelectionKey> &key);
+	
+	/**
+	 * @brief Register a channel to this selector
+	 * @param key selection key
+	 * @param events events to wait for
 	 */
 	virtual void put(const SharedPtr<SelectionKey> &key, int events);
 	
+	/**
+	 * @brief Re-arm a registered channel
+	 * 
+	 * Registrations are one-shot: a channel is disabled once selected
+	 * until its key is re-armed.
+	 * 
+	 * @param key selection key
+	 * @param events events to wait for
+	 */
+	virtual void rearm(const SharedPtr<SelectionKey> &key, int events);
+	
 	/**
 	 * @brief Remove a channel from this selector
 	 * @param channel channel to remove
@@ -93,16 +195,25 @@ private:
 	
 #else //WIN32
 	int m_epfd;
+	int m_wakeupFd;
 	epoll_event m_event;
 	epoll_event *m_events;
 #endif //WIN32
-	QMap<int, SharedPtr<SelectionKey> > m_keys;
+	/// @brief Registered keys indexed by file descriptor
+	QVector<SharedPtr<SelectionKey> > m_keys;
+	static Engine s_defaultEngine;
 	QList<SharedPtr<SelectionKey> > m_pendingKeys;
 	QMutex m_synchronize;
+	TimerWheel m_timers;
 };
 
+inline TimerWheel &Selector::timers() {
+	return m_timers;
+}
+
 inline void Selector::cancel() {
 	m_enabled = false;
+	wakeup();
 }
 
 }
@@ -30,6 +30,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <errno.h>
 
 #ifndef SO_REUSEPORT
 #	define SO_REUSEPORT 15
@@ -58,11 +59,11 @@ static int __bind(const QString &host, int port, uint opts) {
 		}
 		it = addrinfo;
 		do {
-			if ((fd = ::socket(it->ai_family, SOCK_STREAM, 0)) == -1) break;
+			if ((fd = ::socket(it->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) break;
 			if ((opts & ServerSocketChannel::OPT_REUSEADDR) && 
 				(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval) == -1)) break;
-// 			if ((opts & ServerSocketChannel::OPT_REUSEPORT) && 
-// 				(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof optval) == -1)) break;
+			if ((opts & ServerSocketChannel::OPT_REUSEPORT) && 
+				(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof optval) == -1)) break;
 			((struct sockaddr_in *)(it->ai_addr))->sin_port = htons(port);
 			bound |= (::bind(fd, it->ai_addr, it->ai_addrlen) == 0);
 			if (bound) {
@@ -87,8 +88,14 @@ static int __bind(const QString &host, int port, uint opts) {
 }
 
 ServerSocketChannel::ServerSocketChannel(const QString& host, int port, uint opts)
-: m_fd(__bind(host, port, opts)), m_name(host + ":" + QString::number(port)), 
-m_keepAlive(0), m_keepIntlv(0), m_keepIdle(0), m_keepCnt(0) {
+: m_fd(__bind(host, port, opts)), m_host(host), m_port(port), m_opts(opts), m_name(host + ":" + QString::number(port)), 
+m_keepAlive(0), m_keepIntlv(0), m_keepIdle(0), m_keepCnt(0), m_exhausted(false) {
+	logFiner() << "ServerSocketChannel::start listening on " << m_name;
+}
+
+ServerSocketChannel::ServerSocketChannel(int fd, const QString& name, uint opts)
+: m_fd(fd), m_host(name), m_port(0), m_opts(opts), m_name(name),
+m_keepAlive(0), m_keepIntlv(0), m_keepIdle(0), m_keepCnt(0), m_exhausted(false) {
 	logFiner() << "ServerSocketChannel::start listening on " << m_name;
 }
 
@@ -103,45 +110,106 @@ void ServerSocketChannel::closeFd() {
 	::close(m_fd);
 }
 
-#define CLIENT_HOST_MAXLEN 256
-#define CLIENT_SERV_MAXLEN 32
-
-void ServerSocketChannel::s_accept(int &cldf, QString &name) {
-	char client_host[CLIENT_HOST_MAXLEN + 1];
-	client_host[0] = '\0';
-	char client_serv[CLIENT_SERV_MAXLEN + 1];
-	client_serv[0] = '\0';
-	struct sockaddr sockaddr_client;
-	socklen_t sockaddr_len = sizeof(struct sockaddr);
-	cldf = ::accept(m_fd, &sockaddr_client, &sockaddr_len);
-	THROW_IOEXP_ON_ERR(cldf);
-	if (getnameinfo(&sockaddr_client, sockaddr_len, client_host, CLIENT_HOST_MAXLEN, client_serv, CLIENT_SERV_MAXLEN, 0) == -1) {
-		THROW_IOEXP(hstrerror(h_errno));
-	}
-	name = QString(client_host) + ":" + client_serv;
-	if (m_keepAlive) {
-		THROW_IOEXP_ON_ERR(setsockopt(cldf, SOL_SOCKET, SO_KEEPALIVE, &m_keepAlive, sizeof m_keepAlive));
-	}
-	if (m_keepIntlv) {
-		THROW_IOEXP_ON_ERR(setsockopt(cldf, IPPROTO_TCP, TCP_KEEPINTVL, &m_keepIntlv, sizeof m_keepIntlv));
-	}
-	if (m_keepIdle) {
-		THROW_IOEXP_ON_ERR(setsockopt(cldf, IPPROTO_TCP, TCP_KEEPIDLE, &m_keepIdle, sizeof m_keepIdle));
-	}
-	if (m_keepCnt) {
-		THROW_IOEXP_ON_ERR(setsockopt(cldf, IPPROTO_TCP, TCP_KEEPCNT, &m_keepCnt, sizeof m_keepCnt));
+bool ServerSocketChannel::s_accept(int &cldf, struct sockaddr_storage &addr, socklen_t &addrLen) {
+	for (;;) {
+		addrLen = sizeof(struct sockaddr_storage);
+		cldf = ::accept4(m_fd, (struct sockaddr *)&addr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (cldf != -1) {
+			if (m_exhausted) {
+				m_exhausted = false;
+				logInfo() << "ServerSocketChannel::accept on " << m_name << ": resumed";
+			}
+			return true;
+		}
+		switch (errno) {
+			case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+			case EWOULDBLOCK:
+#endif
+				return false;
+			case EINTR:
+			case ECONNABORTED:
+			case EPROTO:
+				// Connection reset before being accepted
+				continue;
+			case EMFILE:
+			case ENFILE:
+			case ENOBUFS:
+			case ENOMEM:
+				// Logged once until an accept succeeds again
+				if (!m_exhausted) {
+					m_exhausted = true;
+					logWarn() << "ServerSocketChannel::accept on " << m_name << ": " << QString::fromLocal8Bit(strerror(errno));
+				}
+				return false;
+		}
+		THROW_IOEXP_ON_ERR(cldf);
 	}
 }
 
 SocketChannelPtr ServerSocketChannel::accept() {
 	int cldf;
-	QString name;
-	s_accept(cldf, name);
-	return new SocketChannel(cldf, name);
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+	if (!s_accept(cldf, addr, addrLen)) {
+		return nullptr;
+	}
+	return new SocketChannel(cldf, (struct sockaddr *)&addr, addrLen);
+}
+
+void ServerSocketChannel::setSocketOption(int level, int option, int value, const char *label) {
+	// Inherited by the accepted sockets
+	if (setsockopt(m_fd, level, option, &value, sizeof value) == -1) {
+		logWarn() << "ServerSocketChannel: unable to set " << label << " on " << m_name << ": " << QString::fromLocal8Bit(strerror(errno));
+	}
+}
+
+void ServerSocketChannel::setKeepAlive(bool value) {
+	m_keepAlive = value ? 1 : 0;
+	setSocketOption(SOL_SOCKET, SO_KEEPALIVE, m_keepAlive, "SO_KEEPALIVE");
+}
+
+void ServerSocketChannel::setKeepIntlv(int value) {
+	m_keepIntlv = value;
+	setSocketOption(IPPROTO_TCP, TCP_KEEPINTVL, value, "TCP_KEEPINTVL");
+}
+
+void ServerSocketChannel::setKeepIdle(int value) {
+	m_keepIdle = value;
+	setSocketOption(IPPROTO_TCP, TCP_KEEPIDLE, value, "TCP_KEEPIDLE");
+}
+
+void ServerSocketChannel::setKeepCnt(int value) {
+	m_keepCnt = value;
+	setSocketOption(IPPROTO_TCP, TCP_KEEPCNT, value, "TCP_KEEPCNT");
 }
 
 void ServerSocketChannel::updateStatus(int events) {
 }
 
+ServerSocketChannelPtr ServerSocketChannel::duplicate() {
+	if (!(m_opts & OPT_REUSEPORT)) {
+		return nullptr;
+	}
+	ServerSocketChannelPtr copy = new ServerSocketChannel(m_host, m_port, m_opts);
+	copy->copyOptions(*this);
+	return copy;
+}
+
+void ServerSocketChannel::copyOptions(const ServerSocketChannel &other) {
+	if (other.m_keepAlive) {
+		setKeepAlive(true);
+	}
+	if (other.m_keepIntlv) {
+		setKeepIntlv(other.m_keepIntlv);
+	}
+	if (other.m_keepIdle) {
+		setKeepIdle(other.m_keepIdle);
+	}
+	if (other.m_keepCnt) {
+		setKeepCnt(other.m_keepCnt);
+	}
+}
+
 
 }
@@ -21,6 +21,7 @@
 
 #include <nodebus/core/exception.h>
 #include <nodebus/nio/channel.h>
+#include <sys/socket.h>
 
 /**
  * @namespace
@@ -59,10 +60,42 @@ public:
 	virtual ~ServerSocketChannel();
 	
 	/**
-	 * @brief Connect
+	 * @brief Accept a pending connection without blocking
+	 * @return the new socket or null if there is no pending connection
+	 * @throw IOException on error
 	 */
 	virtual SharedPtr<SocketChannel> accept();
 	
+	/**
+	 * @brief Open an other listening socket on the same address
+	 * 
+	 * This socket must have been opened with OPT_REUSEPORT, the kernel then
+	 * balances the incoming connections between the sockets.
+	 * 
+	 * @return a pointer to the new server socket or null if not supported
+	 */
+	virtual SharedPtr<ServerSocketChannel> duplicate();
+	
+	/**
+	 * @brief Get the listening address
+	 * @return host:port
+	 */
+	const QString &name();
+	
+	/**
+	 * @brief Return if the last accept failed on a descriptor or memory limit
+	 * 
+	 * The listener stays readable meanwhile, it must not be polled again
+	 * before a back-off delay.
+	 * 
+	 * @return true if the process or the system ran out of resources
+	 */
+	bool isExhausted();
+	
+	/**
+	 * @brief Keep-alive options, set once on the listening socket and
+	 * inherited by the accepted ones. A failure is logged only.
+	 */
 	void setKeepAlive(bool value);
 	void setKeepIntlv(int value);
 	void setKeepIdle(int value);
@@ -70,19 +103,42 @@ public:
 	
 protected:
 	/**
-	 * @brief Connect
+	 * @brief Listening socket constructor
+	 * @param fd non-blocking listening socket
+	 * @param name listening address
+	 * @param opts options
 	 */
-	virtual void s_accept(int &cldf, QString &name);
+	ServerSocketChannel(int fd, const QString &name, uint opts);
+	
+	/**
+	 * @brief Accept a pending connection
+	 * @param cldf new non-blocking socket
+	 * @param addr peer address
+	 * @param addrLen peer address length
+	 * @return false if there is no pending connection
+	 * @throw IOException on error
+	 */
+	virtual bool s_accept(int &cldf, struct sockaddr_storage &addr, socklen_t &addrLen);
 	
 	virtual int &fd();
 	virtual void closeFd();
 	virtual void updateStatus(int events);
+	/**
+	 * @brief Copy the socket options of an other server socket
+	 */
+	void copyOptions(const ServerSocketChannel &other);
+	void setSocketOption(int level, int option, int value, const char *label);
+	
 	int m_fd;
+	QString m_host;
+	int m_port;
+	uint m_opts;
 	QString m_name;
 	int m_keepAlive;
 	int m_keepIntlv;
 	int m_keepIdle;
 	int m_keepCnt;
+	bool m_exhausted;
 };
 
 inline uint ServerSocketChannel::OPT_BACKLOG(uint pendingQueueMaxLen) {
@@ -93,23 +149,14 @@ inline int &ServerSocketChannel::fd() {
 	return m_fd;
 }
 
-inline void ServerSocketChannel::setKeepAlive(bool value) {
-	m_keepAlive = value ? 1 : 0;
+inline const QString &ServerSocketChannel::name() {
+	return m_name;
 }
 
-inline void ServerSocketChannel::setKeepCnt(int value) {
-	m_keepCnt = value;
+inline bool ServerSocketChannel::isExhausted() {
+	return m_exhausted;
 }
 
-inline void ServerSocketChannel::setKeepIdle(int value) {
-	m_keepIdle = value;
-}
-
-inline void ServerSocketChannel::setKeepIntlv(int value) {
-	m_keepIntlv = value;
-}
-
-
 typedef SharedPtr<ServerSocketChannel> ServerSocketChannelPtr;
 
 }
@@ -24,7 +24,10 @@
 #include <QString>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <stddef.h>
+#include <errno.h>
 
 #define THROW_IOEXP_ON_ERR(exp) \
 	if ((exp) == -1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + QString::fromLocal8Bit(strerror(errno)))
@@ -48,7 +51,7 @@ static int __connect(const QString &host, int port) {
 		}
 		it = addrinfo;
 		do {
-			fd = ::socket(it->ai_family, SOCK_STREAM, 0);
+			fd = ::socket(it->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
 			if (fd == -1)
 				break;
 			((struct sockaddr_in *)(it->ai_addr))->sin_port = htons(port);
@@ -71,16 +74,84 @@ static int __connect(const QString &host, int port) {
 	}
 }
 
-SocketChannel::SocketChannel(const QString& host, int port): IOChannel(__connect(host, port), true), m_name(host + ":" + QString::number(port)) {
+SocketChannel::SocketChannel(const QString& host, int port): IOChannel(__connect(host, port), true),
+m_name(host + ":" + QString::number(port)), m_addrLen(0) {
 	logFiner() << "SocketChannel::connected to " << m_name;
 }
 
-SocketChannel::SocketChannel(int fd, const QString &name): IOChannel(fd, true), m_name(name) {
-	logFiner() << "SocketChannel::connected from " << m_name;
+SocketChannel::SocketChannel(int fd, const struct sockaddr *addr, socklen_t addrLen)
+: IOChannel(fd, CLOSE_ON_DELETE | READABLE | WRITABLE | KEEP_MODE), m_addrLen(qMin(addrLen, socklen_t(sizeof(m_addr)))) {
+	if (m_addrLen > 0) {
+		memcpy(&m_addr, addr, m_addrLen);
+	}
+	if (Logger::level() >= Logger::FINER) {
+		logFiner() << "SocketChannel::connected from " << name();
+	}
 }
 
 SocketChannel::~SocketChannel() {
-	logFiner() << "SocketChannel::disconnected from " << m_name;
+	if (Logger::level() >= Logger::FINER) {
+		logFiner() << "SocketChannel::disconnected from " << name();
+	}
+}
+
+const QString &SocketChannel::name() {
+	// Set once, the reference stays valid after unlocking
+	QMutexLocker _(&m_nameLock);
+	if (m_name.isEmpty() && m_addrLen > 0 && m_addr.ss_family == AF_UNIX) {
+		struct sockaddr_un *addr = (struct sockaddr_un *)&m_addr;
+		struct ucred cred;
+		socklen_t len = sizeof(cred);
+		if (m_addrLen > offsetof(struct sockaddr_un, sun_path) && addr->sun_path[0] != '\0') {
+			m_name = QString::fromLocal8Bit(addr->sun_path);
+		} else if (::getsockopt(m_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+			// Unnamed peer of an accepted local socket
+			m_name = "unix:" + QString::number(cred.pid);
+		} else {
+			m_name = "unix";
+		}
+	}
+	if (m_name.isEmpty() && m_addrLen > 0) {
+		char host[NI_MAXHOST];
+		char serv[NI_MAXSERV];
+		// Numeric only: no reverse DNS lookup
+		if (::getnameinfo((struct sockaddr *)&m_addr, m_addrLen, host, sizeof(host), serv, sizeof(serv),
+			NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+			m_name = QString(host) + ":" + serv;
+		} else {
+			m_name = "?";
+		}
+	}
+	return m_name;
+}
+
+size_t SocketChannel::s_sendmsg(const struct iovec *iov, int iovcnt, const void *control, size_t controlLen) {
+	struct msghdr msg;
+	bzero(&msg, sizeof(msghdr));
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = iovcnt;
+	msg.msg_control = (void *)control;
+	msg.msg_controllen = controlLen;
+	ssize_t ret = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+	THROW_IOEXP_ON_ERR(ret);
+	return ret;
+}
+
+size_t SocketChannel::s_writev(const struct iovec *iov, int iovcnt, bool more) {
+	struct msghdr msg;
+	bzero(&msg, sizeof(msghdr));
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = iovcnt;
+	// MSG_MORE holds the last partial segment while the channel is corked
+	ssize_t ret = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+	THROW_IOEXP_ON_ERR(ret);
+	return ret;
 }
 
 }
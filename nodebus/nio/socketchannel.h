@@ -21,6 +21,8 @@
 
 #include <nodebus/core/exception.h>
 #include <nodebus/nio/iochannel.h>
+#include <QMutex>
+#include <sys/socket.h>
 
 /**
  * @namespace
@@ -49,13 +51,48 @@ public:
 	 */
 	virtual ~SocketChannel();
 	
+	/**
+	 * @brief Get the peer name
+	 * 
+	 * The name of an accepted socket is formatted numerically on the first call,
+	 * which may come from any thread.
+	 * 
+	 * @return host:port, the path or unix:<pid> for a local socket
+	 */
+	const QString &name();
+	
+	/**
+	 * @brief Run the connection handshake without blocking
+	 * 
+	 * Called again when the socket is ready for the returned operations
+	 * until it returns 0.
+	 * 
+	 * @return 0 once done, otherwise SelectionKey::OP_READ or OP_WRITE
+	 * @throw IOException if the handshake fails
+	 */
+	virtual int handshake();
+	
 protected:
-	SocketChannel(int fd, const QString &name);
+	/**
+	 * @brief Accepted socket constructor
+	 * @param fd non-blocking socket
+	 * @param addr peer address, may be null
+	 * @param addrLen peer address length
+	 */
+	SocketChannel(int fd, const struct sockaddr *addr, socklen_t addrLen);
+	virtual size_t s_writev(const struct iovec *iov, int iovcnt, bool more);
+	virtual size_t s_sendmsg(const struct iovec *iov, int iovcnt, const void *control, size_t controlLen);
 	
-private:
 	QString m_name;
+	QMutex m_nameLock;
+	struct sockaddr_storage m_addr;
+	socklen_t m_addrLen;
 };
 
+inline int SocketChannel::handshake() {
+	return 0;
+}
+
 typedef SharedPtr<SocketChannel> SocketChannelPtr;
 
 }
@@ -41,6 +41,17 @@ public:
     virtual ~SSLContext();
 	
 	virtual SSL_CTX *getCTX() = 0;
+	
+	/**
+	 * @brief Let OpenSSL offload the record layer to the kernel (kTLS)
+	 * 
+	 * The offload is set up by each connection once its handshake is done,
+	 * if the kernel supports the negotiated cipher suite. The connections
+	 * fall back to the user space record layer otherwise.
+	 * 
+	 * @return false if the OpenSSL library is built without kTLS support
+	 */
+	bool enableKernelTLS();
 };
 
 inline SSLContext::SSLContext() {
@@ -49,6 +60,15 @@ inline SSLContext::SSLContext() {
 inline SSLContext::~SSLContext() {
 }
 
+inline bool SSLContext::enableKernelTLS() {
+#ifdef SSL_OP_ENABLE_KTLS
+	SSL_CTX_set_options(getCTX(), SSL_OP_ENABLE_KTLS);
+	return true;
+#else
+	return false;
+#endif
+}
+
 
 typedef SharedPtr<SSLContext> SSLContextPtr;
 
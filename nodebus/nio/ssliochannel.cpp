@@ -22,6 +22,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <QString>
+#include <atomic>
+#include <climits>
 
 #define THROW_IOEXP_ON_ERR(exp) \
 	if ((exp) < 1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + getLastError())
@@ -31,6 +33,9 @@
 
 namespace NodeBus {
 
+static std::atomic<quint64> s_records(0);
+static std::atomic<quint64> s_recordBytes(0);
+
 QString SSLIOChannel::getLastError() {
 	QString msg;
 	const char *txt;
@@ -52,43 +57,129 @@ QString SSLIOChannel::getLastError() {
 SSLIOChannel::SSLIOChannel(int fd, SSL_CTX *ctx, bool closeOnDelete) : IOChannel(fd, closeOnDelete), m_ssl(nullptr) {
 	THROW_IOEXP_ON_NULL(m_ssl = SSL_new(ctx));
 	THROW_IOEXP_ON_ERR(SSL_set_fd(m_ssl, fd));
+	SSL_set_mode(m_ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 }
 
 SSLIOChannel::~SSLIOChannel() {
 	if (m_closeOnDelete && isOpen()) {
-		close();
+		closeNow();
 	}
 	::SSL_free(m_ssl);
 }
 
 size_t SSLIOChannel::s_read(char *buffer, size_t maxlen) {
 	ssize_t n = SSL_read(m_ssl, buffer, maxlen);
-	if (n == 0) {
-		int e = SSL_get_error(m_ssl, n);
-		if (e == SSL_ERROR_NONE || e == SSL_ERROR_ZERO_RETURN) {
-			throw EOFException();
+	if (n <= 0) {
+		switch (SSL_get_error(m_ssl, n)) {
+			case SSL_ERROR_NONE:
+			case SSL_ERROR_ZERO_RETURN:
+				throw EOFException();
+			case SSL_ERROR_WANT_READ:
+			case SSL_ERROR_WANT_WRITE:
+				return 0;
 		}
 	}
 	THROW_IOEXP_ON_ERR(n);
 	return n;
 }
 
-void SSLIOChannel::s_write(const char *buffer, size_t len) {
-	ssize_t ret = 0;
-	while (len > 0) {
-		THROW_IOEXP_ON_ERR(ret = SSL_write(m_ssl, buffer, len));
-		len -= ret;
-		buffer += ret;
+size_t SSLIOChannel::s_write(const char *buffer, size_t len) {
+	struct iovec iov;
+	iov.iov_base = (void*)buffer;
+	iov.iov_len = len;
+	return writeRecords(m_ssl, &iov, 1);
+}
+
+size_t SSLIOChannel::writeRecords(SSL *ssl, const struct iovec *iov, int iovcnt) {
+	// The data is encrypted at once, any thread can use the same buffer
+	static thread_local char stage[NODEBUS_SSLIOCHANNEL_RECORD_SIZE];
+	size_t count = 0;
+	size_t offset = 0;
+	int i = 0;
+	while (i < iovcnt) {
+		const char *data = (const char*)iov[i].iov_base + offset;
+		size_t len = iov[i].iov_len - offset;
+		if (len < NODEBUS_SSLIOCHANNEL_RECORD_SIZE && i + 1 < iovcnt) {
+			len = 0;
+			for (int j = i; j < iovcnt && len < NODEBUS_SSLIOCHANNEL_RECORD_SIZE; j++) {
+				size_t start = j == i ? offset : 0;
+				size_t n = qMin(iov[j].iov_len - start, NODEBUS_SSLIOCHANNEL_RECORD_SIZE - len);
+				memcpy(stage + len, (const char*)iov[j].iov_base + start, n);
+				len += n;
+			}
+			data = stage;
+		}
+		if (len == 0) {
+			i++;
+			offset = 0;
+			continue;
+		}
+		int ret = SSL_write(ssl, data, qMin(len, size_t(INT_MAX)));
+		if (ret <= 0) {
+			switch (SSL_get_error(ssl, ret)) {
+				case SSL_ERROR_WANT_READ:
+				case SSL_ERROR_WANT_WRITE:
+					return count;
+			}
+		}
+		THROW_IOEXP_ON_ERR(ret);
+		size_t written = ret;
+		s_records += (written + NODEBUS_SSLIOCHANNEL_RECORD_SIZE - 1) / NODEBUS_SSLIOCHANNEL_RECORD_SIZE;
+		s_recordBytes += written;
+		count += written;
+		written += offset;
+		while (i < iovcnt && written >= iov[i].iov_len) {
+			written -= iov[i].iov_len;
+			i++;
+		}
+		offset = written;
+		if (size_t(ret) < len) {
+			// Partial write, the output is full
+			break;
+		}
 	}
+	return count;
 }
 
-void SSLIOChannel::close() {
-	if (isOpen()) {
-		::SSL_shutdown(m_ssl);
-		IOChannel::close();
+QVariantMap SSLIOChannel::recordStats() {
+	QVariantMap res;
+	quint64 records = s_records.load();
+	quint64 bytes = s_recordBytes.load();
+	res["records"] = (qulonglong)records;
+	res["bytes"] = (qulonglong)bytes;
+	res["mean-record-size"] = records == 0 ? 0.0 : double(bytes) / records;
+	return res;
+}
+
+void SSLIOChannel::handshake(int (*fn)(SSL *)) {
+	int ret;
+	while ((ret = fn(m_ssl)) != 1) {
+		switch (SSL_get_error(m_ssl, ret)) {
+			case SSL_ERROR_WANT_READ:
+				s_waitForReadyRead(-1);
+				break;
+			case SSL_ERROR_WANT_WRITE:
+				s_waitForReadyWrite(-1);
+				break;
+			default:
+				THROW_IOEXP_ON_ERR(ret);
+		}
 	}
 }
 
+size_t SSLIOChannel::s_readv(const struct iovec *iov, int iovcnt) {
+	return StreamChannel::s_readv(iov, iovcnt);
+}
+
+size_t SSLIOChannel::s_writev(const struct iovec *iov, int iovcnt, bool more) {
+	Q_UNUSED(more);
+	return writeRecords(m_ssl, iov, iovcnt);
+}
+
+void SSLIOChannel::s_shutdown() {
+	::SSL_shutdown(m_ssl);
+}
+
 size_t SSLIOChannel::s_available() {
 	size_t result = SSL_pending(m_ssl);
 	if (result > 0) {
@@ -99,11 +190,11 @@ size_t SSLIOChannel::s_available() {
 }
 
 void SSLIOChannel::accept() {
-	THROW_IOEXP_ON_ERR(::SSL_accept(m_ssl));
+	handshake(::SSL_accept);
 }
 
 void SSLIOChannel::connect() {
-	THROW_IOEXP_ON_ERR(::SSL_connect(m_ssl));
+	handshake(::SSL_connect);
 }
 
 }
@@ -23,6 +23,10 @@
 #include <openssl/err.h>
 #include <nodebus/core/shareddata.h>
 #include <nodebus/nio/iochannel.h>
+#include <QVariant>
+
+/// @brief Maximum TLS record payload, small output slices are staged up to it
+#define NODEBUS_SSLIOCHANNEL_RECORD_SIZE 16384
 
 /**
  * @namespace
@@ -63,20 +67,45 @@ public:
 	 */
 	void accept();
 	
+	static QString getLastError();
+	
 	/**
-	 * @brief Close the channel
+	 * @brief Write output slices as full TLS records
+	 * 
+	 * The small slices are gathered into a plaintext staging buffer so that
+	 * each SSL_write() call produces records of up to
+	 * NODEBUS_SSLIOCHANNEL_RECORD_SIZE bytes. Large slices are written
+	 * without copy. Retries after SSL_ERROR_WANT_WRITE must pass the same
+	 * data again, which is the case of the channel output queue.
+	 * 
+	 * @param ssl SSL session
+	 * @return number of bytes written, 0 if the output is full
 	 * @throw IOException on error
 	 */
-	virtual void close();
+	static size_t writeRecords(SSL *ssl, const struct iovec *iov, int iovcnt);
 	
-	static QString getLastError();
+	/**
+	 * @brief Get the output record metrics of all the SSL channels
+	 * @return record count, plaintext bytes and mean record size
+	 */
+	static QVariantMap recordStats();
 	
 protected:
 	virtual size_t s_available();
 	virtual size_t s_read(char *buffer, size_t maxlen);
-	virtual void s_write(const char *buffer, size_t len);
+	virtual size_t s_readv(const struct iovec *iov, int iovcnt);
+	virtual size_t s_write(const char *buffer, size_t len);
+	virtual size_t s_writev(const struct iovec *iov, int iovcnt, bool more);
+	virtual void s_shutdown();
 
 private:
+	/**
+	 * @brief Run a handshake step until completion, waiting for the socket as needed
+	 * @param fn SSL_accept or SSL_connect
+	 * @throw IOException on error
+	 */
+	void handshake(int (*fn)(SSL *));
+	
 	SSL *m_ssl;
 };
 
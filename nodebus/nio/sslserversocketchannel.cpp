@@ -49,14 +49,23 @@ void SSLServerSocketChannel::close() {
 	ServerSocketChannel::close();
 }
 
-#define CLIENT_HOST_MAXLEN 256
-#define CLIENT_SERV_MAXLEN 32
-
 SocketChannelPtr SSLServerSocketChannel::accept() {
 	int cldf;
-	QString name;
-	s_accept(cldf, name);
-	return new SSLSocketChannel(cldf, name, m_ctx);
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+	if (!s_accept(cldf, addr, addrLen)) {
+		return nullptr;
+	}
+	return new SSLSocketChannel(cldf, (struct sockaddr *)&addr, addrLen, m_ctx);
+}
+
+ServerSocketChannelPtr SSLServerSocketChannel::duplicate() {
+	if (!(m_opts & OPT_REUSEPORT)) {
+		return nullptr;
+	}
+	SharedPtr<SSLServerSocketChannel> copy = new SSLServerSocketChannel(m_host, m_port, m_ctx, m_opts);
+	copy->copyOptions(*this);
+	return copy;
 }
 
 }
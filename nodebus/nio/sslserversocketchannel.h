@@ -61,6 +61,11 @@ public:
 	 */
 	virtual SharedPtr<SocketChannel> accept();
 	
+	/**
+	 * @brief Open an other listening socket on the same address
+	 */
+	virtual SharedPtr<ServerSocketChannel> duplicate();
+	
 private:
     SSLContextPtr m_ctx;
 };
@@ -19,11 +19,17 @@
 #include "sslsocketchannel.h"
 #include <nodebus/core/logger.h>
 #include "ssliochannel.h"
+#include "selectionkey.h"
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <atomic>
 #include <openssl/err.h>
 #include <QString>
+#include <QElapsedTimer>
+#include <QVarLengthArray>
 
 #define THROW_IOEXP_ON_ERR(exp) \
 	if ((exp) < 1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + SSLIOChannel::getLastError())
@@ -31,26 +37,53 @@
 #define THROW_IOEXP_ON_NULL(exp) \
 	if ((exp) == nullptr) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + SSLIOChannel::getLastError())
 
+#define THROW_IOEXP_ON_SYSERR(exp) \
+	if ((exp) == -1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + QString::fromLocal8Bit(strerror(errno)))
+
 namespace NodeBus {
 
-SSLSocketChannel::SSLSocketChannel(const QString& host, int port, SSLContextPtr ctx) : SocketChannel(host, port), m_ssl(NULL) {
+static std::atomic<quint64> s_socketReads(0);
+static std::atomic<quint64> s_socketWrites(0);
+static std::atomic<quint64> s_bytesIn(0);
+static std::atomic<quint64> s_bytesOut(0);
+/// @brief Time spent in the record layer and in the handshakes (nanoseconds)
+static std::atomic<quint64> s_cryptoTime(0);
+static std::atomic<quint64> s_handshakeTime(0);
+
+SSLSocketChannel::SSLSocketChannel(const QString& host, int port, SSLContextPtr ctx)
+: SocketChannel(host, port), m_ssl(NULL), m_netBio(NULL), m_handshaking(true), m_ktlsSend(false), m_ktlsRecv(false) {
 	THROW_IOEXP_ON_NULL(m_ssl = SSL_new(ctx->getCTX()));
 	try {
-		THROW_IOEXP_ON_ERR(SSL_set_fd(m_ssl, m_fd));
-		THROW_IOEXP_ON_ERR(::SSL_connect(m_ssl));
+		setupBIO(ctx);
+		SSL_set_connect_state(m_ssl);
+		int ops;
+		while ((ops = handshake()) != 0) {
+			if (ops == SelectionKey::OP_READ) {
+				s_waitForReadyRead(-1);
+			} else {
+				s_waitForReadyWrite(-1);
+			}
+		}
 	} catch (Exception &e) {
 		SSL_free(m_ssl);
+		if (m_netBio != NULL) {
+			BIO_free(m_netBio);
+		}
 		throw e;
 	}
 }
 
-SSLSocketChannel::SSLSocketChannel(int fd, const QString& name, SSLContextPtr ctx) : SocketChannel(fd, name), m_ssl(NULL) {
+SSLSocketChannel::SSLSocketChannel(int fd, const struct sockaddr *addr, socklen_t addrLen, SSLContextPtr ctx)
+: SocketChannel(fd, addr, addrLen), m_ssl(NULL), m_netBio(NULL), m_handshaking(true), m_ktlsSend(false), m_ktlsRecv(false) {
 	THROW_IOEXP_ON_NULL(m_ssl = SSL_new(ctx->getCTX()));
 	try {
-		THROW_IOEXP_ON_ERR(SSL_set_fd(m_ssl, m_fd));
-		THROW_IOEXP_ON_ERR(::SSL_accept(m_ssl));
+		setupBIO(ctx);
+		SSL_set_accept_state(m_ssl);
 	} catch (Exception &e) {
 		SSL_free(m_ssl);
+		if (m_netBio != NULL) {
+			BIO_free(m_netBio);
+		}
 		throw e;
 	}
 }
@@ -58,46 +91,236 @@ SSLSocketChannel::SSLSocketChannel(int fd, const QString& name, SSLContextPtr ct
 
 SSLSocketChannel::~SSLSocketChannel() {
 	if (isOpen()) {
-		close();
+		closeNow();
 	}
 	::SSL_free(m_ssl);
+	if (m_netBio != NULL) {
+		BIO_free(m_netBio);
+	}
 }
 
-size_t SSLSocketChannel::s_read(char *buffer, size_t maxlen) {
-	ssize_t n = SSL_read(m_ssl, buffer, maxlen);
-	if (n == 0) {
-		int e = SSL_get_error(m_ssl, n);
-		if (e == SSL_ERROR_NONE || e == SSL_ERROR_ZERO_RETURN) {
+void SSLSocketChannel::setupBIO(SSLContextPtr ctx) {
+	SSL_set_mode(m_ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+	if (SSL_CTX_get_options(ctx->getCTX()) & SSL_OP_ENABLE_KTLS) {
+		// The kernel offload needs OpenSSL to own the socket
+		THROW_IOEXP_ON_ERR(SSL_set_fd(m_ssl, m_fd));
+		return;
+	}
+#else
+	Q_UNUSED(ctx);
+#endif
+	BIO *internal;
+	THROW_IOEXP_ON_ERR(BIO_new_bio_pair(&internal, NODEBUS_SSLSOCKETCHANNEL_BIO_SIZE, &m_netBio, NODEBUS_SSLSOCKETCHANNEL_BIO_SIZE));
+	SSL_set_bio(m_ssl, internal, internal);
+}
+
+size_t SSLSocketChannel::pull() {
+	size_t count = 0;
+	char *buffer;
+	ssize_t space;
+	// Received straight into the pair buffer, several records at once
+	while ((space = BIO_nwrite0(m_netBio, &buffer)) > 0) {
+		ssize_t n = ::read(m_fd, buffer, space);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		THROW_IOEXP_ON_SYSERR(n);
+		s_socketReads++;
+		if (n == 0) {
+			if (count > 0) {
+				break;
+			}
 			throw EOFException();
 		}
+		BIO_nwrite(m_netBio, &buffer, n);
+		s_bytesIn += n;
+		count += n;
+		if (n < space) {
+			break;
+		}
 	}
-	THROW_IOEXP_ON_ERR(n);
-	return n;
+	return count;
 }
 
-void SSLSocketChannel::s_write(const char *buffer, size_t len) {
-	ssize_t ret = 0;
-	while (len > 0) {
-		THROW_IOEXP_ON_ERR(ret = SSL_write(m_ssl, buffer, len));
-		len -= ret;
-		buffer += ret;
+bool SSLSocketChannel::push(bool more) {
+	char *buffer;
+	ssize_t len;
+	while ((len = BIO_nread0(m_netBio, &buffer)) > 0) {
+		ssize_t n = ::send(m_fd, buffer, len, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return false;
+		}
+		THROW_IOEXP_ON_SYSERR(n);
+		s_socketWrites++;
+		s_bytesOut += n;
+		BIO_nread(m_netBio, &buffer, n);
+		if (n < len) {
+			return false;
+		}
 	}
+	return true;
 }
 
-void SSLSocketChannel::close() {
-	if (isOpen()) {
+size_t SSLSocketChannel::s_read(char *buffer, size_t maxlen) {
+	QMutexLocker _(&m_recordLock);
+	// With kTLS RX, OpenSSL receives the decrypted records and handles the
+	// control ones (alerts, key updates) which a plain read() would fail on
+	for (;;) {
+		QElapsedTimer timer;
+		timer.start();
+		ssize_t n = SSL_read(m_ssl, buffer, maxlen);
+		s_cryptoTime += timer.nsecsElapsed();
+		if (n > 0) {
+			return n;
+		}
+		switch (SSL_get_error(m_ssl, n)) {
+			case SSL_ERROR_NONE:
+			case SSL_ERROR_ZERO_RETURN:
+				throw EOFException();
+			case SSL_ERROR_WANT_READ:
+				if (m_netBio != NULL) {
+					// Post-handshake messages may need an answer
+					push();
+					if (pull() > 0) {
+						continue;
+					}
+				}
+				return 0;
+			case SSL_ERROR_WANT_WRITE:
+				if (m_netBio != NULL && push()) {
+					continue;
+				}
+				return 0;
+		}
+		THROW_IOEXP_ON_ERR(n);
+	}
+}
+
+size_t SSLSocketChannel::s_write(const char *buffer, size_t len) {
+	struct iovec iov;
+	iov.iov_base = (void*)buffer;
+	iov.iov_len = len;
+	return s_writev(&iov, 1, false);
+}
+
+int SSLSocketChannel::handshake() {
+	QMutexLocker _(&m_recordLock);
+	if (!m_handshaking) {
+		return 0;
+	}
+	for (;;) {
+		QElapsedTimer timer;
+		timer.start();
+		int ret = SSL_do_handshake(m_ssl);
+		s_handshakeTime += timer.nsecsElapsed();
+		int error = ret == 1 ? SSL_ERROR_NONE : SSL_get_error(m_ssl, ret);
+		if (m_netBio != NULL) {
+			// Each flight is sent as soon as it is produced, alerts included
+			if (!push()) {
+				return SelectionKey::OP_WRITE;
+			}
+			if ((error == SSL_ERROR_WANT_READ && pull() > 0) || error == SSL_ERROR_WANT_WRITE) {
+				continue;
+			}
+		}
+		switch (error) {
+			case SSL_ERROR_NONE:
+				m_handshaking = false;
+#ifdef BIO_get_ktls_send
+				// Set up by OpenSSL if enabled by the context and supported
+				if (m_netBio == NULL) {
+					m_ktlsSend = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+					m_ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(m_ssl));
+				}
+#endif
+				if (Logger::level() >= Logger::FINER) {
+					logFiner() << "SSLSocketChannel: " << SSL_get_cipher_name(m_ssl) << " connection from " << name()
+						<< (m_ktlsSend ? ", kTLS TX" : "") << (m_ktlsRecv ? ", kTLS RX" : "");
+				}
+				return 0;
+			case SSL_ERROR_WANT_READ:
+				return SelectionKey::OP_READ;
+			case SSL_ERROR_WANT_WRITE:
+				return SelectionKey::OP_WRITE;
+		}
+		// Clear the error queue of the calling thread
+		QString message = SSLIOChannel::getLastError();
+		throw IOException("TLS handshake failed" + (message.isEmpty() ? QString() : ": " + message));
+	}
+}
+
+size_t SSLSocketChannel::s_readv(const struct iovec *iov, int iovcnt) {
+	return StreamChannel::s_readv(iov, iovcnt);
+}
+
+size_t SSLSocketChannel::s_writev(const struct iovec *iov, int iovcnt, bool more) {
+	QMutexLocker _(&m_recordLock);
+	if (m_ktlsSend) {
+		// The kernel frames the records: a single gather write, no copy
+		return SocketChannel::s_writev(iov, iovcnt, more);
+	}
+	if (m_netBio == NULL) {
+		return SSLIOChannel::writeRecords(m_ssl, iov, iovcnt);
+	}
+	QVarLengthArray<struct iovec, NODEBUS_STREAMCHANNEL_IOV_MAX> rest;
+	rest.append(iov, iovcnt);
+	int first = 0;
+	size_t count = 0;
+	// The previous records are sent first to free the pair buffer
+	while (push(more) && first < rest.size()) {
+		QElapsedTimer timer;
+		timer.start();
+		size_t n = SSLIOChannel::writeRecords(m_ssl, rest.data() + first, rest.size() - first);
+		s_cryptoTime += timer.nsecsElapsed();
+		if (n == 0) {
+			break;
+		}
+		count += n;
+		while (first < rest.size() && n >= rest[first].iov_len) {
+			n -= rest[first].iov_len;
+			first++;
+		}
+		if (first < rest.size()) {
+			rest[first].iov_base = (char*)rest[first].iov_base + n;
+			rest[first].iov_len -= n;
+		}
+	}
+	return count;
+}
+
+size_t SSLSocketChannel::s_pending() {
+	QMutexLocker _(&m_recordLock);
+	return m_netBio != NULL ? BIO_ctrl_pending(m_netBio) : 0;
+}
+
+void SSLSocketChannel::s_shutdown() {
+	QMutexLocker _(&m_recordLock);
+	if (!m_handshaking) {
 		::SSL_shutdown(m_ssl);
-		IOChannel::close();
+		if (m_netBio != NULL) {
+			// Best effort close notify
+			push();
+		}
 	}
 }
 
 size_t SSLSocketChannel::s_available() {
-	size_t result = SSL_pending(m_ssl);
-	if (result > 0) {
-		return result;
-	}
-	result = IOChannel::s_available();
-	return result;
+	QMutexLocker _(&m_recordLock);
+	// Only the decrypted bytes: a received record may be incomplete, the
+	// ciphertext buffered in the BIO pair or in the socket is not counted
+	return SSL_pending(m_ssl);
+}
+
+QVariantMap SSLSocketChannel::engineStats() {
+	QVariantMap res;
+	res["socket-reads"] = (qulonglong)s_socketReads.load();
+	res["socket-writes"] = (qulonglong)s_socketWrites.load();
+	res["bytes-in"] = (qulonglong)s_bytesIn.load();
+	res["bytes-out"] = (qulonglong)s_bytesOut.load();
+	res["crypto-usecs"] = (qulonglong)(s_cryptoTime.load() / 1000);
+	res["handshake-usecs"] = (qulonglong)(s_handshakeTime.load() / 1000);
+	return res;
 }
 
 }
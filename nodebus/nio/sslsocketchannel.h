@@ -23,6 +23,11 @@
 #include <nodebus/core/shareddata.h>
 #include <nodebus/nio/socketchannel.h>
 #include <nodebus/nio/sslcontext.h>
+#include <QVariant>
+#include <QMutex>
+
+/// @brief Size of each direction of the BIO pair between OpenSSL and the socket
+#define NODEBUS_SSLSOCKETCHANNEL_BIO_SIZE 65536
 
 /**
  * @namespace
@@ -32,7 +37,12 @@ namespace NodeBus {
 class SSLServerSocketChannel;
 
 /**
- * @brief Abstract channel
+ * @brief TLS socket channel
+ * 
+ * OpenSSL is bound to a BIO pair instead of the socket: the channel moves
+ * the records between the pair and the socket with batched system calls,
+ * so the record layer only runs memory to memory. The socket is left to
+ * OpenSSL when the context enables the kernel offload (kTLS).
  * 
  * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
  * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
@@ -55,21 +65,76 @@ public:
 	virtual ~SSLSocketChannel();
 	
 	/**
-	 * @brief Close the channel
-	 * @throw IOException on error
+	 * @brief Run a TLS handshake step without blocking
+	 * @return 0 once done, otherwise SelectionKey::OP_READ or OP_WRITE
+	 * @throw IOException if the handshake fails
+	 */
+	virtual int handshake();
+	
+	/**
+	 * @brief Return if the output records are built by the kernel (kTLS)
+	 * 
+	 * The socket can then be written with plain system calls, such as
+	 * sendfile() or splice(), once the output queue is flushed.
+	 * 
+	 * @return true if the transmission is offloaded, otherwise false
 	 */
-	virtual void close();
+	bool isKernelTLS();
+	
+	/**
+	 * @brief Get the engine metrics of all the TLS socket channels
+	 * @return socket calls and bytes, time spent in the record layer and in
+	 * the handshakes in microseconds
+	 */
+	static QVariantMap engineStats();
 	
 protected:
-	SSLSocketChannel(int fd, const QString &name, SSLContextPtr ctx);
+	/**
+	 * @brief Accepted socket constructor, the handshake is left to the
+	 * selector through handshake()
+	 */
+	SSLSocketChannel(int fd, const struct sockaddr *addr, socklen_t addrLen, SSLContextPtr ctx);
 	virtual size_t s_available();
 	virtual size_t s_read(char *buffer, size_t maxlen);
-	virtual void s_write(const char *buffer, size_t len);
+	virtual size_t s_readv(const struct iovec *iov, int iovcnt);
+	virtual size_t s_write(const char *buffer, size_t len);
+	virtual size_t s_writev(const struct iovec *iov, int iovcnt, bool more);
+	virtual size_t s_pending();
+	virtual void s_shutdown();
 
 private:
+	void setupBIO(SSLContextPtr ctx);
+	
+	/**
+	 * @brief Receive records into the BIO pair
+	 * @return number of bytes received, 0 if none is available
+	 * @throw EOFException at the end of the stream
+	 */
+	size_t pull();
+	
+	/**
+	 * @brief Send the records produced by OpenSSL
+	 * @param more more data will follow shortly
+	 * @return true once the BIO pair is drained
+	 */
+	bool push(bool more = false);
+	
+	/// @brief Serializes the record layer: the channel is read by a worker
+	/// while the other threads write to it or the reactor flushes it
+	QMutex m_recordLock;
 	SSL *m_ssl;
+	/// @brief Network side of the BIO pair, null if OpenSSL owns the socket
+	BIO *m_netBio;
+	bool m_handshaking;
+	/// @brief Records offloaded to the kernel after the handshake
+	bool m_ktlsSend;
+	bool m_ktlsRecv;
 };
 
+inline bool SSLSocketChannel::isKernelTLS() {
+	return m_ktlsSend;
+}
+
 }
 
 #endif // JSONPARSER_SSLSOCKETCHANNEL_H
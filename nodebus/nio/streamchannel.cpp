@@ -17,88 +17,370 @@
  */
 
 #include "iochannel.h"
+#include "selectionkey.h"
 #include <nodebus/core/logger.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <string.h>
 #include <unistd.h>
 #include <QString>
+#include <QDateTime>
 
 #define THROW_IOEXP_ON_ERR(exp) \
 	if ((exp) == -1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + QString::fromLocal8Bit(strerror(errno)))
 
 namespace NodeBus {
 
-inline void StreamChannel::checkBuf() {
+size_t StreamChannel::s_defaultBufferSize = NODEBUS_STREAMCHANNEL_BUFFER_SIZE;
+size_t StreamChannel::s_defaultLowWaterMark = NODEBUS_STREAMCHANNEL_LOW_WATER_MARK;
+size_t StreamChannel::s_defaultHighWaterMark = NODEBUS_STREAMCHANNEL_HIGH_WATER_MARK;
+
+StreamChannel::StreamChannel(): m_readBuff(nullptr), m_readMask(0), m_readStart(0), m_readEnd(0),
+m_deadline(-1), m_readCalls(0), m_outOffset(0), m_outSize(0), m_outTailOwned(false), m_corked(0),
+m_saturated(false), m_closing(false), m_lowWaterMark(s_defaultLowWaterMark),
+m_highWaterMark(s_defaultHighWaterMark), m_writeCalls(0) {
+	size_t size = 64;
+	while (size < s_defaultBufferSize) {
+		size <<= 1;
+	}
+	m_readBuff = new char[size];
+	m_readMask = size - 1;
+	QIODevice::open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+void StreamChannel::setDefaultBufferSize(size_t size) {
+	s_defaultBufferSize = size;
+}
+
+void StreamChannel::setDefaultWaterMarks(size_t low, size_t high) {
+	s_defaultLowWaterMark = low;
+	s_defaultHighWaterMark = qMax(low, high);
+}
+
+void StreamChannel::setWaterMarks(size_t low, size_t high) {
+	QMutexLocker _(&m_writeLock);
+	m_lowWaterMark = low;
+	m_highWaterMark = qMax(low, high);
+}
+
+size_t StreamChannel::fill(bool wait) {
+	size_t size = m_readMask + 1;
 	if (m_readEnd == m_readStart) {
-		size_t n;
-		n = available(true);
-		m_readEnd = s_read(m_readBuff, qMin(n, (size_t)sizeof(m_readBuff)));
-		m_readStart = 0;
+		// Restart at the buffer begining to get a single contiguous area
+		m_readStart = m_readEnd = 0;
+	}
+	size_t free = size - (m_readEnd - m_readStart);
+	size_t offset = m_readEnd & m_readMask;
+	struct iovec iov[2];
+	iov[0].iov_base = m_readBuff + offset;
+	iov[0].iov_len = qMin(free, size - offset);
+	iov[1].iov_base = m_readBuff;
+	iov[1].iov_len = free - iov[0].iov_len;
+	size_t n;
+	// A short read means the socket is drained: no need to read until EAGAIN
+	while (m_readCalls++, (n = s_readv(iov, iov[1].iov_len > 0 ? 2 : 1)) == 0 && wait) {
+		waitFor(false);
 	}
+	m_readEnd += n;
+	return n;
 }
 
-char StreamChannel::get() {
-	checkBuf();
-	return m_readBuff[m_readStart++];
+void StreamChannel::setDeadLine(qint64 msecs) {
+	m_deadline = msecs == -1 ? -1 : TimerWheel::now() + (msecs - QDateTime::currentMSecsSinceEpoch());
 }
 
-char StreamChannel::peek() {
-	checkBuf();
-	return m_readBuff[m_readStart];
+void StreamChannel::waitFor(bool write) {
+	while (m_readCalls++, !(write ? s_waitForReadyWrite(100) : s_waitForReadyRead(100))) {
+		if (!m_active) {
+			throw EOFException("Closed channel");
+		}
+		if (m_deadline != -1 && m_deadline < TimerWheel::now()) {
+			throw IOTimeoutException("Time exceeds");
+		}
+	}
 }
 
-void StreamChannel::ignore(size_t len) {
-	for (size_t i=0; i < len; i++) {
-		get();
+size_t StreamChannel::s_readv(const struct iovec *iov, int iovcnt) {
+	size_t count = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		size_t n = s_read((char*)iov[i].iov_base, iov[i].iov_len);
+		count += n;
+		if (n < iov[i].iov_len) {
+			break;
+		}
 	}
+	return count;
 }
 
 size_t StreamChannel::read(char *buffer, size_t maxlen) {
 	size_t count;
-	if (m_readEnd != m_readStart) {
-		count = qMin(m_readEnd - m_readStart, maxlen);
-		memcpy(buffer, m_readBuff + m_readStart, count);
-		m_readStart += count;
-		return count;
+	if (m_readEnd == m_readStart) {
+		if (maxlen > m_readMask) {
+			// Large read, bypass the buffer
+			while (m_readCalls++, (count = s_read(buffer, maxlen)) == 0) {
+				waitFor(false);
+			}
+			return count;
+		}
+		fill();
+	}
+	const char *data = span(count);
+	count = qMin(count, maxlen);
+	memcpy(buffer, data, count);
+	m_readStart += count;
+	return count;
+}
+
+size_t StreamChannel::s_writev(const struct iovec *iov, int iovcnt, bool more) {
+	Q_UNUSED(more);
+	size_t count = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		size_t n = s_write((const char*)iov[i].iov_base, iov[i].iov_len);
+		count += n;
+		if (n < iov[i].iov_len) {
+			break;
+		}
+	}
+	return count;
+}
+
+void StreamChannel::s_shutdown() {
+}
+
+size_t StreamChannel::s_sendmsg(const struct iovec *iov, int iovcnt, const void *control, size_t controlLen) {
+	Q_UNUSED(iov);
+	Q_UNUSED(iovcnt);
+	Q_UNUSED(control);
+	Q_UNUSED(controlLen);
+	throw IllegalOperationException("Control messages not supported by this channel");
+}
+
+void StreamChannel::writeControl(const char *buffer, size_t len, const void *control, size_t controlLen) {
+	QMutexLocker _(&m_writeLock);
+	// The control messages must not overtake the queued data
+	for (;;) {
+		flushOutput();
+		if (m_outSize == 0) {
+			break;
+		}
+		waitFor(true);
+	}
+	struct iovec iov;
+	iov.iov_base = (void*)buffer;
+	iov.iov_len = len;
+	size_t written;
+	while (m_writeCalls++, (written = s_sendmsg(&iov, 1, control, controlLen)) == 0) {
+		waitFor(true);
 	}
-	count = qMin(available(true), maxlen);
-	return s_read(buffer, count);
+	enqueue(buffer + written, len - written);
+	flushOutput();
 }
 
 void StreamChannel::write(const char *buffer, size_t len) {
-	s_write(buffer, len);
+	QMutexLocker _(&m_writeLock);
+	enqueue(buffer, len);
+	if (m_corked == 0 || m_outSize >= NODEBUS_STREAMCHANNEL_CORK_SIZE) {
+		flushOutput();
+	}
 }
 
-size_t StreamChannel::available(bool noEmpty) {
-	int n = s_available() + (m_readEnd - m_readStart);
-	if (noEmpty && n == 0) {
-		if (m_deadline == -1) {
-			while (!s_waitForReadyRead(100)) {
-				if (!m_active) {
-					throw EOFException("Closed channel");
+void StreamChannel::write(const QByteArray &data) {
+	QMutexLocker _(&m_writeLock);
+	if (data.size() < NODEBUS_STREAMCHANNEL_CHUNK_SIZE) {
+		enqueue(data.constData(), data.size());
+	} else {
+		// Implicitly shared, no copy
+		m_outQueue.append(data);
+		m_outSize += data.size();
+		m_outTailOwned = false;
+		if (m_outSize >= m_highWaterMark) {
+			m_saturated = true;
+		}
+	}
+	if (m_corked == 0 || m_outSize >= NODEBUS_STREAMCHANNEL_CORK_SIZE) {
+		flushOutput();
+	}
+}
+
+void StreamChannel::enqueue(const char *buffer, size_t len) {
+	if (len == 0) {
+		return;
+	}
+	if (m_outTailOwned) {
+		// Coalesce small writes into the tail chunk
+		QByteArray &tail = m_outQueue.last();
+		if (size_t(tail.capacity() - tail.size()) >= len) {
+			tail.append(buffer, len);
+			m_outSize += len;
+			return;
+		}
+	}
+	QByteArray chunk;
+	chunk.reserve(qMax(len, size_t(NODEBUS_STREAMCHANNEL_CHUNK_SIZE)));
+	chunk.append(buffer, len);
+	m_outQueue.append(chunk);
+	m_outTailOwned = true;
+	m_outSize += len;
+	if (m_outSize >= m_highWaterMark) {
+		m_saturated = true;
+	}
+}
+
+bool StreamChannel::flushOutput(bool wait) {
+	struct iovec iov[NODEBUS_STREAMCHANNEL_IOV_MAX];
+	for (;;) {
+		try {
+			while (!m_outQueue.isEmpty()) {
+				int count = 0;
+				size_t total = 0, offset = m_outOffset;
+				for (auto it = m_outQueue.begin(); it != m_outQueue.end() && count < NODEBUS_STREAMCHANNEL_IOV_MAX; it++) {
+					iov[count].iov_base = (void*)(it->constData() + offset);
+					iov[count].iov_len = it->size() - offset;
+					total += iov[count].iov_len;
+					offset = 0;
+					count++;
 				}
-			}
-		} else {
-			while (!s_waitForReadyRead(100)) {
-				if (!m_active) {
-					throw EOFException("Closed channel");
+				m_writeCalls++;
+				size_t written = s_writev(iov, count, m_corked > 0);
+				m_outSize -= written;
+				size_t n = written + m_outOffset;
+				while (!m_outQueue.isEmpty() && n >= size_t(m_outQueue.first().size())) {
+					n -= m_outQueue.first().size();
+					m_outQueue.removeFirst();
 				}
-				if (m_deadline < QDateTime::currentMSecsSinceEpoch()) {
-					throw IOTimeoutException("Time exceeds");
+				m_outOffset = n;
+				if (written < total) {
+					// The output is full, an extra call would only return EAGAIN
+					break;
 				}
 			}
+			if (m_outQueue.isEmpty() && s_pending() > 0) {
+				m_writeCalls++;
+				s_writev(iov, 0, false);
+			}
+		} catch (Exception &e) {
+			m_outQueue.clear();
+			m_outOffset = m_outSize = 0;
+			m_outTailOwned = false;
+			m_saturated = false;
+			throw;
+		}
+		if (m_outQueue.isEmpty()) {
+			m_outOffset = 0;
+			m_outTailOwned = false;
 		}
-		n = s_available();
-		if (n == 0) {
-			throw EOFException("End of File");
+		if (m_saturated && m_outSize <= m_lowWaterMark) {
+			m_saturated = false;
+		}
+		if ((m_outSize == 0 && s_pending() == 0) || armKeys(SelectionKey::OP_WRITE)) {
+			return true;
+		}
+		if (!wait) {
+			return false;
+		}
+		// Not registered to any selector, wait for the data to be sent
+		waitFor(true);
+	}
+}
+
+void StreamChannel::flush() {
+	QMutexLocker locker(&m_writeLock);
+	flushOutput();
+	if (m_closing && m_outSize == 0 && s_pending() == 0) {
+		locker.unlock();
+		// Called from the reactor, the owner may still be reading
+		closeNow(true);
+	}
+}
+
+void StreamChannel::cork() {
+	QMutexLocker _(&m_writeLock);
+	m_corked++;
+}
+
+void StreamChannel::uncork() {
+	QMutexLocker _(&m_writeLock);
+	if (m_corked > 0 && --m_corked == 0) {
+		flushOutput();
+	}
+}
+
+qint64 StreamChannel::readData(char *data, qint64 maxlen) {
+	return read(data, maxlen);
+}
+
+qint64 StreamChannel::writeData(const char *data, qint64 len) {
+	write(data, len);
+	return len;
+}
+
+size_t StreamChannel::available(bool noEmpty) {
+	if (m_readEnd == m_readStart) {
+		fill(noEmpty);
+	}
+	return m_readEnd - m_readStart;
+}
+
+bool StreamChannel::contains(char c) {
+	size_t size = m_readMask + 1;
+	size_t scanned = 0;
+	for (;;) {
+		while (m_readEnd - m_readStart > scanned) {
+			size_t offset = (m_readStart + scanned) & m_readMask;
+			size_t len = qMin(m_readEnd - m_readStart - scanned, size - offset);
+			if (memchr(m_readBuff + offset, c, len) != nullptr) {
+				return true;
+			}
+			scanned += len;
+		}
+		if (scanned == size || fill(false) == 0) {
+			return false;
 		}
 	}
-	return n;
 }
 
 void StreamChannel::close() {
-	Channel::close();
+	QMutexLocker locker(&m_writeLock);
+	if (m_closing && (m_outSize > 0 || s_pending() > 0)) {
+		return;
+	}
+	m_corked = 0;
+	if (m_active && (m_outSize > 0 || s_pending() > 0)) {
+		bool queued = false;
+		try {
+			queued = flushOutput(false);
+		} catch (Exception &e) {
+		}
+		if (queued && (m_outSize > 0 || s_pending() > 0)) {
+			// Closed by flush() once the selector reports the channel writable
+			m_closing = true;
+			return;
+		}
+	}
+	locker.unlock();
+	closeNow();
+}
+
+void StreamChannel::closeNow(bool deferFd) {
+	{
+		QMutexLocker _(&m_writeLock);
+		m_outQueue.clear();
+		m_outOffset = m_outSize = 0;
+		m_outTailOwned = false;
+		m_saturated = false;
+	}
+	if (m_active) {
+		try {
+			s_shutdown();
+		} catch (Exception &e) {
+		}
+	}
+	if (deferFd) {
+		shutdownChannel();
+	} else {
+		closeChannel();
+	}
+	QIODevice::close();
 }
 
 
@@ -21,6 +21,23 @@
 
 #include <nodebus/core/exception.h>
 #include <nodebus/nio/channel.h>
+#include <nodebus/nio/timerwheel.h>
+#include <sys/uio.h>
+#include <QByteArray>
+#include <QMutex>
+
+/// @brief Default read buffer size
+#define NODEBUS_STREAMCHANNEL_BUFFER_SIZE 16384
+/// @brief Output chunk size, smaller writes are coalesced into a chunk
+#define NODEBUS_STREAMCHANNEL_CHUNK_SIZE 4096
+/// @brief Maximum number of output slices per writev call
+#define NODEBUS_STREAMCHANNEL_IOV_MAX 64
+/// @brief Output size from which a corked channel is flushed anyway
+#define NODEBUS_STREAMCHANNEL_CORK_SIZE 65536
+/// @brief Default output queue high water mark
+#define NODEBUS_STREAMCHANNEL_HIGH_WATER_MARK 1048576
+/// @brief Default output queue low water mark
+#define NODEBUS_STREAMCHANNEL_LOW_WATER_MARK 262144
 
 /**
  * @namespace
@@ -48,6 +65,11 @@ public:
 	
 	/**
 	 * @brief Close the channel
+	 * 
+	 * If output data is still queued, the channel is closed once it has
+	 * been flushed by the selector. Not registered to any selector, the
+	 * data which cannot be written without blocking is dropped.
+	 * 
 	 * @throw IOException on error
 	 */
 	virtual void close();
@@ -73,18 +95,128 @@ public:
 	void ignore(size_t len = 1);
 	
 	/**
-	 * @brief Flush output data
+	 * @brief Read data
+	 * @param buffer destination buffer
+	 * @param maxlen maximum number of bytes to read
+	 * @return number of bytes read
+	 * @throw IOException on error
+	 */
+	size_t read(char *buffer, size_t maxlen);
+	
+	/**
+	 * @brief Write data
+	 * 
+	 * The data is queued and sent without blocking, the remaining part
+	 * is flushed when the selector reports the channel writable. A channel
+	 * which is not registered to any selector waits for the data to be sent.
+	 * 
+	 * @param buffer source buffer
+	 * @param len number of bytes to write
+	 * @throw IOException on error
+	 */
+	void write(const char *buffer, size_t len);
+	
+	/**
+	 * @brief Write data, a large array is queued without copy
+	 * @param data source data
+	 * @throw IOException on error
+	 */
+	void write(const QByteArray &data);
+	
+	/**
+	 * @brief Get the buffered data as a contiguous span, fill the buffer if empty
+	 * 
+	 * The span is valid until the next read operation. Use consume() to
+	 * extract the bytes processed.
+	 * 
+	 * @param len span length
+	 * @return span address
+	 * @throw IOException on error
+	 */
+	const char *span(size_t &len);
+	
+	/**
+	 * @brief Extract bytes from the buffered data
+	 * @param len number of bytes, at most the current span length
+	 */
+	void consume(size_t len);
+	
+	/**
+	 * @brief Flush output data without blocking
+	 * 
+	 * The selection keys are armed for OP_WRITE if data remains queued.
+	 * 
 	 * @throw IOException on error
 	 */
 	void flush();
 	
+	/**
+	 * @brief Hold the output data until uncork() to coalesce several writes
+	 * 
+	 * Calls can be nested.
+	 */
+	void cork();
+	
+	/**
+	 * @brief Release the output data held since cork()
+	 * @throw IOException on error
+	 */
+	void uncork();
+	
+	/**
+	 * @brief Get the number of bytes queued for output
+	 * @return byte count
+	 */
+	size_t pending();
+	
+	/**
+	 * @brief Return if the output queue is saturated
+	 * 
+	 * The queue is saturated once it exceeds the high water mark, until it
+	 * is drained below the low water mark. Producers should stop writing in
+	 * the meantime.
+	 * 
+	 * @return true if saturated, otherwise false
+	 */
+	bool isSaturated();
+	
+	/**
+	 * @brief Set the output queue water marks
+	 * @param low low water mark in bytes
+	 * @param high high water mark in bytes
+	 */
+	void setWaterMarks(size_t low, size_t high);
+	
 	/**
 	 * @brief Get available data for read
+	 * 
+	 * Buffered data is returned without any system call, otherwise the
+	 * buffer is refilled with the data already received.
+	 * 
+	 * @param noEmpty wait for data if none is available
 	 * @return number of byte ready to read
 	 * @throw IOException on error
 	 */
 	size_t available(bool noEmpty=false);
 	
+	/**
+	 * @brief Look for a byte in the buffered data
+	 * 
+	 * The data already received is appended to the buffer without blocking,
+	 * unless the buffer is full.
+	 * 
+	 * @param c byte to look for
+	 * @return true if found, otherwise false
+	 * @throw IOException on error
+	 */
+	bool contains(char c);
+	
+	/**
+	 * @brief Get the read buffer size
+	 * @return size in bytes
+	 */
+	size_t bufferSize();
+	
 	/**
 	 * @brief Set deadline.
 	 * 
@@ -96,34 +228,227 @@ public:
 	 */
 	void setDeadLine(qint64 msecs);
 	
+	/**
+	 * @brief Set the deadline relatively to now
+	 * 
+	 * The deadline is kept on the coarse monotonic clock.
+	 * 
+	 * @param msecs time in milliseconds or -1 to cancel it
+	 */
+	void setTimeout(int msecs);
+	
+	/**
+	 * @brief Get the number of low level read calls (wait, available, read)
+	 * @return call count
+	 */
+	quint64 readCalls();
+	
+	/**
+	 * @brief Get the number of low level write calls
+	 * @return call count
+	 */
+	quint64 writeCalls();
+	
+	/**
+	 * @brief Set the read buffer size of the channels created afterwards
+	 * @param size buffer size, rounded up to a power of 2
+	 */
+	static void setDefaultBufferSize(size_t size);
+	
+	/**
+	 * @brief Set the output queue water marks of the channels created afterwards
+	 * @param low low water mark in bytes
+	 * @param high high water mark in bytes
+	 */
+	static void setDefaultWaterMarks(size_t low, size_t high);
+	
 protected:
+	/**
+	 * @brief Get the number of bytes which can be read without blocking
+	 */
 	virtual size_t s_available() = 0;
+	
+	/**
+	 * @brief Non-blocking read
+	 * @return number of bytes read, 0 if no data is available
+	 * @throw EOFException at the end of the stream
+	 */
 	virtual size_t s_read(char *buffer, size_t maxlen) = 0;
-	virtual void s_write(const char *buffer, size_t len) = 0;
+	
+	/**
+	 * @brief Non-blocking scatter read
+	 * @return number of bytes read, 0 if no data is available
+	 * @throw EOFException at the end of the stream
+	 */
+	virtual size_t s_readv(const struct iovec *iov, int iovcnt);
+	
+	/**
+	 * @brief Non-blocking write
+	 * @return number of bytes written, 0 if the output is full
+	 */
+	virtual size_t s_write(const char *buffer, size_t len) = 0;
+	
+	/**
+	 * @brief Non-blocking gather write
+	 * @param more more data will follow shortly
+	 * @return number of bytes written, 0 if the output is full
+	 */
+	virtual size_t s_writev(const struct iovec *iov, int iovcnt, bool more);
+	
+	/**
+	 * @brief Non-blocking gather write with control messages
+	 * @param control control messages (struct cmsghdr sequence)
+	 * @param controlLen control messages length
+	 * @return number of bytes written, 0 if the output is full
+	 * @throw IllegalOperationException if the channel does not support it
+	 */
+	virtual size_t s_sendmsg(const struct iovec *iov, int iovcnt, const void *control, size_t controlLen);
+	
+	/**
+	 * @brief Write data along with control messages (ex: file descriptors)
+	 * 
+	 * The queued output is sent first, waiting for the channel to be
+	 * writable if needed: the control messages are delivered with the first
+	 * byte of the data. The remaining part of the data is queued.
+	 * 
+	 * @param buffer source buffer, at least one byte
+	 * @param len number of bytes to write
+	 * @param control control messages (struct cmsghdr sequence)
+	 * @param controlLen control messages length
+	 * @throw IOException on error
+	 */
+	void writeControl(const char *buffer, size_t len, const void *control, size_t controlLen);
+	
+	/**
+	 * @brief Get the number of output bytes buffered below the channel
+	 * 
+	 * Such bytes (ex: encrypted records) are sent by s_writev() calls,
+	 * made with an empty slice list once the output queue is drained.
+	 */
+	virtual size_t s_pending();
+	
+	/**
+	 * @brief Called once the output is drained, before closing the channel
+	 */
+	virtual void s_shutdown();
+	
+	/**
+	 * @brief Close the channel at once, dropping the queued output
+	 * 
+	 * Never blocks: used on teardown, when the data cannot be flushed.
+	 * 
+	 * @param deferFd shut the file descriptor down, closed once released
+	 */
+	void closeNow(bool deferFd = false);
+	
 	virtual bool s_waitForReadyRead(int timeout) = 0;
+	virtual bool s_waitForReadyWrite(int timeout) = 0;
+	virtual qint64 readData(char *data, qint64 maxlen);
+	virtual qint64 writeData(const char *data, qint64 len);
 	
 private:
-	void checkBuf();
+	size_t fill(bool wait = true);
+	void waitFor(bool write);
+	void enqueue(const char *buffer, size_t len);
+	bool flushOutput(bool wait = true);
 	
-	char m_readBuff[64];
+	/// @brief Ring buffer, positions are free running counters
+	char *m_readBuff;
+	size_t m_readMask;
 	size_t m_readStart;
 	size_t m_readEnd;
+	/// @brief Deadline on the TimerWheel clock
 	qint64 m_deadline;
+	quint64 m_readCalls;
+	/// @brief Output queue, the head slice is written from m_outOffset
+	QMutex m_writeLock;
+	QList<QByteArray> m_outQueue;
+	size_t m_outOffset;
+	size_t m_outSize;
+	/// @brief The tail slice is a chunk owned by the queue
+	bool m_outTailOwned;
+	int m_corked;
+	bool m_saturated;
+	bool m_closing;
+	size_t m_lowWaterMark;
+	size_t m_highWaterMark;
+	quint64 m_writeCalls;
+	static size_t s_defaultBufferSize;
+	static size_t s_defaultLowWaterMark;
+	static size_t s_defaultHighWaterMark;
 };
 
-inline StreamChannel::StreamChannel(): m_readStart(0), m_readEnd(0), m_deadline(-1) {
+inline StreamChannel::~StreamChannel() {
+	delete[] m_readBuff;
 }
 
-inline StreamChannel::~StreamChannel() {
+inline void StreamChannel::setTimeout(int msecs) {
+	m_deadline = msecs < 0 ? -1 : TimerWheel::now() + msecs;
+}
+
+inline size_t StreamChannel::s_pending() {
+	return 0;
+}
+
+inline quint64 StreamChannel::readCalls() {
+	return m_readCalls;
+}
+
+inline quint64 StreamChannel::writeCalls() {
+	return m_writeCalls;
+}
+
+inline size_t StreamChannel::pending() {
+	QMutexLocker _(&m_writeLock);
+	return m_outSize;
+}
+
+inline size_t StreamChannel::bufferSize() {
+	return m_readMask + 1;
+}
+
+inline bool StreamChannel::isSaturated() {
+	QMutexLocker _(&m_writeLock);
+	return m_saturated;
+}
+
+inline char StreamChannel::get() {
+	if (m_readEnd == m_readStart) {
+		fill();
+	}
+	return m_readBuff[m_readStart++ & m_readMask];
+}
+
+inline char StreamChannel::peek() {
+	if (m_readEnd == m_readStart) {
+		fill();
+	}
+	return m_readBuff[m_readStart & m_readMask];
 }
 
-inline void StreamChannel::setDeadLine(qint64 msecs) {
-	m_deadline = msecs;
+inline void StreamChannel::ignore(size_t len) {
+	while (len > 0) {
+		if (m_readEnd == m_readStart) {
+			fill();
+		}
+		size_t count = qMin(len, m_readEnd - m_readStart);
+		m_readStart += count;
+		len -= count;
+	}
 }
 
-inline void StreamChannel::flush() {
+inline const char *StreamChannel::span(size_t &len) {
+	if (m_readEnd == m_readStart) {
+		fill();
+	}
+	size_t offset = m_readStart & m_readMask;
+	len = qMin(m_readEnd - m_readStart, m_readMask + 1 - offset);
+	return m_readBuff + offset;
 }
 
+inline void StreamChannel::consume(size_t len) {
+	m_readStart += len;
+}
 
 typedef SharedPtr<StreamChannel> StreamChannelPtr;
 
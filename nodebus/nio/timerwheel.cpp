@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "timerwheel.h"
+#include "selector.h"
+#include <nodebus/core/logger.h>
+#include <typeinfo>
+#include <time.h>
+#include <string.h>
+
+#define NODEBUS_TIMERWHEEL_INDEX(tick, level) \
+	(((tick) >> ((level) * NODEBUS_TIMERWHEEL_BITS)) & NODEBUS_TIMERWHEEL_MASK)
+
+namespace NodeBus {
+
+void Timer::start(TimerWheel &wheel, int msecs) {
+	cancel();
+	QMutexLocker _(&(wheel.m_synchronize));
+	quint64 now = TimerWheel::now() / NODEBUS_TIMERWHEEL_TICK;
+	if (wheel.m_count == 0 || now < wheel.m_current) {
+		// Nothing to catch up with
+		wheel.m_current = qMax(wheel.m_current, now);
+	}
+	m_wheel = &wheel;
+	m_expires = qMax(now, wheel.m_current) + (qMax(msecs, 0) + NODEBUS_TIMERWHEEL_TICK - 1) / NODEBUS_TIMERWHEEL_TICK;
+	wheel.add(this);
+	wheel.m_count++;
+	if (m_expires < wheel.m_wakeTick && wheel.m_selector != nullptr) {
+		wheel.m_wakeTick = m_expires;
+		wheel.m_selector->wakeup();
+	}
+}
+
+void Timer::cancel() {
+	TimerWheel *wheel = m_wheel;
+	if (wheel == nullptr) {
+		return;
+	}
+	QMutexLocker _(&(wheel->m_synchronize));
+	if (m_pprev != nullptr) {
+		wheel->unlink(this);
+		wheel->m_count--;
+	}
+}
+
+void Timer::release() {
+	TimerWheel *wheel = m_wheel;
+	if (wheel == nullptr) {
+		return;
+	}
+	QMutexLocker locker(&(wheel->m_synchronize));
+	if (m_pprev != nullptr) {
+		wheel->unlink(this);
+		wheel->m_count--;
+	}
+	while (wheel->m_running == this && wheel->m_runningThread != QThread::currentThreadId()) {
+		locker.unlock();
+		QThread::yieldCurrentThread();
+		locker.relock();
+	}
+	m_wheel = nullptr;
+}
+
+TimerWheel::TimerWheel(Selector *selector): m_current(now() / NODEBUS_TIMERWHEEL_TICK), m_wakeTick(~quint64(0)),
+m_count(0), m_running(nullptr), m_runningThread(nullptr), m_selector(selector) {
+	bzero(m_slots, sizeof(m_slots));
+}
+
+TimerWheel::~TimerWheel() {
+	QMutexLocker _(&m_synchronize);
+	for (int level = 0; level < NODEBUS_TIMERWHEEL_LEVELS; level++) {
+		for (int index = 0; index < NODEBUS_TIMERWHEEL_SIZE; index++) {
+			while (m_slots[level][index] != nullptr) {
+				Timer *timer = m_slots[level][index];
+				unlink(timer);
+				timer->m_wheel = nullptr;
+			}
+		}
+	}
+}
+
+qint64 TimerWheel::now() {
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return qint64(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::add(Timer *timer) {
+	quint64 expires = timer->m_expires;
+	quint64 delta = expires - m_current;
+	Timer **slot;
+	if (expires < m_current) {
+		// Already expired: next tick
+		slot = &m_slots[0][m_current & NODEBUS_TIMERWHEEL_MASK];
+	} else {
+		int level = 0;
+		while (level < NODEBUS_TIMERWHEEL_LEVELS - 1 && delta >= (quint64(1) << ((level + 1) * NODEBUS_TIMERWHEEL_BITS))) {
+			level++;
+		}
+		if (delta >= (quint64(1) << (NODEBUS_TIMERWHEEL_LEVELS * NODEBUS_TIMERWHEEL_BITS))) {
+			// Out of range: clamped to the wheel range
+			expires = m_current + (quint64(1) << (NODEBUS_TIMERWHEEL_LEVELS * NODEBUS_TIMERWHEEL_BITS)) - 1;
+			timer->m_expires = expires;
+		}
+		slot = &m_slots[level][NODEBUS_TIMERWHEEL_INDEX(expires, level)];
+	}
+	timer->m_next = *slot;
+	if (*slot != nullptr) {
+		(*slot)->m_pprev = &timer->m_next;
+	}
+	timer->m_pprev = slot;
+	*slot = timer;
+}
+
+void TimerWheel::unlink(Timer *timer) {
+	*timer->m_pprev = timer->m_next;
+	if (timer->m_next != nullptr) {
+		timer->m_next->m_pprev = timer->m_pprev;
+	}
+	timer->m_next = nullptr;
+	timer->m_pprev = nullptr;
+}
+
+int TimerWheel::cascade(int level, int index) {
+	Timer *list = m_slots[level][index];
+	m_slots[level][index] = nullptr;
+	while (list != nullptr) {
+		Timer *timer = list;
+		list = timer->m_next;
+		timer->m_next = nullptr;
+		add(timer);
+	}
+	return index;
+}
+
+int TimerWheel::timeout() {
+	QMutexLocker _(&m_synchronize);
+	if (m_count == 0) {
+		m_wakeTick = ~quint64(0);
+		return -1;
+	}
+	// Bounded scan: up to the next cascade
+	quint64 tick = m_current;
+	do {
+		if (m_slots[0][tick & NODEBUS_TIMERWHEEL_MASK] != nullptr) {
+			break;
+		}
+		tick++;
+	} while (tick & NODEBUS_TIMERWHEEL_MASK);
+	m_wakeTick = tick;
+	qint64 delay = qint64(tick) * NODEBUS_TIMERWHEEL_TICK - now();
+	return delay > 0 ? int(delay) : 0;
+}
+
+void TimerWheel::run(qint64 now) {
+	quint64 target = now / NODEBUS_TIMERWHEEL_TICK;
+	QMutexLocker locker(&m_synchronize);
+	if (m_count == 0) {
+		m_current = qMax(m_current, target + 1);
+		return;
+	}
+	while (m_current <= target) {
+		int index = m_current & NODEBUS_TIMERWHEEL_MASK;
+		if (index == 0) {
+			for (int level = 1; level < NODEBUS_TIMERWHEEL_LEVELS; level++) {
+				if (cascade(level, NODEBUS_TIMERWHEEL_INDEX(m_current, level)) != 0) {
+					break;
+				}
+			}
+		}
+		m_current++;
+		// Callbacks are called without the lock, they may re-arm or cancel timers
+		while (m_slots[0][index] != nullptr) {
+			Timer *timer = m_slots[0][index];
+			unlink(timer);
+			m_count--;
+			m_running = timer;
+			m_runningThread = QThread::currentThreadId();
+			locker.unlock();
+			try {
+				timer->timeout();
+			} catch (Exception &e) {
+				logWarn() << "TimerWheel: timer callback throwing an instance of '" << __demangle(typeid(e).name()) << "'";
+				if (!e.message().isEmpty())
+					logWarn() << "  what(): " << e.message();
+			}
+			locker.relock();
+			m_running = nullptr;
+			m_runningThread = nullptr;
+		}
+		if (m_count == 0) {
+			m_current = qMax(m_current, target + 1);
+			break;
+		}
+	}
+}
+
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NODEBUS_TIMERWHEEL_H
+#define NODEBUS_TIMERWHEEL_H
+
+#include <nodebus/core/exception.h>
+#include <QMutex>
+#include <QThread>
+
+/// @brief Timer resolution in milliseconds
+#define NODEBUS_TIMERWHEEL_TICK 16
+/// @brief Number of bits of a wheel level index
+#define NODEBUS_TIMERWHEEL_BITS 6
+#define NODEBUS_TIMERWHEEL_SIZE (1 << NODEBUS_TIMERWHEEL_BITS)
+#define NODEBUS_TIMERWHEEL_MASK (NODEBUS_TIMERWHEEL_SIZE - 1)
+/// @brief Number of levels, the range is 2^(BITS*LEVELS) ticks (about 74 hours)
+#define NODEBUS_TIMERWHEEL_LEVELS 4
+
+/**
+ * @namespace
+ */
+namespace NodeBus {
+
+class TimerWheel;
+class Selector;
+
+/**
+ * @brief Timer handled by a TimerWheel
+ * 
+ * The timeout() callback is called from the thread running the selector
+ * which owns the wheel. A timer is typically a member of the object it
+ * acts on and refers to it through a weak pointer. The wheel must
+ * outlive the timers started on it.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+class Timer {
+	friend class TimerWheel;
+public:
+	/**
+	 * @brief Timer constructor
+	 */
+	Timer();
+	
+	/**
+	 * @brief Timer destructor, releases the timer
+	 */
+	virtual ~Timer();
+	
+	/**
+	 * @brief Arm the timer, re-arm it if already armed
+	 * @param wheel timer wheel
+	 * @param msecs delay in milliseconds
+	 */
+	void start(TimerWheel &wheel, int msecs);
+	
+	/**
+	 * @brief Disarm the timer
+	 * 
+	 * Does not wait for a callback running in an other thread: it may be
+	 * called with locks the callback takes.
+	 */
+	void cancel();
+	
+	/**
+	 * @brief Disarm the timer and wait for the end of a callback running
+	 * in an other thread
+	 * 
+	 * A derived timer must call it in its own destructor, before its
+	 * members are destroyed.
+	 */
+	void release();
+	
+	/**
+	 * @brief Return if the timer is armed
+	 * @return true if armed, otherwise false
+	 */
+	bool isActive();
+	
+protected:
+	/**
+	 * @brief Timer callback
+	 */
+	virtual void timeout() = 0;
+	
+private:
+	TimerWheel *m_wheel;
+	Timer *m_next;
+	Timer **m_pprev;
+	quint64 m_expires;
+};
+
+/**
+ * @brief Hierarchical timing wheel
+ * 
+ * Arming and cancelling a timer are O(1), expired timers are found
+ * without scanning: far timers are cascaded to the lower levels when
+ * the time comes closer.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+class TimerWheel {
+	friend class Timer;
+public:
+	/**
+	 * @brief TimerWheel constructor
+	 * @param selector selector to wake up when a timer is armed earlier
+	 * than the current wait ends
+	 */
+	TimerWheel(Selector *selector = nullptr);
+	
+	/**
+	 * @brief TimerWheel destructor
+	 */
+	~TimerWheel();
+	
+	/**
+	 * @brief Get the coarse monotonic time
+	 * @return time in milliseconds
+	 */
+	static qint64 now();
+	
+	/**
+	 * @brief Get the time until the next expiration
+	 * @return delay in milliseconds, -1 if no timer is armed
+	 */
+	int timeout();
+	
+	/**
+	 * @brief Run the expired timer callbacks
+	 * @param now current time, sampled once per selector loop
+	 */
+	void run(qint64 now);
+	
+	/**
+	 * @brief Get the number of armed timers
+	 * @return timer count
+	 */
+	int count();
+	
+	/**
+	 * @brief Get the selector woken up by the wheel
+	 * @return the selector, nullptr if none
+	 */
+	Selector *selector();
+	
+private:
+	void add(Timer *timer);
+	void unlink(Timer *timer);
+	int cascade(int level, int index);
+	
+	QMutex m_synchronize;
+	Timer *m_slots[NODEBUS_TIMERWHEEL_LEVELS][NODEBUS_TIMERWHEEL_SIZE];
+	/// @brief Next tick to process
+	quint64 m_current;
+	/// @brief Tick the waiting thread will wake up at
+	quint64 m_wakeTick;
+	int m_count;
+	/// @brief Timer whose callback is running
+	Timer *m_running;
+	Qt::HANDLE m_runningThread;
+	Selector *m_selector;
+};
+
+inline Timer::Timer(): m_wheel(nullptr), m_next(nullptr), m_pprev(nullptr), m_expires(0) {
+}
+
+inline Timer::~Timer() {
+	release();
+}
+
+inline bool Timer::isActive() {
+	return m_pprev != nullptr;
+}
+
+inline int TimerWheel::count() {
+	return m_count;
+}
+
+inline Selector *TimerWheel::selector() {
+	return m_selector;
+}
+
+}
+
+#endif // NODEBUS_TIMERWHEEL_H
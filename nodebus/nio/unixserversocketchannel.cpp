@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "unixserversocketchannel.h"
+#include <nodebus/core/logger.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <errno.h>
+
+#define THROW_IOEXP_ON_ERR(exp) \
+	if ((exp) == -1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + QString::fromLocal8Bit(strerror(errno)))
+
+namespace NodeBus {
+
+static int __bind(const QString &path, int type, uint opts) {
+	struct sockaddr_un addr;
+	bzero(&addr, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	QByteArray name = path.toLocal8Bit();
+	if (name.isEmpty() || name.size() >= int(sizeof(addr.sun_path))) {
+		throw IOException("Invalid socket path: " + path);
+	}
+	memcpy(addr.sun_path, name.constData(), name.size());
+	socklen_t len = offsetof(struct sockaddr_un, sun_path) + name.size();
+	bool abstract = (addr.sun_path[0] == '@');
+	if (abstract) {
+		addr.sun_path[0] = '\0';
+	} else {
+		len++;
+	}
+	int fd;
+	THROW_IOEXP_ON_ERR(fd = ::socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+	int ret = ::bind(fd, (struct sockaddr *)&addr, len);
+	if (ret == -1 && errno == EADDRINUSE && !abstract) {
+		// Replace the socket file only if nobody listens to it anymore
+		int probe = ::socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+		if (probe != -1 && ::connect(probe, (struct sockaddr *)&addr, len) == -1 && errno == ECONNREFUSED) {
+			logWarn() << "UnixServerSocketChannel: removing the stale socket " << path;
+			::unlink(name.constData());
+			ret = ::bind(fd, (struct sockaddr *)&addr, len);
+		} else {
+			errno = EADDRINUSE;
+		}
+		if (probe != -1) {
+			::close(probe);
+		}
+	}
+	if (ret == -1 || ::listen(fd, opts & ServerSocketChannel::MASK_BACKLOG) == -1) {
+		int error = errno;
+		::close(fd);
+		errno = error;
+		THROW_IOEXP_ON_ERR(-1);
+	}
+	return fd;
+}
+
+UnixServerSocketChannel::UnixServerSocketChannel(const QString& path, UnixSocketChannel::Type type, uint opts)
+: ServerSocketChannel(__bind(path, type, opts), path, opts), m_type(type), m_owner(!path.startsWith('@')) {
+}
+
+UnixServerSocketChannel::UnixServerSocketChannel(int fd, const QString& path, UnixSocketChannel::Type type, uint opts)
+: ServerSocketChannel(fd, path, opts), m_type(type), m_owner(false) {
+}
+
+UnixServerSocketChannel::~UnixServerSocketChannel() {
+	if (m_active) {
+		close();
+	}
+}
+
+void UnixServerSocketChannel::closeFd() {
+	ServerSocketChannel::closeFd();
+	if (m_owner) {
+		::unlink(m_name.toLocal8Bit().constData());
+	}
+}
+
+SocketChannelPtr UnixServerSocketChannel::accept() {
+	int cldf;
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+	if (!s_accept(cldf, addr, addrLen)) {
+		return nullptr;
+	}
+	return new UnixSocketChannel(cldf, m_type);
+}
+
+ServerSocketChannelPtr UnixServerSocketChannel::duplicate() {
+	int fd;
+	THROW_IOEXP_ON_ERR(fd = ::fcntl(m_fd, F_DUPFD_CLOEXEC, 0));
+	return new UnixServerSocketChannel(fd, m_name, m_type, m_opts);
+}
+
+}
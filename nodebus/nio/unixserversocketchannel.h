@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NODEBUS_UNIXSERVERSOCKETCHANNEL_H
+#define NODEBUS_UNIXSERVERSOCKETCHANNEL_H
+
+#include <nodebus/core/exception.h>
+#include <nodebus/nio/serversocketchannel.h>
+#include <nodebus/nio/unixsocketchannel.h>
+
+/**
+ * @namespace
+ */
+namespace NodeBus {
+
+/**
+ * @brief Local (AF_UNIX) server socket
+ * 
+ * A stale socket file left by a previous instance is replaced. The
+ * socket file is removed when the channel is closed.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+class UnixServerSocketChannel: public ServerSocketChannel {
+public:
+	/**
+	 * @brief Server socket constructor
+	 * @param path socket path, abstract if starting with '@'
+	 * @param type socket type
+	 * @param opts options (only the backlog applies)
+	 * @throw IOException on error
+	 */
+	UnixServerSocketChannel(const QString &path, UnixSocketChannel::Type type = UnixSocketChannel::STREAM,
+		uint opts=OPT_BACKLOG(5));
+	
+	/**
+	 * @brief Server socket destructor
+	 */
+	virtual ~UnixServerSocketChannel();
+	
+	virtual SharedPtr<SocketChannel> accept();
+	
+	/**
+	 * @brief Share the listening socket with an other selector
+	 * 
+	 * There is no SO_REUSEPORT balancing for local sockets: the copies
+	 * use the same socket, the first one to accept takes the connection.
+	 * 
+	 * @return a pointer to the new server socket
+	 */
+	virtual SharedPtr<ServerSocketChannel> duplicate();
+	
+protected:
+	virtual void closeFd();
+	
+private:
+	UnixServerSocketChannel(int fd, const QString &path, UnixSocketChannel::Type type, uint opts);
+	
+	UnixSocketChannel::Type m_type;
+	/// @brief Remove the socket file on close
+	bool m_owner;
+};
+
+typedef SharedPtr<UnixServerSocketChannel> UnixServerSocketChannelPtr;
+
+}
+
+#endif // NODEBUS_UNIXSERVERSOCKETCHANNEL_H
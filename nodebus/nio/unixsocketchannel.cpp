@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "unixsocketchannel.h"
+#include <nodebus/core/logger.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <errno.h>
+
+#ifndef MFD_CLOEXEC
+#	define MFD_CLOEXEC 0x0001U
+#	define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#	define F_ADD_SEALS 1033
+#	define F_GET_SEALS 1034
+#	define F_SEAL_SEAL 0x0001
+#	define F_SEAL_SHRINK 0x0002
+#	define F_SEAL_GROW 0x0004
+#	define F_SEAL_WRITE 0x0008
+#endif
+
+#define THROW_IOEXP_ON_ERR(exp) \
+	if ((exp) == -1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + QString::fromLocal8Bit(strerror(errno)))
+
+namespace NodeBus {
+
+static int __connect(const QString &path, int type) {
+	struct sockaddr_un addr;
+	bzero(&addr, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	QByteArray name = path.toLocal8Bit();
+	if (name.size() >= int(sizeof(addr.sun_path))) {
+		throw IOException("Socket path too long: " + path);
+	}
+	memcpy(addr.sun_path, name.constData(), name.size());
+	socklen_t len = offsetof(struct sockaddr_un, sun_path) + name.size();
+	if (addr.sun_path[0] == '@') {
+		// Abstract namespace
+		addr.sun_path[0] = '\0';
+	} else {
+		len++;
+	}
+	int fd;
+	THROW_IOEXP_ON_ERR(fd = ::socket(AF_UNIX, type | SOCK_CLOEXEC, 0));
+	if (::connect(fd, (struct sockaddr *)&addr, len) == -1) {
+		int error = errno;
+		::close(fd);
+		errno = error;
+		THROW_IOEXP_ON_ERR(-1);
+	}
+	int fl = ::fcntl(fd, F_GETFL);
+	if (fl == -1 || ::fcntl(fd, F_SETFL, fl | O_NONBLOCK) == -1) {
+		int error = errno;
+		::close(fd);
+		errno = error;
+		THROW_IOEXP_ON_ERR(-1);
+	}
+	return fd;
+}
+
+UnixSocketChannel::UnixSocketChannel(const QString &path, Type type)
+: SocketChannel(__connect(path, type), nullptr, 0), m_type(type), m_acceptFds(false), m_overflowOffset(0), m_overflowEnd(0) {
+	m_name = path;
+}
+
+UnixSocketChannel::UnixSocketChannel(int fd, Type type)
+: SocketChannel(fd, nullptr, 0), m_type(type), m_acceptFds(false), m_overflowOffset(0), m_overflowEnd(0) {
+}
+
+UnixSocketChannel::~UnixSocketChannel() {
+	for (auto it = m_fds.begin(); it != m_fds.end(); it++) {
+		::close(*it);
+	}
+}
+
+void UnixSocketChannel::sendFds(const QByteArray &data, const QList<int> &fds) {
+	if (data.isEmpty()) {
+		throw IllegalOperationException("File descriptors must be sent with data");
+	}
+	if (fds.size() > NODEBUS_UNIXSOCKETCHANNEL_MAX_FDS) {
+		throw IllegalOperationException("Too many file descriptors");
+	}
+	union {
+		char buffer[CMSG_SPACE(sizeof(int) * NODEBUS_UNIXSOCKETCHANNEL_MAX_FDS)];
+		struct cmsghdr align;
+	} control;
+	bzero(&control, sizeof(control));
+	struct cmsghdr *cmsg = (struct cmsghdr *)control.buffer;
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+	int *fdv = (int *)CMSG_DATA(cmsg);
+	for (int i = 0; i < fds.size(); i++) {
+		fdv[i] = fds[i];
+	}
+	writeControl(data.constData(), data.size(), control.buffer, CMSG_SPACE(sizeof(int) * fds.size()));
+}
+
+void UnixSocketChannel::sendBuffer(const QByteArray &data, const char *buffer, size_t len) {
+	int fd = createBuffer(buffer, len);
+	try {
+		sendFds(data, QList<int>() << fd);
+	} catch (Exception &e) {
+		::close(fd);
+		throw;
+	}
+	// The peer holds its own reference
+	::close(fd);
+}
+
+QList<int> UnixSocketChannel::takeFds() {
+	QList<int> fds = m_fds;
+	m_fds.clear();
+	return fds;
+}
+
+int UnixSocketChannel::createBuffer(const char *buffer, size_t len) {
+	int fd;
+	THROW_IOEXP_ON_ERR(fd = ::syscall(SYS_memfd_create, "nodebus", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+	try {
+		THROW_IOEXP_ON_ERR(::ftruncate(fd, len));
+		size_t offset = 0;
+		while (offset < len) {
+			ssize_t n = ::pwrite(fd, buffer + offset, len - offset, offset);
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			THROW_IOEXP_ON_ERR(n);
+			offset += n;
+		}
+		// The receiver can map it without fearing any later change
+		THROW_IOEXP_ON_ERR(::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL));
+	} catch (Exception &e) {
+		::close(fd);
+		throw;
+	}
+	return fd;
+}
+
+size_t UnixSocketChannel::s_read(char *buffer, size_t maxlen) {
+	// Through recvmsg, not to lose any file descriptor
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = maxlen;
+	return s_readv(&iov, 1);
+}
+
+size_t UnixSocketChannel::s_readv(const struct iovec *iov, int iovcnt) {
+	if (m_overflowOffset < m_overflowEnd) {
+		// Remaining part of the last seqpacket message
+		size_t count = 0;
+		for (int i = 0; i < iovcnt && m_overflowOffset < m_overflowEnd; i++) {
+			size_t n = qMin(iov[i].iov_len, size_t(m_overflowEnd - m_overflowOffset));
+			memcpy(iov[i].iov_base, m_overflow.constData() + m_overflowOffset, n);
+			m_overflowOffset += n;
+			count += n;
+		}
+		return count;
+	}
+	struct iovec vec[3];
+	int count = qMin(iovcnt, 2);
+	size_t total = 0;
+	for (int i = 0; i < count; i++) {
+		vec[i] = iov[i];
+		total += iov[i].iov_len;
+	}
+	if (m_type == SEQPACKET) {
+		// A message larger than the free buffer space would be truncated
+		if (m_overflow.isEmpty()) {
+			m_overflow.resize(NODEBUS_UNIXSOCKETCHANNEL_RECORD_SIZE);
+		}
+		vec[count].iov_base = m_overflow.data();
+		vec[count].iov_len = m_overflow.size();
+		count++;
+	}
+	union {
+		char buffer[CMSG_SPACE(sizeof(int) * NODEBUS_UNIXSOCKETCHANNEL_MAX_FDS)];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	bzero(&msg, sizeof(msghdr));
+	msg.msg_iov = vec;
+	msg.msg_iovlen = count;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+	ssize_t ret = ::recvmsg(m_fd, &msg, MSG_CMSG_CLOEXEC);
+	if (ret == 0 && total > 0) {
+		throw EOFException();
+	}
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+	THROW_IOEXP_ON_ERR(ret);
+	int dropped = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			int *fdv = (int *)CMSG_DATA(cmsg);
+			int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (int i = 0; i < n; i++) {
+				// Unsolicited or never taken, it would exhaust the descriptor table
+				if (m_acceptFds && m_fds.size() < NODEBUS_UNIXSOCKETCHANNEL_MAX_QUEUED_FDS) {
+					m_fds.append(fdv[i]);
+				} else {
+					::close(fdv[i]);
+					dropped++;
+				}
+			}
+		}
+	}
+	if (dropped > 0) {
+		logWarn() << "UnixSocketChannel " << name() << ": " << dropped << " file descriptor(s) " <<
+			(m_acceptFds ? "exceeding the queue closed" : "closed, not accepted");
+	}
+	if (msg.msg_flags & MSG_CTRUNC) {
+		logWarn() << "UnixSocketChannel " << name() << ": file descriptors dropped";
+	}
+	if (msg.msg_flags & MSG_TRUNC) {
+		throw IOException("UnixSocketChannel " + name() + ": message truncated");
+	}
+	if (size_t(ret) > total) {
+		m_overflowOffset = 0;
+		m_overflowEnd = ret - total;
+		return total;
+	}
+	return ret;
+}
+
+UnixSocketChannel::Buffer::Buffer(int fd): m_fd(fd), m_data(MAP_FAILED), m_size(0) {
+	try {
+		int seals;
+		THROW_IOEXP_ON_ERR(seals = ::fcntl(fd, F_GET_SEALS));
+		if ((seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE)) {
+			throw IOException("Unsealed buffer");
+		}
+		struct stat st;
+		THROW_IOEXP_ON_ERR(::fstat(fd, &st));
+		m_size = st.st_size;
+		if (m_size > 0) {
+			m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (m_data == MAP_FAILED) {
+				THROW_IOEXP_ON_ERR(-1);
+			}
+		}
+	} catch (Exception &e) {
+		::close(fd);
+		throw;
+	}
+}
+
+UnixSocketChannel::Buffer::~Buffer() {
+	if (m_data != MAP_FAILED) {
+		::munmap(m_data, m_size);
+	}
+	::close(m_fd);
+}
+
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NODEBUS_UNIXSOCKETCHANNEL_H
+#define NODEBUS_UNIXSOCKETCHANNEL_H
+
+#include <nodebus/core/exception.h>
+#include <nodebus/nio/socketchannel.h>
+#include <QList>
+#include <QByteArray>
+
+/// @brief Maximum number of file descriptors received with a single read
+#define NODEBUS_UNIXSOCKETCHANNEL_MAX_FDS 16
+/// @brief Maximum number of received file descriptors waiting to be taken
+#define NODEBUS_UNIXSOCKETCHANNEL_MAX_QUEUED_FDS 64
+/// @brief Maximum size of a seqpacket message
+#define NODEBUS_UNIXSOCKETCHANNEL_RECORD_SIZE 65536
+
+/**
+ * @namespace
+ */
+namespace NodeBus {
+
+class UnixServerSocketChannel;
+
+/**
+ * @brief Local (AF_UNIX) socket channel
+ * 
+ * A stream or seqpacket socket able to pass file descriptors to the
+ * peer process. Large payloads can be handed over as a sealed memfd
+ * buffer instead of being copied through the socket.
+ * 
+ * The received file descriptors are queued as soon as the data they have
+ * been sent with is read into the channel buffer: a protocol announces
+ * them in the message and takes them once the message has been read.
+ * They are closed on reception unless the protocol enabled it with
+ * setAcceptFds(), and beyond NODEBUS_UNIXSOCKETCHANNEL_MAX_QUEUED_FDS
+ * not taken yet.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+class UnixSocketChannel: public SocketChannel {
+	friend class UnixServerSocketChannel;
+public:
+	/**
+	 * @brief Socket types
+	 */
+	enum Type {
+		STREAM = SOCK_STREAM,
+		/// @brief Message boundaries are kept by the kernel, but not by the channel
+		SEQPACKET = SOCK_SEQPACKET
+	};
+	
+	/**
+	 * @brief Memory buffer received as a memfd
+	 */
+	class Buffer: public SharedData {
+	public:
+		/**
+		 * @brief Map a sealed memfd
+		 * @param fd memfd, owned by the buffer
+		 * @throw IOException if the memfd can still be modified by the sender
+		 */
+		Buffer(int fd);
+		virtual ~Buffer();
+		const char *data();
+		size_t size();
+	private:
+		int m_fd;
+		void *m_data;
+		size_t m_size;
+	};
+	
+	/**
+	 * @brief Connect to a local socket
+	 * @param path socket path, abstract if starting with '@'
+	 * @param type socket type
+	 * @throw IOException on error
+	 */
+	UnixSocketChannel(const QString &path, Type type = STREAM);
+	
+	/**
+	 * @brief Socket destructor, closes the file descriptors not taken
+	 */
+	virtual ~UnixSocketChannel();
+	
+	/**
+	 * @brief Get the socket type
+	 * @return STREAM or SEQPACKET
+	 */
+	Type type();
+	
+	/**
+	 * @brief Send file descriptors with data
+	 * @param data data, at least one byte
+	 * @param fds file descriptors, still owned by the caller
+	 * @throw IOException on error
+	 */
+	void sendFds(const QByteArray &data, const QList<int> &fds);
+	
+	/**
+	 * @brief Send a memory buffer as a sealed memfd with data
+	 * @param data data, at least one byte
+	 * @param buffer buffer address
+	 * @param len buffer length
+	 * @throw IOException on error
+	 */
+	void sendBuffer(const QByteArray &data, const char *buffer, size_t len);
+	
+	/**
+	 * @brief Enable the reception of file descriptors
+	 * @param value if false, the received file descriptors are closed
+	 */
+	void setAcceptFds(bool value);
+	
+	/**
+	 * @brief Take the received file descriptors
+	 * @return file descriptors, owned by the caller
+	 */
+	QList<int> takeFds();
+	
+	/**
+	 * @brief Create a sealed memfd holding a copy of a buffer
+	 * @param buffer buffer address
+	 * @param len buffer length
+	 * @return the memfd
+	 * @throw IOException on error
+	 */
+	static int createBuffer(const char *buffer, size_t len);
+	
+protected:
+	/**
+	 * @brief Accepted socket constructor
+	 * @param fd non-blocking socket
+	 * @param type socket type
+	 */
+	UnixSocketChannel(int fd, Type type);
+	
+	virtual size_t s_read(char *buffer, size_t maxlen);
+	virtual size_t s_readv(const struct iovec *iov, int iovcnt);
+	
+private:
+	Type m_type;
+	bool m_acceptFds;
+	QList<int> m_fds;
+	/// @brief Seqpacket message part exceeding the read buffer
+	QByteArray m_overflow;
+	int m_overflowOffset;
+	int m_overflowEnd;
+};
+
+inline UnixSocketChannel::Type UnixSocketChannel::type() {
+	return m_type;
+}
+
+inline void UnixSocketChannel::setAcceptFds(bool value) {
+	m_acceptFds = value;
+}
+
+inline const char *UnixSocketChannel::Buffer::data() {
+	return (const char *)m_data;
+}
+
+inline size_t UnixSocketChannel::Buffer::size() {
+	return m_size;
+}
+
+typedef SharedPtr<UnixSocketChannel> UnixSocketChannelPtr;
+
+}
+
+#endif // NODEBUS_UNIXSOCKETCHANNEL_H
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "uringselector.h"
+
+#ifdef NODEBUS_HAVE_IO_URING
+
+#include "selectionkey.h"
+#include <nodebus/core/logger.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define NODEBUS_URINGSELECTOR_WAKEUP_TAG 0xFFFFFFFFFFFFFFFFULL
+/// @brief Low word of a timeout tag, the high word is the timeout sequence
+#define NODEBUS_URINGSELECTOR_TIMEOUT_TAG 0xFFFFFFFEULL
+#define NODEBUS_URINGSELECTOR_CANCEL_TAG 0xFFFFFFFFFFFFFFFDULL
+
+#define THROW_IOEXP_ON_ERR(exp) \
+	if ((exp) == -1) throw IOException(QString() + __FILE__ + ":" + QString::number(__LINE__) + ": " + QString::fromLocal8Bit(strerror(errno)))
+
+namespace NodeBus {
+
+URingSelector::URingSelector(bool sqPoll) : Selector(false), m_ringFd(-1), m_sqPoll(sqPoll),
+m_ring(MAP_FAILED), m_ringSize(0), m_sqes((io_uring_sqe*)MAP_FAILED), m_sqesSize(0), m_owner(nullptr),
+m_timeoutSeq(0), m_timeoutPending(false), m_timeoutDeadline(0) {
+	io_uring_params params;
+	bzero(&params, sizeof(io_uring_params));
+	if (sqPoll) {
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = 1000;
+	}
+	try {
+		THROW_IOEXP_ON_ERR(m_ringFd = syscall(__NR_io_uring_setup, NODEBUS_URINGSELECTOR_ENTRIES, &params));
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+			throw IOException("io_uring: kernel too old (no single mmap feature)");
+		}
+		m_ringSize = qMax(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+			params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+		m_ring = ::mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+		if (m_ring == MAP_FAILED) {
+			THROW_IOEXP_ON_ERR(-1);
+		}
+		m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_sqes = (io_uring_sqe*)::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+		if (m_sqes == MAP_FAILED) {
+			THROW_IOEXP_ON_ERR(-1);
+		}
+	} catch (Exception &e) {
+		if (m_ring != MAP_FAILED) {
+			::munmap(m_ring, m_ringSize);
+		}
+		if (m_ringFd != -1) {
+			::close(m_ringFd);
+		}
+		throw;
+	}
+	char *ring = (char*)m_ring;
+	m_sqHead = (unsigned*)(ring + params.sq_off.head);
+	m_sqTail = (unsigned*)(ring + params.sq_off.tail);
+	m_sqMask = (unsigned*)(ring + params.sq_off.ring_mask);
+	m_sqFlags = (unsigned*)(ring + params.sq_off.flags);
+	m_sqArray = (unsigned*)(ring + params.sq_off.array);
+	m_sqEntries = params.sq_entries;
+	m_cqHead = (unsigned*)(ring + params.cq_off.head);
+	m_cqTail = (unsigned*)(ring + params.cq_off.tail);
+	m_cqMask = (unsigned*)(ring + params.cq_off.ring_mask);
+	m_cqes = (io_uring_cqe*)(ring + params.cq_off.cqes);
+	QMutexLocker _(&m_synchronize);
+	pollAdd(m_wakeupFd, EPOLLIN);
+	submit();
+}
+
+URingSelector::~URingSelector() {
+	QMutexLocker locker(&m_synchronize);
+	// The base destructor can no longer reach our remove()
+	auto list = m_keys;
+	for (auto it = list.begin(); it != list.end(); it++) {
+		if (*it != nullptr) {
+			(*it)->cancel();
+		}
+	}
+	locker.unlock();
+	::munmap(m_sqes, m_sqesSize);
+	::munmap(m_ring, m_ringSize);
+	::close(m_ringFd);
+}
+
+const char *URingSelector::engineName() {
+	return m_sqPoll ? "io_uring-sqpoll" : "io_uring";
+}
+
+bool URingSelector::select(int timeout) {
+	QMutexLocker locker(&m_synchronize);
+	m_pendingKeys.clear();
+	m_owner = QThread::currentThreadId();
+	while (m_enabled) {
+		int wait = waitTimeout(timeout);
+		if (wait > 0) {
+			qint64 deadline = TimerWheel::now() + wait;
+			// A pending earlier timeout only makes select() return sooner
+			if (!m_timeoutPending || m_timeoutDeadline > deadline) {
+				timeoutAdd(deadline);
+			}
+		}
+		unsigned toSubmit = unsubmitted();
+		locker.unlock();
+		// Queued submissions and the wait in a single system call
+		if (enter(toSubmit, wait == 0 ? 0 : 1, IORING_ENTER_GETEVENTS) == -1
+			&& errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) {
+			THROW_IOEXP_ON_ERR(-1);
+		}
+		locker.relock();
+		bool done = (wait == 0);
+		unsigned head = *m_cqHead;
+		unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+			quint64 data = cqe->user_data;
+			int res = cqe->res;
+			if (data == NODEBUS_URINGSELECTOR_WAKEUP_TAG) {
+				eventfd_t value;
+				eventfd_read(m_wakeupFd, &value);
+				pollAdd(m_wakeupFd, EPOLLIN);
+				done = true;
+				continue;
+			}
+			if ((data & 0xFFFFFFFF) == NODEBUS_URINGSELECTOR_TIMEOUT_TAG) {
+				// Timeouts replaced by an earlier one are ignored
+				if (quint32(data >> 32) == m_timeoutSeq) {
+					m_timeoutPending = false;
+					done = true;
+				}
+				continue;
+			}
+			if (data == NODEBUS_URINGSELECTOR_CANCEL_TAG) {
+				continue;
+			}
+			int fd = data & 0xFFFFFFFF;
+			if (fd >= m_generation.size() || m_generation[fd] != quint32(data >> 32)) {
+				// Removed or re-armed since
+				continue;
+			}
+			m_armed[fd] = false;
+			selected(fd, res < 0 ? EPOLLERR : res);
+			done = true;
+		}
+		__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+		if (done) {
+			bool found = updateSelectedKeys(locker);
+			m_timers.run(TimerWheel::now());
+			return found;
+		}
+	}
+	return false;
+}
+
+void URingSelector::put(const SelectionKeyPtr& key, int events) {
+	QMutexLocker _(&m_synchronize);
+	int fd = keyFd(key);
+	if (fd >= m_keys.size()) {
+		int size = qMax(fd + 1, m_keys.size() * 2);
+		m_keys.resize(size);
+		m_generation.resize(size);
+		m_armed.resize(size);
+	}
+	m_keys[fd] = key;
+	setInterest(key, events);
+	m_generation[fd]++;
+	if (events != 0) {
+		pollAdd(fd, events);
+	}
+	if (m_owner != QThread::currentThreadId()) {
+		submit();
+	}
+}
+
+void URingSelector::rearm(const SelectionKeyPtr& key, int events) {
+	QMutexLocker _(&m_synchronize);
+	int fd = keyFd(key);
+	setInterest(key, events);
+	if (m_armed[fd]) {
+		pollRemove(fd);
+	}
+	m_generation[fd]++;
+	if (events != 0) {
+		pollAdd(fd, events);
+	}
+	if (m_owner != QThread::currentThreadId()) {
+		submit();
+	}
+}
+
+void URingSelector::remove(const SelectionKeyPtr& key) {
+	QMutexLocker _(&m_synchronize);
+	int fd = keyFd(key);
+	if (fd >= m_keys.size()) {
+		return;
+	}
+	m_keys[fd] = nullptr;
+	if (m_armed[fd]) {
+		pollRemove(fd);
+		// The pending request holds a file reference: drop it before the close
+		submit();
+	}
+	m_generation[fd]++;
+}
+
+io_uring_sqe* URingSelector::getSqe() {
+	unsigned tail = *m_sqTail;
+	while (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) {
+		submit();
+		if (m_sqPoll) {
+			QThread::yieldCurrentThread();
+		}
+	}
+	io_uring_sqe *sqe = &m_sqes[tail & *m_sqMask];
+	bzero(sqe, sizeof(io_uring_sqe));
+	return sqe;
+}
+
+void URingSelector::push() {
+	unsigned tail = *m_sqTail;
+	m_sqArray[tail & *m_sqMask] = tail & *m_sqMask;
+	// The entry must be filled before being visible to the kernel
+	__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void URingSelector::pollAdd(int fd, int events) {
+	io_uring_sqe *sqe = getSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	if (fd == m_wakeupFd) {
+		sqe->user_data = NODEBUS_URINGSELECTOR_WAKEUP_TAG;
+	} else {
+		sqe->user_data = (quint64(m_generation[fd]) << 32) | quint32(fd);
+		m_armed[fd] = true;
+	}
+	push();
+}
+
+void URingSelector::pollRemove(int fd) {
+	io_uring_sqe *sqe = getSqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (quint64(m_generation[fd]) << 32) | quint32(fd);
+	sqe->user_data = NODEBUS_URINGSELECTOR_CANCEL_TAG;
+	m_armed[fd] = false;
+	push();
+}
+
+void URingSelector::timeoutAdd(qint64 deadline) {
+	io_uring_sqe *sqe;
+	if (m_timeoutPending) {
+		sqe = getSqe();
+		sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = (quint64(m_timeoutSeq) << 32) | NODEBUS_URINGSELECTOR_TIMEOUT_TAG;
+		sqe->user_data = NODEBUS_URINGSELECTOR_CANCEL_TAG;
+		push();
+	}
+	// Absolute time on the monotonic clock, the request is copied on submission
+	m_timeout.tv_sec = deadline / 1000;
+	m_timeout.tv_nsec = (deadline % 1000) * 1000000L;
+	m_timeoutSeq++;
+	m_timeoutPending = true;
+	m_timeoutDeadline = deadline;
+	sqe = getSqe();
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (quint64)&m_timeout;
+	sqe->len = 1;
+	sqe->timeout_flags = IORING_TIMEOUT_ABS;
+	sqe->user_data = (quint64(m_timeoutSeq) << 32) | NODEBUS_URINGSELECTOR_TIMEOUT_TAG;
+	push();
+}
+
+unsigned URingSelector::unsubmitted() {
+	return *m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int URingSelector::enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+	if (m_sqPoll && (__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)) {
+		flags |= IORING_ENTER_SQ_WAKEUP;
+	}
+	return syscall(__NR_io_uring_enter, m_ringFd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+void URingSelector::submit() {
+	if (m_sqPoll) {
+		if (__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+			enter(0, 0, 0);
+		}
+		return;
+	}
+	// The owner thread may consume the same entries from select()
+	// without the lock, the count is read again on each pass
+	unsigned toSubmit;
+	while ((toSubmit = unsubmitted()) > 0) {
+		int ret = enter(toSubmit, 0, 0);
+		if (ret == -1 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+			continue;
+		}
+		THROW_IOEXP_ON_ERR(ret);
+		if (ret == 0) {
+			break;
+		}
+	}
+}
+
+}
+
+#endif // NODEBUS_HAVE_IO_URING
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NODEBUS_URINGSELECTOR_H
+#define NODEBUS_URINGSELECTOR_H
+
+#ifdef NODEBUS_HAVE_IO_URING
+
+#include <nodebus/nio/selector.h>
+#include <linux/io_uring.h>
+#include <QThread>
+
+/// @brief Number of submission queue entries
+#define NODEBUS_URINGSELECTOR_ENTRIES 1024
+
+/**
+ * @namespace
+ */
+namespace NodeBus {
+
+/**
+ * @brief io_uring selector
+ * 
+ * Readiness is watched with one-shot IORING_OP_POLL_ADD requests, which
+ * match the selection key semantics. Registrations made by the reactor
+ * thread are queued and submitted by the next select() in the same
+ * system call as the wait. With the submission thread option, the other
+ * threads re-arm their keys without any system call.
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+class URingSelector : public Selector {
+public:
+	/**
+	 * @brief URingSelector constructor
+	 * @param sqPoll use a kernel submission thread
+	 * @throw IOException if io_uring is not supported
+	 */
+	URingSelector(bool sqPoll = false);
+	
+	/**
+	 * @brief URingSelector destructor
+	 */
+	virtual ~URingSelector();
+	
+	virtual bool select(int timeout = -1);
+	
+	virtual const char *engineName();
+	
+private:
+	virtual void put(const SharedPtr<SelectionKey> &key, int events);
+	virtual void rearm(const SharedPtr<SelectionKey> &key, int events);
+	virtual void remove(const SharedPtr<SelectionKey> &key);
+	
+	io_uring_sqe *getSqe();
+	void push();
+	void pollAdd(int fd, int events);
+	void pollRemove(int fd);
+	void timeoutAdd(qint64 deadline);
+	unsigned unsubmitted();
+	int enter(unsigned toSubmit, unsigned minComplete, unsigned flags);
+	void submit();
+	
+	int m_ringFd;
+	bool m_sqPoll;
+	void *m_ring;
+	size_t m_ringSize;
+	io_uring_sqe *m_sqes;
+	size_t m_sqesSize;
+	unsigned *m_sqHead;
+	unsigned *m_sqTail;
+	unsigned *m_sqMask;
+	unsigned *m_sqFlags;
+	unsigned *m_sqArray;
+	unsigned m_sqEntries;
+	unsigned *m_cqHead;
+	unsigned *m_cqTail;
+	unsigned *m_cqMask;
+	io_uring_cqe *m_cqes;
+	/// @brief Poll request generation per file descriptor, stale completions are ignored
+	QVector<quint32> m_generation;
+	QVector<bool> m_armed;
+	/// @brief Thread running select(), its submissions are deferred
+	Qt::HANDLE m_owner;
+	/// @brief Sequence of the last timeout request
+	quint32 m_timeoutSeq;
+	bool m_timeoutPending;
+	qint64 m_timeoutDeadline;
+	struct __kernel_timespec m_timeout;
+};
+
+}
+
+#endif // NODEBUS_HAVE_IO_URING
+
+#endif // NODEBUS_URINGSELECTOR_H
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "httpparser.h"
+#include <string.h>
+
+size_t HttpParser::s_maxHeaderSize = NODEBUS_HTTPPARSER_MAX_HEADER_SIZE;
+size_t HttpParser::s_maxBodySize = NODEBUS_HTTPPARSER_MAX_BODY_SIZE;
+
+static inline bool isField(const char *name, size_t len, const char *field) {
+	return len == qstrlen(field) && qstrnicmp(name, field, len) == 0;
+}
+
+static inline bool isSpace(char c) {
+	return c == ' ' || c == '\t';
+}
+
+HttpParser::HttpParser(): m_state(REQUEST_LINE), m_headerSize(0), m_minorVersion(1), m_close(false), m_keepAlive(false), m_hasLength(false), m_contentLength(0), m_received(0) {
+}
+
+void HttpParser::reset() {
+	m_state = REQUEST_LINE;
+	m_line.clear();
+	m_headerSize = 0;
+	m_method.clear();
+	m_path.clear();
+	m_contentType.clear();
+	m_minorVersion = 1;
+	m_close = false;
+	m_keepAlive = false;
+	m_hasLength = false;
+	m_contentLength = 0;
+	m_received = 0;
+	if (size_t(m_body.size()) > NODEBUS_HTTPPARSER_KEPT_BODY_SIZE) {
+		m_body.clear();
+	}
+}
+
+bool HttpParser::parse(StreamChannel &channel) {
+	size_t len;
+	if (m_state == DONE) {
+		reset();
+	}
+	// Never waits: stops once the buffer is drained
+	while (m_state != DONE && channel.available() > 0) {
+		const char *data = channel.span(len);
+		if (m_state == BODY) {
+			size_t n = qMin(len, m_contentLength - m_received);
+			memcpy(m_body.data() + m_received, data, n);
+			channel.consume(n);
+			m_received += n;
+			if (m_received == m_contentLength) {
+				m_state = DONE;
+			}
+			continue;
+		}
+		// memchr is vectorized by the C library
+		const char *end = (const char*)memchr(data, '\n', len);
+		size_t n = end == nullptr ? len : end - data + 1;
+		m_headerSize += n;
+		if (m_headerSize > s_maxHeaderSize) {
+			throw HTTPException(431, "Request header too large");
+		}
+		if (end == nullptr) {
+			m_line.append(data, n);
+		} else if (m_line.isEmpty()) {
+			parseLine(data, n - 1);
+		} else {
+			m_line.append(data, n - 1);
+			parseLine(m_line.constData(), m_line.size());
+			m_line.clear();
+		}
+		channel.consume(n);
+	}
+	return m_state == DONE;
+}
+
+void HttpParser::parseLine(const char *line, size_t len) {
+	if (len > 0 && line[len - 1] == '\r') {
+		len--;
+	}
+	if (m_state == REQUEST_LINE) {
+		// Empty lines before the request line are allowed
+		if (len > 0) {
+			parseRequestLine(line, len);
+			m_state = HEADER;
+		}
+	} else if (len == 0) {
+		endHeader();
+	} else {
+		parseField(line, len);
+	}
+}
+
+void HttpParser::parseRequestLine(const char *line, size_t len) {
+	const char *end = line + len;
+	const char *sp1 = (const char*)memchr(line, ' ', len);
+	const char *sp2 = sp1 == nullptr ? nullptr : (const char*)memchr(sp1 + 1, ' ', end - sp1 - 1);
+	if (sp2 == nullptr || sp1 == line || sp2 == sp1 + 1) {
+		throw HTTPException(400, "Invalid HTTP request line");
+	}
+	const char *version = sp2 + 1;
+	if (end - version != 8 || memcmp(version, "HTTP/", 5) != 0) {
+		throw HTTPException(400, "Invalid HTTP request line");
+	}
+	if (memcmp(version + 5, "1.", 2) != 0 || version[7] < '0' || version[7] > '9') {
+		throw HTTPException(505, "Only HTTP/1.x is supported");
+	}
+	m_minorVersion = version[7] - '0';
+	m_method = QByteArray(line, sp1 - line);
+	m_path = QByteArray(sp1 + 1, sp2 - sp1 - 1);
+}
+
+void HttpParser::parseField(const char *line, size_t len) {
+	const char *end = line + len;
+	const char *colon = (const char*)memchr(line, ':', len);
+	if (colon == nullptr || colon == line || isSpace(line[0]) || isSpace(colon[-1])) {
+		throw HTTPException(400, "Invalid HTTP header field");
+	}
+	size_t nameLen = colon - line;
+	const char *value = colon + 1;
+	while (value < end && isSpace(*value)) {
+		value++;
+	}
+	while (end > value && isSpace(end[-1])) {
+		end--;
+	}
+	if (isField(line, nameLen, "Content-Length")) {
+		size_t length = 0;
+		if (value == end) {
+			throw HTTPException(400, "Invalid Content-Length");
+		}
+		for (const char *c = value; c < end; c++) {
+			if (*c < '0' || *c > '9') {
+				throw HTTPException(400, "Invalid Content-Length");
+			}
+			length = length * 10 + (*c - '0');
+			if (length > s_maxBodySize) {
+				throw HTTPException(413, "Request body too large");
+			}
+		}
+		if (m_hasLength && length != m_contentLength) {
+			throw HTTPException(400, "Conflicting Content-Length");
+		}
+		m_hasLength = true;
+		m_contentLength = length;
+	} else if (isField(line, nameLen, "Content-Type")) {
+		const char *param = (const char*)memchr(value, ';', end - value);
+		if (param != nullptr) {
+			end = param;
+			while (end > value && isSpace(end[-1])) {
+				end--;
+			}
+		}
+		m_contentType = QByteArray(value, end - value);
+	} else if (isField(line, nameLen, "Connection")) {
+		parseConnection(value, end - value);
+	} else if (isField(line, nameLen, "Transfer-Encoding")) {
+		throw HTTPException(501, "Transfer encodings are not supported");
+	}
+}
+
+void HttpParser::parseConnection(const char *value, size_t len) {
+	const char *end = value + len;
+	while (value < end) {
+		const char *comma = (const char*)memchr(value, ',', end - value);
+		const char *tokenEnd = comma == nullptr ? end : comma;
+		while (value < tokenEnd && isSpace(*value)) {
+			value++;
+		}
+		const char *last = tokenEnd;
+		while (last > value && isSpace(last[-1])) {
+			last--;
+		}
+		if (isField(value, last - value, "close")) {
+			m_close = true;
+		} else if (isField(value, last - value, "keep-alive")) {
+			m_keepAlive = true;
+		}
+		value = tokenEnd + 1;
+	}
+}
+
+void HttpParser::endHeader() {
+	m_received = 0;
+	if (m_contentLength == 0) {
+		m_state = DONE;
+		return;
+	}
+	if (size_t(m_body.size()) < m_contentLength) {
+		m_body.resize(m_contentLength);
+	}
+	m_state = BODY;
+}
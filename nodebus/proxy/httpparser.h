@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2012-2014 Emeric Verschuur <emericv@mbedsys.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * @brief NodeBus proxy: HTTP request parser
+ * 
+ * @author <a href="mailto:emericv@mbedsys.org">Emeric Verschuur</a>
+ * @copyright Copyright (C) 2012-2014 MBEDSYS SAS
+ * This library is released under the GNU Lesser General Public version 2.1
+ */
+
+
+#ifndef HTTPPARSER_H
+#define HTTPPARSER_H
+
+#include <nodebus/core/exception.h>
+#include <nodebus/nio/streamchannel.h>
+#include <QByteArray>
+
+/// @brief Default maximum size of a request header in bytes
+#define NODEBUS_HTTPPARSER_MAX_HEADER_SIZE 8192
+/// @brief Default maximum size of a request body in bytes
+#define NODEBUS_HTTPPARSER_MAX_BODY_SIZE 4194304
+/// @brief Body buffer size kept for the next requests in bytes
+#define NODEBUS_HTTPPARSER_KEPT_BODY_SIZE 65536
+
+using namespace NodeBus;
+
+class HTTPExceptionData :public ExceptionData {
+public:
+	uint code;
+	inline HTTPExceptionData(uint code, const QString& message): ExceptionData(message), code(code) {}
+};
+
+/**
+ * @brief HTTP error, answered with its status code
+ */
+class  HTTPException :public Exception  {
+public: 
+	inline HTTPException (uint code, const QString &msg = ""):Exception (new HTTPExceptionData(code, msg)) {}
+	inline virtual ~HTTPException () throw() {} 
+	inline virtual void raise() const { throw *this; } 
+	inline virtual HTTPException  *clone() const { return new HTTPException (*this); }
+	inline uint code() { return data<HTTPExceptionData>()->code; }
+};
+
+/**
+ * @brief Incremental HTTP/1.x request parser
+ * 
+ * Parses the requests straight from the read buffer of a channel, as the
+ * data arrives, without ever waiting for more. The header lines are
+ * scanned in place, only the fields used are copied out. A line is
+ * copied only if it is split over two reads or over the buffer wrap.
+ * The body is received into a heap buffer kept for the next requests.
+ * 
+ * The header and the body sizes are bounded, a request over the limits is
+ * rejected as soon as the limit is reached.
+ */
+class HttpParser {
+public:
+	HttpParser();
+	
+	/**
+	 * @brief Parse the buffered data
+	 * 
+	 * Stops at the end of a request, the next pipelined requests are left
+	 * in the buffer. Once a request is complete, the next call parses the
+	 * following one.
+	 * 
+	 * @param channel source channel
+	 * @return true if a request is complete, false if more data is needed
+	 * @throw HTTPException on invalid or too large request
+	 * @throw IOException on error
+	 */
+	bool parse(StreamChannel &channel);
+	
+	/**
+	 * @brief Forget the current request to parse the next one
+	 */
+	void reset();
+	
+	/**
+	 * @brief Get the request method
+	 * @return method
+	 */
+	const QByteArray &method() const;
+	
+	/**
+	 * @brief Get the request target
+	 * @return path
+	 */
+	const QByteArray &path() const;
+	
+	/**
+	 * @brief Get the content type, without its parameters
+	 * @return content type, empty if none
+	 */
+	const QByteArray &contentType() const;
+	
+	/**
+	 * @brief Get the request body
+	 * @param len body length
+	 * @return body address, valid until the next call to parse()
+	 */
+	const char *body(size_t &len) const;
+	
+	/**
+	 * @brief Test if the connection persists after the request
+	 * 
+	 * HTTP/1.1 connections persist unless the client sends Connection:
+	 * close, HTTP/1.0 ones only if it sends Connection: keep-alive.
+	 * 
+	 * @return true to keep the connection open, otherwise false
+	 */
+	bool keepAlive() const;
+	
+	/**
+	 * @brief Test if a request has been partially received
+	 * @return true if a request is in progress, otherwise false
+	 */
+	bool isStarted() const;
+	
+	/**
+	 * @brief Set the maximum size of a request header
+	 * @param size size in bytes
+	 */
+	static void setMaxHeaderSize(size_t size);
+	
+	/**
+	 * @brief Set the maximum size of a request body
+	 * @param size size in bytes
+	 */
+	static void setMaxBodySize(size_t size);
+	
+private:
+	enum State {
+		REQUEST_LINE,
+		HEADER,
+		BODY,
+		DONE
+	};
+	
+	void parseLine(const char *line, size_t len);
+	void parseRequestLine(const char *line, size_t len);
+	void parseField(const char *line, size_t len);
+	void parseConnection(const char *value, size_t len);
+	void endHeader();
+	
+	State m_state;
+	/// @brief Start of a line split over two reads
+	QByteArray m_line;
+	size_t m_headerSize;
+	QByteArray m_method;
+	QByteArray m_path;
+	QByteArray m_contentType;
+	/// @brief HTTP/1.x minor version
+	int m_minorVersion;
+	bool m_close;
+	bool m_keepAlive;
+	bool m_hasLength;
+	size_t m_contentLength;
+	/// @brief Body buffer, kept for the next requests unless large
+	QByteArray m_body;
+	size_t m_received;
+	static size_t s_maxHeaderSize;
+	static size_t s_maxBodySize;
+};
+
+inline const QByteArray &HttpParser::method() const {
+	return m_method;
+}
+
+inline const QByteArray &HttpParser::path() const {
+	return m_path;
+}
+
+inline const QByteArray &HttpParser::contentType() const {
+	return m_contentType;
+}
+
+inline const char *HttpParser::body(size_t &len) const {
+	len = m_contentLength;
+	return m_body.constData();
+}
+
+inline bool HttpParser::keepAlive() const {
+	return !m_close && (m_minorVersion > 0 || m_keepAlive);
+}
+
+inline bool HttpParser::isStarted() const {
+	return m_state != REQUEST_LINE || !m_line.isEmpty();
+}
+
+inline void HttpParser::setMaxHeaderSize(size_t size) {
+	s_maxHeaderSize = size;
+}
+
+inline void HttpParser::setMaxBodySize(size_t size) {
+	s_maxBodySize = size;
+}
+
+#endif // HTTPPARSER_H
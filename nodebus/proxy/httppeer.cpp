@@ -20,31 +20,23 @@
 #include "stdpeer.h"
 #include "proxy.h"
 #include <typeinfo>
-#include <qt4/QtNetwork/QHttpHeader>
+#include <string.h>
 #include <qt4/QtCore/qshareddata.h>
 #include <nodebus/core/logger.h>
+#include <nodebus/core/census.h>
+#include <nodebus/core/executor.h>
 #include <nodebus/nio/selectionkey.h>
 #include <nodebus/nio/streamchannel.h>
+#include <nodebus/nio/reactor.h>
+#include <nodebus/nio/ssliochannel.h>
+#include <nodebus/nio/sslsocketchannel.h>
 #include <nodebus/core/parser.h>
 #include <nodebus/core/serializer.h>
 
-class HTTPExceptionData :public ExceptionData {
-public:
-	uint code;
-	inline HTTPExceptionData(uint code, const QString& message): ExceptionData(message), code(code) {}
-};
-
-class  HTTPException :public Exception  {
-public: 
-	inline HTTPException (uint code, const QString &msg = ""):Exception (new HTTPExceptionData(code, msg)) {}
-	inline virtual ~HTTPException () throw() {} 
-	inline virtual void raise() const { throw *this; } 
-	inline virtual HTTPException  *clone() const { return new HTTPException (*this); }
-	inline uint code() { return data<HTTPExceptionData>()->code; }
-};
+int HttpPeer::s_requestTimeout = NODEBUS_HTTPPEER_REQUEST_TIMEOUT;
 
 HttpPeer::HttpPeer(SocketChannelPtr channel)
-: Peer(channel), m_processDone(false) {
+: Peer(channel), m_synchronize(QMutex::Recursive), m_requestTimer(this), m_replied(0), m_steps(0), m_reqId(0), m_receiveStart(0), m_keepAlive(false), m_format(JSON) {
 }
 
 HttpPeer::~HttpPeer() {
@@ -52,149 +44,328 @@ HttpPeer::~HttpPeer() {
 }
 
 void HttpPeer::cancel() {
+	QMutexLocker locker(&m_synchronize);
 	if (m_socket == nullptr) {
 		return;
 	}
-	if (m_stdPeer != NULL) {
-		m_stdPeer->rmRef(m_reqUid);
+	SharedPtr<StdPeer> stdPeer = m_stdPeer.lock();
+	if (stdPeer != nullptr && m_reqId != 0) {
+		stdPeer->rmRef(m_reqId);
 	}
 	Peer::cancel();
 }
 
-void HttpPeer::sendResult(uint code, const QVariant& content) {
+/**
+ * @brief Get the status line of a response
+ */
+static const char *statusLine(uint code, size_t &len) {
+	const char *line;
+	switch (code) {
+		case 200: line = "HTTP/1.1 200 OK\r\n"; break;
+		case 400: line = "HTTP/1.1 400 Bad Request\r\n"; break;
+		case 404: line = "HTTP/1.1 404 Not Found\r\n"; break;
+		case 405: line = "HTTP/1.1 405 Method Not Allowed\r\n"; break;
+		case 408: line = "HTTP/1.1 408 Request Timeout\r\n"; break;
+		case 413: line = "HTTP/1.1 413 Payload Too Large\r\n"; break;
+		case 415: line = "HTTP/1.1 415 Unsupported Media Type\r\n"; break;
+		case 431: line = "HTTP/1.1 431 Request Header Fields Too Large\r\n"; break;
+		case 501: line = "HTTP/1.1 501 Not Implemented\r\n"; break;
+		case 503: line = "HTTP/1.1 503 Service Unavailable\r\n"; break;
+		case 504: line = "HTTP/1.1 504 Gateway Timeout\r\n"; break;
+		case 505: line = "HTTP/1.1 505 HTTP Version Not Supported\r\n"; break;
+		default: line = code < 500 ? "HTTP/1.1 400 Bad Request\r\n" : "HTTP/1.1 500 Internal Server Error\r\n"; break;
+	}
+	len = qstrlen(line);
+	return line;
+}
+
+/**
+ * @brief Append a string to a response header
+ */
+static inline char *append(char *dest, const char *src, size_t len) {
+	memcpy(dest, src, len);
+	return dest + len;
+}
+
+#define APPEND_LITERAL(dest, str) dest = append(dest, str, sizeof(str) - 1)
+
+void HttpPeer::reply(uint code, const QVariant& content) {
+	SocketChannelPtr socket = this->socket();
+	if (socket == nullptr) {
+		return;
+	}
 	QByteArray msgData;
 	Serializer(msgData, m_format).serialize(content);
-	QHttpResponseHeader rspHdr;
-	rspHdr.setStatusLine(code);
-	rspHdr.setContentLength(msgData.length());
-	rspHdr.setContentType("application/json");
-	logFiner() << rspHdr.toString() << QString(msgData);
-	QByteArray hdrData = rspHdr.toString().toUtf8();
-	m_socket->write(hdrData.constData(), hdrData.length());
-	m_socket->write(msgData.constData(), msgData.length());
-	m_socket->close();
+	// Filled from constant fragments, no formatting but the length
+	char header[NODEBUS_HTTPPEER_HEADER_SIZE];
+	char *end = header;
+	size_t len;
+	const char *line = statusLine(code, len);
+	end = append(end, line, len);
+	switch (m_format) {
+		case BSON: APPEND_LITERAL(end, "Content-Type: application/bson\r\n"); break;
+		case BCON: APPEND_LITERAL(end, "Content-Type: application/bcon\r\n"); break;
+		default: APPEND_LITERAL(end, "Content-Type: application/json\r\n"); break;
+	}
+	if (m_keepAlive) {
+		APPEND_LITERAL(end, "Connection: keep-alive\r\nContent-Length: ");
+	} else {
+		APPEND_LITERAL(end, "Connection: close\r\nContent-Length: ");
+	}
+	char digits[20];
+	int count = 0;
+	uint length = msgData.size();
+	do {
+		digits[count++] = '0' + length % 10;
+		length /= 10;
+	} while (length > 0);
+	while (count > 0) {
+		*end++ = digits[--count];
+	}
+	APPEND_LITERAL(end, "\r\n\r\n");
+	if (Logger::level() >= Logger::FINER) {
+		logFiner() << QByteArray(header, end - header) << msgData;
+	}
+	// Both parts are sent by a single writev
+	socket->cork();
+	socket->write(header, end - header);
+	socket->write(msgData);
+	socket->uncork();
+	if (!m_keepAlive) {
+		socket->close();
+	}
 }
 
-void HttpPeer::process() {
-	size_t n;
-	if (m_processDone) {
-		while ((n = m_socket->available()) > 0) {
-			m_socket->ignore(n);
+SocketChannelPtr HttpPeer::socket() {
+	QMutexLocker _(&m_synchronize);
+	return m_socket;
+}
+
+void HttpPeer::sendResult(uint code, const QVariant& content) {
+	// The box response and the request timeout may race
+	if (!m_replied.testAndSetOrdered(0, 1)) {
+		return;
+	}
+	reply(code, content);
+	if (!m_steps.deref()) {
+		// process() has already returned
+		complete();
+		if (m_keepAlive) {
+			// Next pipelined request
+			Executor::globalInstance()->start(new Peer::Task(this));
 		}
-		Proxy::getInstance().getPeerAdmin().attach(m_socket, this);
+	}
+}
+
+void HttpPeer::complete() {
+	// Waits for a running timeout
+	m_requestTimer.release();
+	m_reqId = 0;
+}
+
+void HttpPeer::expire() {
+	SharedPtr<StdPeer> stdPeer = m_stdPeer.lock();
+	// Already taken from the pending requests if the box responded
+	if (stdPeer != nullptr && !stdPeer->rmRef(m_reqId)) {
 		return;
 	}
-	m_socket->setDeadLine(QDateTime::currentMSecsSinceEpoch() + 30000);
-	try {
-		QString data;
+	logConf() << "HTTP 504: No response from the box";
+	QVariantMap res;
+	res["type"] = "response";
+	res["object"] = "Proxy";
+	res["status"] = "failure";
+	res["error-message"] = "No response from the box";
+	sendResult(504, res);
+}
+
+bool HttpPeer::shed() {
+	if (m_reqId != 0) {
+		// Waiting for the box response, the work is already done
+		return false;
+	}
+	logFine() << "HTTP 503: request shed on overload";
+	QVariantMap res;
+	res["type"] = "response";
+	res["object"] = "Proxy";
+	res["status"] = "failure";
+	res["error-message"] = "The proxy is overloaded";
+	m_keepAlive = false;
+	reply(503, res);
+	return true;
+}
+
+void HttpPeer::process() {
+	// Kept alive by this copy if the peer is cancelled meanwhile, the
+	// parser then gets an end of file
+	SocketChannelPtr socket = this->socket();
+	if (socket == nullptr) {
+		return;
+	}
+	// The pipelined requests are handled one at a time, in order
+	for (;;) {
 		try {
-			char c1 = m_socket->get(),c2 = m_socket->get(),c3 = m_socket->get(),c4 = m_socket->get();
-			data.append(c1);
-			data.append(c2);
-			while (c1 != '\r' ||  c3 != '\r' || c2 != '\n' || c4 != '\n') {
-				data.append(c3);
-				c1 = c2;
-				c2 = c3;
-				c3 = c4;
-				c4 = m_socket->get();
+			if (m_receiveStart != 0 && TimerWheel::now() - m_receiveStart > NODEBUS_HTTPPEER_RECEIVE_TIMEOUT) {
+				throw HTTPException(408, "Request timeout");
 			}
-		} catch (IOTimeoutException &e) {
-			throw HTTPException(408, "Request timeout");
-		}
-		logFiner() << data;
-		QHttpRequestHeader httpHeader(data);
-		if (!httpHeader.isValid()) {
-			throw HTTPException(400, "Invalid HTTP header");
-		}
-		if (httpHeader.method() != "POST") {
-			throw HTTPException(405, "Only POST method is supported");
-		}
-		if (httpHeader.contentType() == "application/json") {
+			if (!m_parser.parse(*socket)) {
+				if (m_receiveStart == 0 && m_parser.isStarted()) {
+					m_receiveStart = TimerWheel::now();
+				}
+				// Incomplete request or idle connection, wait for the next
+				// data without holding a worker, the idle timeout applies
+				Proxy::getInstance().getPeerAdmin().attach(socket, this);
+				return;
+			}
+			m_receiveStart = 0;
+			m_keepAlive = m_parser.keepAlive();
 			m_format = JSON;
-		} else if (httpHeader.contentType() == "application/bson") {
-			m_format = BSON;
-		} else if (httpHeader.contentType() == "application/bcon") {
-			m_format = BCON;
-		} else {
-			throw HTTPException(415, "Missing/Unknow ContentType (can be 'application/json', 'application/bson' or 'application/bcon')");
-		}
-		uint payloadLen = httpHeader.contentLength();
-		if (payloadLen == 0) {
-			throw HTTPException(400, "No data found");
-		}
-		char payloadData[payloadLen];
-		try {
-			uint n = 0;
-			while (n < payloadLen) {
-				n += m_socket->read(payloadData + n, payloadLen - n);
+			if (handle()) {
+				// Continued by the response unless already sent
+				if (m_steps.deref()) {
+					return;
+				}
+				complete();
 			}
-		} catch (IOTimeoutException &e) {
-			throw HTTPException(408, "Request timeout");
+		} catch (HTTPException &e) {
+			logConf() << "HTTP " << e.code() << ": " << e.message();
+			QVariantMap res;
+			res["type"] = "response";
+			res["object"] = "Proxy";
+			res["status"] = "failure";
+			res["error-message"] = e.message();
+			// The following data may not be a request
+			m_keepAlive = false;
+			reply(e.code(), res);
 		}
-		while ((n = m_socket->available()) > 0) {
-			m_socket->ignore(n);
+		if (!m_keepAlive) {
+			return;
 		}
-		QVariantMap message;
-		try {
-			message = Parser::parse(payloadData, payloadLen, m_format).toMap();
-		} catch (Exception &e) {
-			throw HTTPException(400, "Data parse error: " + e.message());
+	}
+}
+
+bool HttpPeer::handle() {
+	if (Logger::level() >= Logger::FINER) {
+		logFiner() << m_parser.method() << " " << m_parser.path();
+	}
+	if (m_parser.method() != "POST") {
+		throw HTTPException(405, "Only POST method is supported");
+	}
+	if (m_parser.contentType() == "application/json") {
+		m_format = JSON;
+	} else if (m_parser.contentType() == "application/bson") {
+		m_format = BSON;
+	} else if (m_parser.contentType() == "application/bcon") {
+		m_format = BCON;
+	} else {
+		throw HTTPException(415, "Missing/Unknow ContentType (can be 'application/json', 'application/bson' or 'application/bcon')");
+	}
+	size_t payloadLen;
+	const char *payloadData = m_parser.body(payloadLen);
+	if (payloadLen == 0) {
+		throw HTTPException(400, "No data found");
+	}
+	QVariantMap message;
+	try {
+		message = Parser::parse(payloadData, payloadLen, m_format).toMap();
+	} catch (Exception &e) {
+		throw HTTPException(400, "Data parse error: " + e.message());
+	}
+	logFiner() << Serializer::toJSONString(message, Serializer::INDENT(2));
+	QString uid = QString::fromUtf8(m_parser.path()).section('/', 1);
+	SharedPtr<StdPeer> stdPeer;
+	if (!uid.isEmpty()) {
+		stdPeer = StdPeer::get(uid);
+		if (stdPeer == nullptr) {
+			throw HTTPException(404, "There is no box with the given uid '" + uid + "'");
 		}
-		logFiner() << Serializer::toJSONString(message, Serializer::INDENT(2));
-		QString uid = httpHeader.path().section('/', 1);
-		if (!uid.isEmpty()) {
-			m_stdPeer = StdPeer::get(uid);
-			if (m_stdPeer == nullptr) {
-				throw HTTPException(404, "There is no box with the given uid '" + uid + "'");
-			}
+	}
+	QString object = message["object"].toString();
+	if (object.isEmpty()) {
+		throw HTTPException(400, "Malformed message, missing 'object' field");
+	}
+	QString type = message["type"].toString();
+	if (stdPeer != nullptr) {
+		if (type != "request") {
+			throw HTTPException(400, "Only 'request' messge type can be forwarded");
 		}
-		QString object = message["object"].toString();
-		if (object.isEmpty()) {
-			throw HTTPException(400, "Malformed message, missing 'object' field");
+		m_stdPeer = stdPeer;
+		// Released by this thread and by the response, the last one continues
+		m_replied.fetchAndStoreOrdered(0);
+		m_steps.fetchAndStoreOrdered(2);
+		quint64 id = stdPeer->send(message, this);
+		if (id == 0) {
+			throw HTTPException(503, "The box '" + uid + "' is overloaded");
 		}
-		QString type = message["type"].toString();
-		if (m_stdPeer != nullptr) {
-			if (type != "request") {
-				throw HTTPException(400, "Only 'request' messge type can be forwarded");
-			}
-			m_reqUid = m_stdPeer->send(message, this);
-			Proxy::getInstance().getPeerAdmin().attach(m_socket, this);
-			m_processDone = true;
-			return;
+		m_reqId = id;
+		if (s_requestTimeout > 0 && timers() != nullptr) {
+			m_requestTimer.start(*timers(), s_requestTimeout);
 		}
-		if (object != "Proxy") {
-			throw HTTPException(400, "Service '" + object + "' not found");
+		return true;
+	}
+	if (object != "Proxy") {
+		throw HTTPException(400, "Service '" + object + "' not found");
+	}
+	QString method = message["method"].toString();
+	QVariant variant;
+	if (method == "ping") {
+	} else if (method == "help") {
+	} else if (method == "getStatus") {
+		QVariantMap res;
+		res["box-count"] = StdPeer::getCount();
+		QVariantMap allocs;
+		allocs["SelectionKey"] = (qulonglong)ObjectPool<SelectionKey>::allocatorCalls();
+		allocs["Peer::Task"] = (qulonglong)ObjectPool<Peer::Task>::allocatorCalls();
+		allocs["ExceptionData"] = (qulonglong)ObjectPool<ExceptionData>::allocatorCalls();
+		allocs["MPSCQueue::Node"] = (qulonglong)MPSCQueue<QByteArray>::allocatorCalls();
+		allocs.unite(Parser::allocatorCalls());
+		res["allocator-calls"] = allocs;
+		res["tls-handshakes"] = Reactor::handshakeStats();
+		res["tls-records"] = SSLIOChannel::recordStats();
+		res["tls-engine"] = SSLSocketChannel::engineStats();
+		res["executor"] = Executor::globalInstance()->stats();
+		res["outbox"] = StdPeer::getOutboxStats();
+		res["admission"] = Admission::allStats();
+		variant = res;
+	} else if (method == "getBoxList") {
+		QList<QString> list = StdPeer::getUidList();
+		QVariantList res;
+		for (auto it = list.begin(); it != list.end(); it++) {
+			res.append(*it);
 		}
-		QString method = message["method"].toString();
-		QVariant variant;
-		if (method == "ping") {
-		} else if (method == "help") {
-		} else if (method == "getStatus") {
-			QVariantMap res;
-			res["box-count"] = StdPeer::getCount();
-			variant = res;
-		} else if (method == "getBoxList") {
-			QList<QString> list = StdPeer::getUidList();
-			QVariantList res;
-			for (auto it = list.begin(); it != list.end(); it++) {
-				res.append(*it);
-			}
-			variant = res;
-		} else {
-			throw HTTPException(400, "invalid method '" + method + "'");
+		variant = res;
+	} else if (method == "getCensus") {
+		QVariantMap parameters = message["parameters"].toMap();
+		if (parameters.contains("enable")) {
+			Census::setEnabled(parameters["enable"].toBool());
 		}
 		QVariantMap res;
-		res["type"] = "response";
-		res["status"] = "success";
-		res["data"] = variant;
-		sendResult(200, res);
-	} catch (HTTPException &e) {
-		logConf() << "HTTP " << e.code() << ": " << e.message();
-		QVariantMap res;
-		res["type"] = "response";
-		res["object"] = "Proxy";
-		res["status"] = "failure";
-		res["error-message"] = e.message();
-		sendResult(e.code(), res);
+		res["enabled"] = Census::isEnabled();
+		res["live-count"] = Census::liveCount();
+		res["types"] = Census::toString();
+		variant = res;
+	} else {
+		throw HTTPException(400, "invalid method '" + method + "'");
+	}
+	QVariantMap res;
+	res["type"] = "response";
+	res["status"] = "success";
+	res["data"] = variant;
+	reply(200, res);
+	return false;
+}
+
+HttpPeer::RequestTimer::RequestTimer(HttpPeer *peer): m_peer(peer) {
+}
+
+HttpPeer::RequestTimer::~RequestTimer() {
+	release();
+}
+
+void HttpPeer::RequestTimer::timeout() {
+	// The peer may be released concurrently
+	SharedPtr<HttpPeer> peer = m_peer.lock();
+	if (peer == nullptr) {
+		return;
 	}
+	peer->expire();
 }
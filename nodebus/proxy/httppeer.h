@@ -29,14 +29,33 @@
 #define HTTPPEER_H
 
 #include <nodebus/core/sharedptr.h>
+#include <nodebus/core/weakptr.h>
 #include <nodebus/nio/streamchannel.h>
 #include <nodebus/nio/peer.h>
 #include <nodebus/core/global.h>
+#include "httpparser.h"
 #include <QVariant>
+#include <QAtomicInt>
+#include <QMutex>
+
+/// @brief Default time to wait for the response of a box in milliseconds
+#define NODEBUS_HTTPPEER_REQUEST_TIMEOUT 30000
+/// @brief Time allowed to receive a whole request in milliseconds
+#define NODEBUS_HTTPPEER_RECEIVE_TIMEOUT 30000
+/// @brief Response header buffer size
+#define NODEBUS_HTTPPEER_HEADER_SIZE 256
 
 class StdPeer;
 using namespace NodeBus;
 
+/**
+ * @brief Console HTTP/1.1 connection
+ * 
+ * The connection persists between the requests unless the client asks to
+ * close it. The pipelined requests are handled one at a time, so that the
+ * responses are sent in order: the next request is parsed once the
+ * response of the previous one is sent, by the box or by the proxy.
+ */
 class HttpPeer: public Peer {
 public:
 	
@@ -57,12 +76,88 @@ public:
 	
 	virtual void process();
 	
+	/**
+	 * @brief Answer 503 at once on overload
+	 * @return true if shed, false once the request is forwarded to a box
+	 */
+	virtual bool shed();
+	
+	/**
+	 * @brief Send the response of the request forwarded to a box
+	 * 
+	 * Only the first call sends a response, the next ones are ignored.
+	 * The connection is closed unless it persists, the next pipelined
+	 * request is then handled.
+	 * 
+	 * @param code HTTP status code
+	 * @param content response content
+	 */
 	void sendResult(uint code, const QVariant& content);
 	
+	/**
+	 * @brief Set the time to wait for the response of a box
+	 * @param msecs time in milliseconds, 0 to wait forever
+	 */
+	static void setRequestTimeout(int msecs);
+	
+	/**
+	 * @brief Get the time allowed to the box to respond
+	 * @return time in milliseconds, 0 to wait forever
+	 */
+	static int requestTimeout();
+	
 private:
-	bool m_processDone;
-	SharedPtr<StdPeer> m_stdPeer;
-	QString m_reqUid;
+	class RequestTimer: public Timer {
+	public:
+		RequestTimer(HttpPeer *peer);
+		virtual ~RequestTimer();
+	protected:
+		virtual void timeout();
+	private:
+		WeakPtr<HttpPeer> m_peer;
+	};
+	
+	/**
+	 * @brief Get the socket, cancelled concurrently by the timers
+	 * @return socket, nullptr once cancelled
+	 */
+	SocketChannelPtr socket();
+	
+	/**
+	 * @brief Handle a parsed request
+	 * @return true if forwarded to a box, false if already answered
+	 */
+	bool handle();
+	
+	/**
+	 * @brief Write a response, close the connection unless it persists
+	 */
+	void reply(uint code, const QVariant& content);
+	
+	/**
+	 * @brief Answer 504 if the box did not respond yet
+	 */
+	void expire();
+	
+	/**
+	 * @brief End of a forwarded request
+	 */
+	void complete();
+	
+	static int s_requestTimeout;
+	/// @brief Protects m_socket
+	QMutex m_synchronize;
+	RequestTimer m_requestTimer;
+	QAtomicInt m_replied;
+	/// @brief Forwarded request steps left: the end of process() and the response
+	QAtomicInt m_steps;
+	WeakPtr<StdPeer> m_stdPeer;
+	/// @brief Correlation id of the forwarded request, 0 if none
+	quint64 m_reqId;
+	HttpParser m_parser;
+	/// @brief Reception start of the request, 0 if none
+	qint64 m_receiveStart;
+	bool m_keepAlive;
 	FileFormat m_format;
 };
 
@@ -70,4 +165,12 @@ inline SharedPtr< Peer > HttpPeer::Factory::build(SocketChannelPtr channel) {
 	return new HttpPeer(channel);
 }
 
+inline void HttpPeer::setRequestTimeout(int msecs) {
+	s_requestTimeout = msecs;
+}
+
+inline int HttpPeer::requestTimeout() {
+	return s_requestTimeout;
+}
+
 #endif // HTTPPEER_H
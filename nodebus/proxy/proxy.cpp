@@ -21,12 +21,17 @@
 #include <nodebus/core/cliarguments.h>
 #include <nodebus/core/settings.h>
 #include <nodebus/core/logger.h>
+#include <nodebus/core/census.h>
+#include <nodebus/core/cpuset.h>
+#include <nodebus/core/executor.h>
 #include <nodebus/nio/sslserversocketchannel.h>
 #include <nodebus/nio/ssliochannel.h>
 #include <nodebus/nio/sslcontext.h>
+#include <nodebus/nio/unixserversocketchannel.h>
 #include "proxy.h"
 #include "stdpeer.h"
 #include <nodebus/nio/peeradmin.h>
+#include <nodebus/nio/selector.h>
 #include "httppeer.h"
 #include <openssl/pkcs12.h>
 
@@ -126,7 +131,7 @@ void Proxy::onStart() {
 #endif
 // 	m_settings->define("pidfile",	tr("Path of the file where the service PID will be written in"),
 // 					"/var/run/nodebusproxy.pid");
-	m_settings->define("intf-main/listen-uri",	tr("Main interface - Listen addresses (comma separated URIs)"),
+	m_settings->define("intf-main/listen-uri",	tr("Main interface - Listen addresses (comma separated URIs: ssl://host:port, socket://host:port, unix:///path or seqpacket:///path)"),
 					"ssl://[::]:3693");
 	m_settings->define("intf-main/keystore-path",	tr("Main interface - PKCS12 keystore path"),
 					"/etc/nodebusproxy/keystore.p12");
@@ -140,11 +145,83 @@ void Proxy::onStart() {
 					"");
 	m_settings->define("intf-console/keystore-pwd",	tr("Console interface - PKCS12 keystore password"),
 					"");
+	m_settings->define("reactor-count",	tr("Number of reactor threads (0 for one per core)"),
+					0);
+	m_settings->define("reactor-cpus",	tr("CPUs the reactor threads are pinned to, one reactor per CPU (ex: '0-3,8-11', empty for none)"),
+					"");
+	m_settings->define("worker-cpus",	tr("CPUs the worker threads are pinned to, one worker per CPU (ex: '4-7,12-15', empty for none)"),
+					"");
+	m_settings->define("listen-nic",	tr("Network interface whose NUMA node accepts the connections, only the reactors pinned to this node listen (empty for all)"),
+					"");
+	m_settings->define("io-engine",	tr("I/O engine: epoll, io_uring or io_uring-sqpoll (falls back to epoll if not supported)"),
+					"epoll");
+	m_settings->define("read-buffer-size",	tr("Read buffer size per connection in bytes"),
+					NODEBUS_STREAMCHANNEL_BUFFER_SIZE);
+	m_settings->define("write-low-water-mark",	tr("Output queue size per connection below which writing resumes in bytes"),
+					NODEBUS_STREAMCHANNEL_LOW_WATER_MARK);
+	m_settings->define("write-high-water-mark",	tr("Output queue size per connection above which writing is suspended in bytes"),
+					NODEBUS_STREAMCHANNEL_HIGH_WATER_MARK);
+	m_settings->define("intf-main/kernel-tls",	tr("Main interface - Offload the TLS records to the kernel when supported (kTLS)"),
+					false);
+	m_settings->define("intf-main/idle-timeout",	tr("Main interface - Time without any received data before closing a connection in seconds (0 to disable)"),
+					0);
+	m_settings->define("intf-console/idle-timeout",	tr("Console interface - Time without any received data before closing a connection in seconds (0 to disable)"),
+					60);
+	m_settings->define("intf-main/queue-limit",	tr("Main interface - Maximum number of peer tasks waiting for a worker (0 for no limit)"),
+					0);
+	m_settings->define("intf-main/queue-target-delay",	tr("Main interface - Queue delay above which the listener is overloaded in milliseconds (0 to disable)"),
+					0);
+	m_settings->define("intf-console/queue-limit",	tr("Console interface - Maximum number of peer tasks waiting for a worker, the requests above are answered 503 (0 for no limit)"),
+					1000);
+	m_settings->define("intf-console/queue-target-delay",	tr("Console interface - Queue delay above which the requests waiting longer are answered 503 in milliseconds (0 to disable)"),
+					NODEBUS_ADMISSION_TARGET);
+	m_settings->define("request-timeout",	tr("Time to wait for the response of a box to a console request in seconds (0 to wait forever)"),
+					NODEBUS_HTTPPEER_REQUEST_TIMEOUT / 1000);
+	m_settings->define("request-max-header-size",	tr("Maximum size of a console request header in bytes, the larger ones are answered 431"),
+					NODEBUS_HTTPPARSER_MAX_HEADER_SIZE);
+	m_settings->define("request-max-size",	tr("Maximum size of a console request body in bytes, the larger ones are answered 413"),
+					NODEBUS_HTTPPARSER_MAX_BODY_SIZE);
+	m_settings->define("handshake-timeout",	tr("Time allowed to a new connection to complete its TLS handshake in seconds"),
+					NODEBUS_REACTOR_HANDSHAKE_TIMEOUT / 1000);
+	m_settings->define("debug/census",	tr("Debug - Enable the per type shared data census"),
+					false);
 	if (args.isEnabled("edit-settings")) {
 		m_settings->setup();
 		throw ExitApplicationException();
 	}
 	
+	Census::setEnabled(m_settings->value("debug/census").toBool());
+	QString engine = m_settings->value("io-engine").toString();
+	if (engine == "io_uring") {
+		Selector::setDefaultEngine(Selector::URING);
+	} else if (engine == "io_uring-sqpoll") {
+		Selector::setDefaultEngine(Selector::URING_SQPOLL);
+	} else if (engine != "epoll") {
+		logWarn() << "Unknown I/O engine '" << engine << "', using epoll";
+	}
+	m_socketAdmin.setReactorCount(m_settings->value("reactor-count").toInt());
+	try {
+		m_socketAdmin.setReactorCpus(CpuSet::parse(m_settings->value("reactor-cpus").toString()));
+		Executor::setGlobalCpus(CpuSet::parse(m_settings->value("worker-cpus").toString()));
+	} catch (CpuSetException &e) {
+		throw ApplicationException(e.message());
+	}
+	QString nic = m_settings->value("listen-nic").toString();
+	if (!nic.isEmpty()) {
+		int node = CpuSet::nodeOfInterface(nic);
+		if (node == -1) {
+			logWarn() << "No NUMA node found for the network interface '" << nic << "', listening on all the reactors";
+		}
+		m_socketAdmin.setListenNode(node);
+	}
+	StreamChannel::setDefaultBufferSize(m_settings->value("read-buffer-size").toUInt());
+	StreamChannel::setDefaultWaterMarks(m_settings->value("write-low-water-mark").toUInt(),
+		m_settings->value("write-high-water-mark").toUInt());
+	HttpPeer::setRequestTimeout(m_settings->value("request-timeout").toInt() * 1000);
+	HttpParser::setMaxHeaderSize(m_settings->value("request-max-header-size").toUInt());
+	HttpParser::setMaxBodySize(m_settings->value("request-max-size").toUInt());
+	Reactor::setHandshakeTimeout(m_settings->value("handshake-timeout").toInt() * 1000);
+	
 	SSL_load_error_strings();
 	SSL_library_init();
 	
@@ -153,7 +230,7 @@ void Proxy::onStart() {
 		throw ApplicationException("No URL given for listen addresse list on the main interface");
 	}
 	SSLContextPtr sslCtx;
-	GenericPtr clientFactory = new StdPeer::Factory(JSON);
+	SharedPtr<Peer::Factory> clientFactory;
 	QString format = m_settings->value("intf-main/format").toString();
 	if (format == "JSON") {
 		clientFactory = new StdPeer::Factory(JSON);
@@ -164,6 +241,8 @@ void Proxy::onStart() {
 	} else {
 		throw ApplicationException("Missing/Invalid format for intf-main/format setting (can be 'JSON', 'BSON' or 'BCON')");
 	}
+	clientFactory->setIdleTimeout(m_settings->value("intf-main/idle-timeout").toInt() * 1000);
+	setupAdmission(clientFactory, "intf-main");
 	for (auto it = urls.begin(); it != urls.end(); it++) {
 		QUrl url(*it);
 		ServerSocketChannelPtr server;
@@ -171,19 +250,28 @@ void Proxy::onStart() {
 			if (sslCtx == nullptr) {
 				sslCtx = new PKCS12SSLCtx(m_settings->value("intf-main/keystore-path").toString(), 
 							m_settings->value("intf-main/keystore-pwd").toString());
+				if (m_settings->value("intf-main/kernel-tls").toBool() && !sslCtx->enableKernelTLS()) {
+					logWarn() << "Kernel TLS not supported by the OpenSSL library, using the user space records";
+				}
 			}
-			m_socketAdmin.attach(server = new SSLServerSocketChannel(url.host(), url.port(3693), sslCtx, 
-					SSLServerSocketChannel::OPT_BACKLOG(5) | SSLServerSocketChannel::OPT_REUSEADDR), clientFactory);
+			server = new SSLServerSocketChannel(url.host(), url.port(3693), sslCtx, 
+					SSLServerSocketChannel::OPT_BACKLOG(5) | SSLServerSocketChannel::OPT_REUSEADDR | SSLServerSocketChannel::OPT_REUSEPORT);
 		} else if (url.scheme() == "socket") {
-			m_socketAdmin.attach(server = new ServerSocketChannel(url.host(), url.port(3693), 
-					ServerSocketChannel::OPT_BACKLOG(5) | ServerSocketChannel::OPT_REUSEADDR), clientFactory);
+			server = new ServerSocketChannel(url.host(), url.port(3693), 
+					ServerSocketChannel::OPT_BACKLOG(5) | ServerSocketChannel::OPT_REUSEADDR | ServerSocketChannel::OPT_REUSEPORT);
+		} else if (url.scheme() == "unix" || url.scheme() == "seqpacket") {
+			// Same host peers, no keep-alive
+			m_socketAdmin.attach(new UnixServerSocketChannel(url.path(), url.scheme() == "unix" ?
+					UnixSocketChannel::STREAM : UnixSocketChannel::SEQPACKET, ServerSocketChannel::OPT_BACKLOG(5)), clientFactory);
+			continue;
 		} else {
-			throw ApplicationException("Unsupported sheme '" + url.scheme() + "' (possibles values are 'socket' or 'ssl')");
+			throw ApplicationException("Unsupported sheme '" + url.scheme() + "' (possibles values are 'socket', 'ssl', 'unix' or 'seqpacket')");
 		}
 		server->setKeepAlive(true);
 		server->setKeepIntlv(60);
 		server->setKeepIdle(600);
 		server->setKeepCnt(5);
+		m_socketAdmin.attach(server, clientFactory);
 	}
 	
 	urls = m_settings->value("intf-console/listen-uri").toString().split(',');
@@ -192,6 +280,8 @@ void Proxy::onStart() {
 	}
 	sslCtx = nullptr;
 	clientFactory = new HttpPeer::Factory();
+	clientFactory->setIdleTimeout(m_settings->value("intf-console/idle-timeout").toInt() * 1000);
+	setupAdmission(clientFactory, "intf-console");
 	for (auto it = urls.begin(); it != urls.end(); it++) {
 		QUrl url(*it);
 		if (url.scheme() == "https") {
@@ -200,10 +290,10 @@ void Proxy::onStart() {
 							m_settings->value("intf-console/keystore-pwd").toString());
 			}
 			m_socketAdmin.attach(new SSLServerSocketChannel(url.host(), url.port(3695), sslCtx, 
-					SSLServerSocketChannel::OPT_BACKLOG(5) | SSLServerSocketChannel::OPT_REUSEADDR), clientFactory);
+					SSLServerSocketChannel::OPT_BACKLOG(5) | SSLServerSocketChannel::OPT_REUSEADDR | SSLServerSocketChannel::OPT_REUSEPORT), clientFactory);
 		} else if (url.scheme() == "http") {
 			m_socketAdmin.attach(new ServerSocketChannel(url.host(), url.port(3695), 
-					ServerSocketChannel::OPT_BACKLOG(5) | ServerSocketChannel::OPT_REUSEADDR), clientFactory);
+					ServerSocketChannel::OPT_BACKLOG(5) | ServerSocketChannel::OPT_REUSEADDR | ServerSocketChannel::OPT_REUSEPORT), clientFactory);
 		} else {
 			throw ApplicationException("Unsupported sheme '" + url.scheme() + "' (possibles values are 'http' or 'https')");
 		}
@@ -213,3 +303,11 @@ void Proxy::onStart() {
 	connect(this, SIGNAL(aboutToQuit()), &m_socketAdmin, SLOT(cancel()));
 	m_socketAdmin.start();
 }
+
+void Proxy::setupAdmission(SharedPtr<Peer::Factory> factory, const QString &group) {
+	int limit = m_settings->value(group + "/queue-limit").toInt();
+	int target = m_settings->value(group + "/queue-target-delay").toInt();
+	if (limit > 0 || target > 0) {
+		factory->setAdmission(new Admission(group, limit, target));
+	}
+}
@@ -64,6 +64,13 @@ protected:
 	virtual void onStart();
 	
 private:
+	/**
+	 * @brief Set up the admission control of an interface
+	 * @param factory peer factory of the interface listeners
+	 * @param group settings group of the interface
+	 */
+	void setupAdmission(SharedPtr<Peer::Factory> factory, const QString &group);
+	
 	PeerAdmin m_socketAdmin;
 };
 
@@ -25,8 +25,11 @@
 #include <nodebus/nio/streamchannel.h>
 #include <nodebus/core/parser.h>
 #include <nodebus/core/serializer.h>
+#include <QBuffer>
+#include <QThread>
+#include <atomic>
 
-QMap<QString, SharedPtr<StdPeer> > StdPeer::m_stdPeers;
+ConcurrentHash<QString, SharedPtr<StdPeer> > StdPeer::m_stdPeers;
 
 void StdPeer::clearClientList() {
 	m_stdPeers.clear();
@@ -37,7 +40,7 @@ SharedPtr< StdPeer > StdPeer::get(const QString& uid) {
 }
 
 StdPeer::StdPeer(SocketChannelPtr socket, FileFormat format)
-: Peer(socket), m_dataStream(socket.data()), m_parser(m_dataStream, format), m_serializer(m_dataStream, format), m_synchronize(QMutex::Recursive) {
+: Peer(socket), m_dataStream(socket.data()), m_parser(m_dataStream, format), m_format(format), m_synchronize(QMutex::Recursive), m_nextId(1), m_nextExpiry(0), m_draining(0), m_outboxMax(0) {
 }
 
 StdPeer::~StdPeer() {
@@ -50,7 +53,8 @@ void StdPeer::cancel() {
 		return;
 	}
 	if (!m_uid.isEmpty()) {
-		m_stdPeers.remove(m_uid);
+		// Kept if the uid is registered again by a new connection
+		m_stdPeers.remove(m_uid, this);
 		logInfo() << "Peer[" << m_uid << "] unregistred";
 		m_uid.clear();
 	}
@@ -63,9 +67,7 @@ void StdPeer::writeError(const QString &object, const QString &message, const QS
 	res["object"] = QVariant(object);
 	res["status"] = QVariant("failure");
 	res["error-message"] = QVariant(message);
-	logFiner() << "Peer << " << Serializer::toJSONString(res, Serializer::INDENT(2));
-	m_serializer.serialize(res);
-	m_socket->write("\n", 1);
+	post(res);
 }
 
 void StdPeer::writeResponse(const QString &object, const QVariant &data) {
@@ -74,42 +76,137 @@ void StdPeer::writeResponse(const QString &object, const QVariant &data) {
 	res["object"] = QVariant(object);
 	res["status"] = QVariant("success");
 	res["data"] = data;
-	logFiner() << "Peer << " << Serializer::toJSONString(res, Serializer::INDENT(2));
-	m_serializer.serialize(res);
-	m_socket->write("\n", 1);
+	post(res);
 }
 
-QString StdPeer::send(QVariantMap &request, SharedPtr<HttpPeer> peer) {
-	QMutexLocker locker(&m_synchronize);
-	QString uid;
-	if (request.contains("uid")) {
-		uid = request["uid"].toString();
-	} else {
-		uid = QUuid::createUuid().toString();
-		request["uid"] = uid;
+void StdPeer::post(const QVariant &message) {
+	if (Logger::level() >= Logger::FINER) {
+		logFiner() << "Peer << " << Serializer::toJSONString(message, Serializer::INDENT(2));
+	}
+	QByteArray data;
+	QBuffer buffer(&data);
+	DataStream dataStream(&buffer);
+	Serializer::serialize(dataStream, message, m_format);
+	data.append('\n');
+	m_outbox.push(data);
+	int size = m_outbox.size();
+	int max = m_outboxMax;
+	while (size > max && !m_outboxMax.testAndSetRelaxed(max, size)) {
+		max = m_outboxMax;
+	}
+	flushOutbox();
+}
+
+void StdPeer::flushOutbox() {
+	// Messages queued while the token is held are drained by its holder,
+	// which checks the outbox again once the token is released. Only the
+	// size is read without the token: the queue nodes belong to its holder.
+	// The fences order the size counted by push() before the token read,
+	// and the token release before the size read of its holder
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	while (m_outbox.size() > 0 && m_draining.testAndSetOrdered(0, 1)) {
+		SocketChannelPtr socket;
+		{
+			QMutexLocker _(&m_synchronize);
+			socket = m_socket;
+		}
+		QByteArray data;
+		int count = 0;
+		try {
+			if (socket != nullptr) {
+				socket->cork();
+			}
+			while (m_outbox.pop(data)) {
+				count++;
+				if (socket != nullptr) {
+					socket->write(data);
+				}
+			}
+			if (socket != nullptr) {
+				socket->uncork();
+			}
+		} catch (Exception &e) {
+			m_draining.fetchAndStoreOrdered(0);
+			throw;
+		}
+		m_draining.fetchAndStoreOrdered(0);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (count == 0) {
+			// Counted but not linked yet, let its producer complete the push
+			QThread::yieldCurrentThread();
+		}
+	}
+}
+
+quint64 StdPeer::send(QVariantMap &request, SharedPtr<HttpPeer> peer) {
+	quint64 id;
+	{
+		QMutexLocker locker(&m_synchronize);
+		if (m_socket == nullptr || m_socket->isSaturated()) {
+			return 0;
+		}
+		qint64 now = TimerWheel::now();
+		if (now >= m_nextExpiry) {
+			// The requesters dropped without cancelling their request
+			m_pending.expire(now);
+			m_nextExpiry = now + 1000;
+		}
+		if (m_pending.size() >= NODEBUS_STDPEER_PENDING_MAX) {
+			return 0;
+		}
+		int timeout = HttpPeer::requestTimeout();
+		Pending pending;
+		pending.peer = peer;
+		pending.uid = request.value("uid").toString();
+		id = m_nextId++;
+		m_pending.insert(id, pending, now + (timeout > 0 ? timeout : NODEBUS_STDPEER_PENDING_TTL));
 	}
-	m_httpPeers[uid] = peer;
-	logFiner() << "Peer << " << Serializer::toJSONString(request, Serializer::INDENT(2));
-	m_serializer.serialize(request);
-	m_socket->write("\n", 1);
-	return uid;
+	request["uid"] = QString::number(id);
+	post(request);
+	return id;
 }
 
-void StdPeer::rmRef(const QString& reqUid) {
-	m_httpPeers.remove(reqUid);
+bool StdPeer::rmRef(quint64 id) {
+	QMutexLocker locker(&m_synchronize);
+	return m_pending.remove(id);
+}
+
+QVariantMap StdPeer::getOutboxStats() {
+	QVariantMap res;
+	auto entries = m_stdPeers.entries();
+	for (auto it = entries.begin(); it != entries.end(); it++) {
+		QVariantMap outbox;
+		outbox["queued"] = (qulonglong)it->second->m_outbox.size();
+		outbox["max-queued"] = (int)it->second->m_outboxMax;
+		{
+			QMutexLocker locker(&it->second->m_synchronize);
+			outbox["pending-requests"] = it->second->m_pending.size();
+		}
+		res[it->first] = outbox;
+	}
+	return res;
 }
 
 void StdPeer::process() {
-	while (true) {
+	// No lock held while parsing: the socket is kept alive by this copy
+	// if the peer is cancelled meanwhile, the parser then gets an EOF
+	SocketChannelPtr socket;
+	{
 		QMutexLocker locker(&m_synchronize);
-		while (m_socket->available() > 0 && isspace(m_socket->peek())) {
-			m_socket->get();
+		socket = m_socket;
+	}
+	if (socket == nullptr) {
+		return;
+	}
+	while (true) {
+		while (socket->available() > 0 && isspace(socket->peek())) {
+			socket->get();
 		}
-		if (m_socket->available() == 0) {
-			Proxy::getInstance().getPeerAdmin().attach(m_socket, this);
+		if (socket->available() == 0) {
+			Proxy::getInstance().getPeerAdmin().attach(socket, this);
 			return;
 		}
-		m_socket->setDeadLine(QDateTime::currentMSecsSinceEpoch() + 30000);
+		socket->setTimeout(30000);
 		QVariantMap message = m_parser.parse().toMap();
 		logFiner() << "Peer >> " << Serializer::toJSONString(message, Serializer::INDENT(2));
 		QString object = message["object"].toString();
@@ -129,20 +226,25 @@ void StdPeer::process() {
 				break;
 			}
 			if (method == "register") {
-				if (!m_uid.isEmpty()) {
-					writeError("Proxy", "Already registred", "response");
-					break;
-				}
-				m_uid = parameters["uid"].toString();
-				if (m_uid.isEmpty()) {
-					m_uid = parameters["tuid"].toString();
+				QString uid = parameters["uid"].toString();
+				if (uid.isEmpty()) {
+					uid = parameters["tuid"].toString();
 				}
-				if (m_uid.isEmpty()) {
+				if (uid.isEmpty()) {
 					writeError("Proxy", "register: Missing parameter 'uid'", "response");
 					break;
 				}
-				m_stdPeers[m_uid] = this;
-				logInfo() << "Peer[" << m_uid << "] registred";
+				{
+					QMutexLocker locker(&m_synchronize);
+					if (!m_uid.isEmpty()) {
+						locker.unlock();
+						writeError("Proxy", "Already registred", "response");
+						break;
+					}
+					m_uid = uid;
+					m_stdPeers.insert(m_uid, this);
+				}
+				logInfo() << "Peer[" << uid << "] registred";
 				writeResponse("Proxy", QVariant());
 			} else if (method == "help") {
 				
@@ -152,11 +254,20 @@ void StdPeer::process() {
 		} else if (type == "response") {
 			QString status = message["status"].toString();
 			if (status == "success" || status == "failure") {
-				QString msguid = message["rel-msg-uid"].toString();
-				SharedPtr<HttpPeer> client = m_httpPeers.value(msguid);
-				if (client != nullptr) {
-					m_httpPeers.remove(msguid);
-					client->sendResult(200, message);
+				bool ok;
+				quint64 id = message["rel-msg-uid"].toString().toULongLong(&ok);
+				Pending pending;
+				if (ok) {
+					QMutexLocker locker(&m_synchronize);
+					m_pending.take(id, pending);
+				}
+				if (pending.peer != nullptr) {
+					if (pending.uid.isEmpty()) {
+						message.remove("rel-msg-uid");
+					} else {
+						message["rel-msg-uid"] = pending.uid;
+					}
+					pending.peer->sendResult(200, message);
 				}
 			}
 		} else {
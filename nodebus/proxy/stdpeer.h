@@ -33,11 +33,28 @@
 #include <nodebus/core/parser.h>
 #include <nodebus/core/serializer.h>
 #include <nodebus/nio/peer.h>
+#include <nodebus/core/mpscqueue.h>
+#include <nodebus/core/concurrenthash.h>
+#include <nodebus/core/idtable.h>
+#include <QAtomicInt>
 #include <QVariant>
 using namespace NodeBus;
 
+/// @brief Maximum number of requests waiting for a response per box
+#define NODEBUS_STDPEER_PENDING_MAX 65536
+/// @brief Lifetime of a pending request if the requests never time out, in milliseconds
+#define NODEBUS_STDPEER_PENDING_TTL 300000
+
 class HttpPeer;
 
+/**
+ * @brief Box connection
+ * 
+ * The messages sent to the box are serialized by the sender thread and
+ * queued to a lock-free outbox, drained to the socket by whichever thread
+ * gets the drain token. The senders never wait for the reader, which
+ * may be blocked on a partial message.
+ */
 class StdPeer: public Peer {
 public:
 	
@@ -58,9 +75,25 @@ public:
 	
 	virtual ~StdPeer();
 	
-	QString send(QVariantMap& request, SharedPtr< HttpPeer > peer);
+	/**
+	 * @brief Forward a request to this peer
+	 * 
+	 * The request is sent with a sequential correlation id as uid, the
+	 * uid given by the requester, if any, is restored in the response.
+	 * 
+	 * @param request request message
+	 * @param peer requester
+	 * @return correlation id, 0 if the peer output is saturated or too
+	 * many requests are pending
+	 */
+	quint64 send(QVariantMap& request, SharedPtr< HttpPeer > peer);
 	
-	void rmRef(const QString &reqUid);
+	/**
+	 * @brief Forget a pending request
+	 * @param id correlation id returned by send()
+	 * @return true if still pending, false if already answered
+	 */
+	bool rmRef(quint64 id);
 	
 	virtual void cancel();
 	
@@ -70,16 +103,53 @@ public:
 	static void clearClientList();
 	static QList<QString> getUidList();
 	static uint getCount();
+	
+	/**
+	 * @brief Get the outbox metrics of the registered peers
+	 * @return queued and maximum queued message counts, pending request count indexed by peer uid
+	 */
+	static QVariantMap getOutboxStats();
+	
 private:
 	void writeError(const QString& object, const QString& message, const QString& type="message");
 	void writeResponse(const QString &object, const QVariant &data);
-	static QMap<QString, SharedPtr<StdPeer> > m_stdPeers;
+	
+	/**
+	 * @brief Serialize and queue a message to the outbox, then drain it
+	 * @param message message to send
+	 * @throw IOException on error
+	 */
+	void post(const QVariant &message);
+	
+	/**
+	 * @brief Write the queued messages to the socket, unless another
+	 * thread does it
+	 * @throw IOException on error
+	 */
+	void flushOutbox();
+	
+	/// @brief Registered peers, read by the HTTP peers of all the workers
+	static ConcurrentHash<QString, SharedPtr<StdPeer> > m_stdPeers;
 	QDataStream m_dataStream;
 	Parser m_parser;
-	Serializer m_serializer;
+	FileFormat m_format;
 	QString m_uid;
+	/// @brief Short critical sections only: socket, uid and pending requests
 	QMutex m_synchronize;
-	QMap<QString, SharedPtr<HttpPeer> > m_httpPeers;
+	struct Pending {
+		SharedPtr<HttpPeer> peer;
+		/// @brief Uid given by the requester
+		QString uid;
+	};
+	
+	IdTable<Pending> m_pending;
+	quint64 m_nextId;
+	/// @brief Next purge of the expired pending requests
+	qint64 m_nextExpiry;
+	MPSCQueue<QByteArray> m_outbox;
+	/// @brief Drain token, held by the thread writing the outbox
+	QAtomicInt m_draining;
+	QAtomicInt m_outboxMax;
 };
 
 inline StdPeer::Factory::Factory(FileFormat format): m_format(format) {
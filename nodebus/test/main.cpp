@@ -17,16 +17,39 @@
  */
 
 #include <nodebus/core/sharedptr.h>
+#include <nodebus/core/weakptr.h>
+#include <nodebus/core/census.h>
+#include <nodebus/core/executor.h>
+#include <nodebus/core/cpuset.h>
+#include <nodebus/core/mpscqueue.h>
+#include <nodebus/core/concurrenthash.h>
+#include <nodebus/core/task.h>
+#include <QThreadPool>
+#include <QtAlgorithms>
+#include <thread>
 #include <nodebus/core/logger.h>
 #include <nodebus/nio/selector.h>
 #include <nodebus/nio/serversocketchannel.h>
 #include <nodebus/nio/selectionkey.h>
 #include <nodebus/nio/socketchannel.h>
+#include <nodebus/nio/iochannel.h>
+#include <nodebus/nio/unixserversocketchannel.h>
+#include <nodebus/nio/admission.h>
+#include <nodebus/nio/peer.h>
+#ifdef NODEBUS_TEST_NIO
+#include <nodebus/proxy/stdpeer.h>
+#include <nodebus/proxy/httppeer.h>
+#endif // NODEBUS_TEST_NIO
 #include <nodebus/core/parser.h>
 #include <nodebus/core/serializer.h>
 #include <nodebus/core/idlparser/driver.h>
 #include <unistd.h>
+#include <time.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 using namespace NodeBus;
 using namespace std;
@@ -94,6 +117,622 @@ void testPtr() {
 	logInfo() << "DONE!";
 }
 
+void testWeakPtr() {
+	WeakPtr<A> w;
+	{
+		SharedPtr<B> b = newB();
+		w = b;
+		logInfo() << "(w.lock() == b) is " << (w.lock() == b);
+	}
+	logInfo() << "w.isNull() is " << w.isNull();
+	if (!w.isNull()) {
+		throw Exception("Weak pointer still valid after the data release");
+	}
+	logInfo() << "DONE!";
+}
+
+void testCensus() {
+	Census::setEnabled(true);
+	QList<SharedPtr<A> > list;
+	for (int i = 0; i < 3; i++) {
+		list.append(new B(i));
+	}
+	list.append(new C(0));
+	logInfo() << "Census: " << Census::toString();
+	if (Census::typeCount().value("B") != 3 || Census::typeCount().value("C") != 1) {
+		throw Exception("Invalid census");
+	}
+	list.clear();
+	if (Census::typeCount().contains("B")) {
+		throw Exception("Invalid census after release");
+	}
+	Census::setEnabled(false);
+	logInfo() << "DONE!";
+}
+
+void testMPSCQueue(int producers = 4, int count = 100000) {
+	MPSCQueue<QByteArray> queue;
+	QList<std::thread*> threads;
+	for (int p = 0; p < producers; p++) {
+		threads.append(new std::thread([&queue, p, count] {
+			for (int i = 0; i < count; i++) {
+				queue.push(QByteArray::number(p) + ":" + QByteArray::number(i));
+			}
+		}));
+	}
+	QVector<int> last(producers, -1);
+	QByteArray value;
+	for (int received = 0; received < producers * count;) {
+		if (!queue.pop(value)) {
+			continue;
+		}
+		int p = value.left(value.indexOf(':')).toInt();
+		int i = value.mid(value.indexOf(':') + 1).toInt();
+		if (i != last[p] + 1) {
+			throw Exception("MPSCQueue: out of order value");
+		}
+		last[p] = i;
+		received++;
+	}
+	for (auto it = threads.begin(); it != threads.end(); it++) {
+		(*it)->join();
+		delete *it;
+	}
+	if (!queue.isEmpty() || queue.size() != 0) {
+		throw Exception("MPSCQueue: not empty");
+	}
+	logInfo() << "MPSCQueue: " << producers << " producers, " << count << " values each";
+}
+
+void testConcurrentHash(int threads = 4, int count = 100000) {
+	ConcurrentHash<QString, SharedPtr<A> > hash;
+	QList<std::thread*> list;
+	for (int t = 0; t < threads; t++) {
+		list.append(new std::thread([&hash, t, count] {
+			for (int i = 0; i < count; i++) {
+				QString key = QString::number(t) + ":" + QString::number(i);
+				SharedPtr<A> value = new B(i);
+				hash.insert(key, value);
+				if (hash.value(key) != value) {
+					throw Exception("ConcurrentHash: value not found");
+				}
+				// Every other entry removed, only if still mapped to it
+				if (i % 2 == 1 && (hash.remove(key, (A*)nullptr) || !hash.remove(key, value.data()))) {
+					throw Exception("ConcurrentHash: invalid removal");
+				}
+			}
+		}));
+	}
+	// Iterated while the entries change
+	for (int i = 0; i < 100; i++) {
+		hash.entries();
+	}
+	for (auto it = list.begin(); it != list.end(); it++) {
+		(*it)->join();
+		delete *it;
+	}
+	if (hash.size() != threads * count / 2 || hash.keys().size() != hash.size()) {
+		throw Exception("ConcurrentHash: invalid size");
+	}
+	hash.clear();
+	if (hash.size() != 0 || hash.contains("0:0")) {
+		throw Exception("ConcurrentHash: not empty");
+	}
+	logInfo() << "ConcurrentHash: " << threads << " threads, " << count << " entries each";
+}
+
+void testIdTable(int count = 1000000) {
+	IdTable<int> table;
+	// Sliding window of pending requests, as a box answering in order
+	quint64 next = 1, oldest = 1;
+	for (int i = 0; i < count; i++) {
+		table.insert(next++, i, i + 100);
+		if (next - oldest > 64) {
+			int value;
+			if (!table.take(oldest++, value) || value != int(oldest - 2)) {
+				throw Exception("IdTable: entry not found");
+			}
+		}
+	}
+	if (table.size() != 64 || table.capacity() > 256) {
+		throw Exception("IdTable: invalid size");
+	}
+	if (table.remove(oldest - 1) || !table.remove(oldest)) {
+		throw Exception("IdTable: invalid removal");
+	}
+	// The reserved ids must not match the tombstones left by the removals
+	int value;
+	if (table.remove(~quint64(0)) || table.take(~quint64(0), value) || table.remove(0) || table.size() != 63) {
+		throw Exception("IdTable: reserved id found");
+	}
+	if (table.expire(count + 98) != 62 || table.size() != 1) {
+		throw Exception("IdTable: invalid expiration");
+	}
+	logInfo() << "IdTable: " << count << " ids, capacity " << table.capacity();
+}
+
+class BenchTask: public QRunnable {
+public:
+	static QAtomicInt s_count;
+	virtual void run() {
+		s_count.fetchAndAddRelaxed(1);
+	}
+};
+
+QAtomicInt BenchTask::s_count;
+
+void benchExecutor(int connections = 1000, int rounds = 200) {
+	qint64 start = QDateTime::currentMSecsSinceEpoch();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < connections; i++) {
+			QThreadPool::globalInstance()->start(new BenchTask());
+		}
+	}
+	QThreadPool::globalInstance()->waitForDone();
+	qint64 elapsed = QDateTime::currentMSecsSinceEpoch() - start;
+	logInfo() << "QThreadPool: " << (double(elapsed) * 1000000 / (double(rounds) * connections)) << " ns per task";
+	Executor executor;
+	start = QDateTime::currentMSecsSinceEpoch();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < connections; i++) {
+			executor.start(new BenchTask(), i);
+		}
+	}
+	executor.waitForDone();
+	elapsed = QDateTime::currentMSecsSinceEpoch() - start;
+	QVariantMap stats = executor.stats();
+	logInfo() << "Executor: " << (double(elapsed) * 1000000 / (double(rounds) * connections)) << " ns per task, "
+		<< stats["stolen"].toULongLong() << " stolen of " << stats["executed"].toULongLong();
+	if (BenchTask::s_count != 2 * rounds * connections) {
+		throw Exception("lost tasks");
+	}
+}
+
+class LatencyTask: public QRunnable {
+public:
+	LatencyTask(qint64 *latency): m_latency(latency), m_queued(now()) {
+	}
+	virtual void run() {
+		*m_latency = now() - m_queued;
+	}
+	static qint64 now() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+private:
+	qint64 *m_latency;
+	qint64 m_queued;
+};
+
+void benchLatency(const QString &name, Executor &executor, int count) {
+	QVector<qint64> latencies(count);
+	qint64 *data = latencies.data();
+	// Bursts of connection events, as dispatched by a reactor
+	for (int i = 0; i < count; i += 64) {
+		for (int j = i; j < qMin(count, i + 64); j++) {
+			executor.start(new LatencyTask(data + j), j);
+		}
+		executor.waitForDone();
+	}
+	qSort(latencies);
+	logInfo() << name << ": p50 " << latencies[count / 2] / 1000.0 << " us, p99 " << latencies[count * 99 / 100] / 1000.0
+		<< " us, p99.9 " << latencies[count * 999 / 1000] / 1000.0 << " us, max " << latencies.last() / 1000.0 << " us";
+}
+
+void benchPinning(int count = 200000) {
+	CpuSet node = CpuSet::ofNode(0);
+	if (node.count() < 2) {
+		logInfo() << "Pinning: NUMA topology unknown or single CPU, skipped";
+		return;
+	}
+	// The calling thread plays the reactor on the first CPU of the node,
+	// the workers take the other ones
+	QList<int> cpus;
+	for (int i = 1; i < node.count(); i++) {
+		cpus.append(node.at(i));
+	}
+	{
+		Executor executor(cpus.size());
+		benchLatency("Unpinned", executor, count);
+	}
+	QList<int> all;
+	for (int i = 0; i < QThread::idealThreadCount(); i++) {
+		all.append(i);
+	}
+	CpuSet(QList<int>() << node.at(0)).pin();
+	{
+		Executor executor(0, CpuSet(cpus));
+		benchLatency("Pinned to node 0 (" + node.toString() + ")", executor, count);
+	}
+	CpuSet(all).pin();
+}
+
+#ifdef NODEBUS_COROUTINES
+static std::coroutine_handle<> s_suspended;
+
+struct TestSuspend {
+	bool await_ready() {
+		return false;
+	}
+	void await_suspend(std::coroutine_handle<> handle) {
+		s_suspended = handle;
+	}
+	void await_resume() {
+	}
+};
+
+Task<int> testTaskLeaf(int value) {
+	co_await TestSuspend();
+	co_return value * 2;
+}
+
+Task<int> testTaskSum(int count) {
+	int sum = 0;
+	for (int i = 0; i < count; i++) {
+		sum += co_await testTaskLeaf(i);
+	}
+	co_return sum;
+}
+
+Task<> testTaskThrow() {
+	co_await TestSuspend();
+	throw Exception("expected");
+}
+
+Task<> testTaskRoot(int &sum, bool &caught) {
+	sum = co_await testTaskSum(1000);
+	try {
+		co_await testTaskThrow();
+	} catch (Exception &e) {
+		caught = true;
+	}
+}
+
+void testTask() {
+	int sum = 0;
+	bool caught = false;
+	Task<> root = testTaskRoot(sum, caught);
+	root.resume();
+	while (!root.isDone()) {
+		std::exchange(s_suspended, nullptr).resume();
+	}
+	root.result();
+	if (sum != 999000 || !caught) {
+		throw Exception("Task: invalid result");
+	}
+	logInfo() << "DONE!";
+}
+#endif // NODEBUS_COROUTINES
+
+#ifdef NODEBUS_TEST_NIO
+void benchStreamChannel(uint count = 500) {
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		throw IOException("socketpair failed");
+	}
+	QByteArray message = "  {\"type\": \"request\", \"object\": \"Test\", \"method\": \"ping\", \"parameters\": {}}\n";
+	for (uint i = 0; i < count; i++) {
+		if (::write(fds[0], message.constData(), message.length()) != message.length()) {
+			throw IOException("write failed");
+		}
+	}
+	SharedPtr<IOChannel> channel = new IOChannel(fds[1], IOChannel::CLOSE_ON_DELETE | IOChannel::READABLE);
+	for (uint i = 0; i < count; i++) {
+		while (channel->available() > 0 && isspace(channel->peek())) {
+			channel->get();
+		}
+		while (channel->get() != '\n');
+	}
+	logInfo() << "StreamChannel: " << count << " messages, " << (double(channel->readCalls()) / count) << " read calls per message";
+	::close(fds[0]);
+}
+
+void benchOutputQueue(uint count = 500) {
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		throw IOException("socketpair failed");
+	}
+	QByteArray message = "{\"type\": \"request\", \"object\": \"Test\", \"method\": \"ping\", \"parameters\": {}}";
+	SharedPtr<IOChannel> channel = new IOChannel(fds[0], IOChannel::CLOSE_ON_DELETE | IOChannel::WRITABLE);
+	channel->cork();
+	for (uint i = 0; i < count; i++) {
+		channel->write(message.constData(), message.length());
+		channel->write("\n", 1);
+	}
+	channel->uncork();
+	if (channel->pending() != 0) {
+		throw IOException("output not flushed");
+	}
+	QByteArray received(count * (message.length() + 1), 0);
+	size_t n = 0;
+	while (n < size_t(received.size())) {
+		ssize_t ret = ::read(fds[1], received.data() + n, received.size() - n);
+		if (ret <= 0) {
+			throw IOException("read failed");
+		}
+		n += ret;
+	}
+	if (received != (message + "\n").repeated(count)) {
+		throw IOException("output corrupted");
+	}
+	logInfo() << "OutputQueue: " << count << " messages, " << (double(channel->writeCalls()) / count) << " write calls per message";
+	::close(fds[1]);
+}
+
+void benchSelector(Selector::Engine engine, int connections = 10000, int rounds = 20) {
+	struct rlimit limit;
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		::setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && rlim_t(connections * 2 + 64) > limit.rlim_cur) {
+		connections = (limit.rlim_cur - 64) / 2;
+	}
+	int server = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_in addr;
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (server == -1 || ::bind(server, (struct sockaddr*)&addr, len) == -1 || ::listen(server, 1024) == -1
+		|| ::getsockname(server, (struct sockaddr*)&addr, &len) == -1) {
+		throw IOException("listen failed");
+	}
+	Selector *selector = Selector::open(engine);
+	QList<int> clients;
+	QList<SharedPtr<IOChannel> > channels;
+	for (int i = 0; i < connections; i++) {
+		int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1 || ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+			throw IOException("connect failed");
+		}
+		clients.append(fd);
+		int cfd = ::accept(server, nullptr, nullptr);
+		if (cfd == -1) {
+			throw IOException("accept failed");
+		}
+		SharedPtr<IOChannel> channel = new IOChannel(cfd, IOChannel::CLOSE_ON_DELETE | IOChannel::READABLE);
+		channel->registerTo(*selector, SelectionKey::OP_READ);
+		channels.append(channel);
+	}
+	qint64 start = QDateTime::currentMSecsSinceEpoch();
+	quint64 selects = 0;
+	for (int r = 0; r < rounds; r++) {
+		for (auto it = clients.begin(); it != clients.end(); it++) {
+			if (::write(*it, "x", 1) != 1) {
+				throw IOException("write failed");
+			}
+		}
+		for (int received = 0; received < connections;) {
+			if (!selector->select()) {
+				continue;
+			}
+			selects++;
+			auto list = selector->selectedKeys();
+			for (auto it = list.begin(); it != list.end(); it++) {
+				StreamChannelPtr channel = (*it)->channel();
+				channel->get();
+				(*it)->interestOps(SelectionKey::OP_READ);
+				received++;
+			}
+		}
+	}
+	qint64 elapsed = QDateTime::currentMSecsSinceEpoch() - start;
+	logInfo() << "Selector[" << selector->engineName() << "]: " << connections << " connections, "
+		<< (double(elapsed) * 1000000 / (double(rounds) * connections)) << " ns per event, "
+		<< (double(rounds) * connections / selects) << " events per select";
+	channels.clear();
+	delete selector;
+	for (auto it = clients.begin(); it != clients.end(); it++) {
+		::close(*it);
+	}
+	::close(server);
+}
+
+void testAdmission() {
+	AdmissionPtr admission = new Admission("test", 2, 1, 10);
+	qint64 first = admission->enqueue();
+	admission->enqueue();
+	if (!admission->isFull()) {
+		throw Exception("Admission: limit not reached");
+	}
+	// A single late task is a burst, not an overload
+	if (admission->dequeue(first - 5000) || admission->dequeue(Admission::now())) {
+		throw Exception("Admission: burst shed");
+	}
+	// Standing queue: the delay stays above the target for a whole interval
+	qint64 end = Admission::now() + 30000;
+	while (Admission::now() < end) {
+		admission->dequeue(admission->enqueue() - 5000);
+	}
+	admission->enqueue();
+	admission->enqueue();
+	if (!admission->dequeue(Admission::now() - 5000) || admission->dequeue(Admission::now())) {
+		throw Exception("Admission: invalid shedding");
+	}
+	logInfo() << "Admission: " << admission->stats()["dispatched"].toULongLong() << " dispatched";
+}
+
+class TestTimer: public Timer {
+public:
+	static int s_fired;
+	static int s_early;
+	qint64 due;
+protected:
+	virtual void timeout() {
+		if (TimerWheel::now() + NODEBUS_TIMERWHEEL_TICK < due) {
+			s_early++;
+		}
+		s_fired++;
+	}
+};
+int TestTimer::s_fired = 0;
+int TestTimer::s_early = 0;
+
+void testTimerWheel(int count = 100000) {
+	Selector *selector = Selector::open();
+	TestTimer *timers = new TestTimer[count];
+	qint64 start = TimerWheel::now();
+	for (int i = 0; i < count; i++) {
+		int delay = qrand() % 2000;
+		timers[i].due = start + delay;
+		timers[i].start(selector->timers(), delay);
+	}
+	for (int i = 0; i < count; i += 2) {
+		timers[i].cancel();
+	}
+	qint64 armed = TimerWheel::now() - start;
+	quint64 selects = 0;
+	while (selector->timers().count() > 0) {
+		selector->select();
+		selects++;
+	}
+	logInfo() << "TimerWheel: " << count << " timers armed in " << armed << " ms, "
+		<< TestTimer::s_fired << " fired in " << selects << " selects";
+	delete[] timers;
+	delete selector;
+	if (TestTimer::s_fired != count / 2 || TestTimer::s_early != 0) {
+		throw Exception("Invalid timer expirations");
+	}
+	logInfo() << "DONE!";
+}
+
+void testUnixSocketChannel(UnixSocketChannel::Type type) {
+	QString path = "@nodebus-test-" + QString::number(::getpid());
+	UnixServerSocketChannelPtr server = new UnixServerSocketChannel(path, type);
+	UnixSocketChannelPtr client = new UnixSocketChannel(path, type);
+	UnixSocketChannelPtr peer = server->accept();
+	if (peer == nullptr) {
+		throw Exception("No pending connection");
+	}
+	peer->setAcceptFds(true);
+	// Large payload handed over as a memfd
+	QByteArray payload(1 << 20, 'x');
+	client->sendBuffer("B", payload.constData(), payload.size());
+	char c = peer->get();
+	QList<int> fds = peer->takeFds();
+	if (c != 'B' || fds.size() != 1) {
+		throw Exception("File descriptor not received");
+	}
+	SharedPtr<UnixSocketChannel::Buffer> buffer = new UnixSocketChannel::Buffer(fds.first());
+	if (buffer->size() != size_t(payload.size()) || memcmp(buffer->data(), payload.constData(), payload.size()) != 0) {
+		throw Exception("Invalid memfd buffer");
+	}
+	// Larger than the read buffer: a seqpacket message goes through the overflow
+	QByteArray message(40000, 'y');
+	client->write(message);
+	QByteArray received(message.size(), '\0');
+	for (int n = 0; n < received.size();) {
+		n += peer->read(received.data() + n, received.size() - n);
+	}
+	if (received != message) {
+		throw Exception("Invalid message");
+	}
+	logInfo() << "UnixSocketChannel[" << (type == UnixSocketChannel::STREAM ? "stream" : "seqpacket") << "]: "
+		<< peer->name() << " DONE!";
+}
+
+class TestPeer: public Peer {
+public:
+	TestPeer(SocketChannelPtr socket): Peer(socket) {
+	}
+	virtual void process() {
+	}
+};
+
+/**
+ * @brief Run the selector as a reactor would, without processing the keys
+ * @param selector selector the hung up channels are registered to
+ * @param count number of hang-ups to wait for
+ */
+static void waitHangUps(Selector *selector, int count) {
+	for (int idle = 0; count > 0;) {
+		if (!selector->select(100)) {
+			if (++idle == 10) {
+				throw Exception("Hang-up not reported");
+			}
+			continue;
+		}
+		count -= selector->selectedKeys().size();
+	}
+}
+
+static SocketChannelPtr testConnect(UnixServerSocketChannelPtr server, const QString &path, UnixSocketChannelPtr &client) {
+	client = new UnixSocketChannel(path);
+	SocketChannelPtr socket = server->accept();
+	if (socket == nullptr) {
+		throw Exception("No pending connection");
+	}
+	return socket;
+}
+
+void testConnectionLeak(int connections = 100000, int boxes = 10000, int batch = 100) {
+	QString path = "@nodebus-leak-" + QString::number(::getpid());
+	UnixServerSocketChannelPtr server = new UnixServerSocketChannel(path, UnixSocketChannel::STREAM,
+		ServerSocketChannel::OPT_BACKLOG(batch));
+	// Lives as long as a reactor: only the hang-ups may release the keys
+	Selector *selector = Selector::open();
+	qint64 initial = Census::liveCount();
+	for (int i = 0; i < connections; i += batch) {
+		for (int j = 0; j < batch; j++) {
+			UnixSocketChannelPtr client;
+			SocketChannelPtr socket = testConnect(server, path, client);
+			// The key holds the channel and the peer, the peer holds the channel
+			socket->registerTo(*selector, SelectionKey::OP_READ, new TestPeer(socket));
+			// Remote end gone, the peer is dropped without any cancel() call
+			client->close();
+		}
+		waitHangUps(selector, batch);
+	}
+	qint64 leaked = Census::liveCount() - initial;
+	logInfo() << connections << " connections churned, " << leaked << " shared data leaked";
+	if (leaked != 0) {
+		throw Exception("Connection graph leak");
+	}
+	// A box holds its pending HTTP peers, which refer back to it
+	Logger::Level level = Logger::level();
+	Logger::setLevel(Logger::WARNING);
+	for (int i = 0; i < boxes; i += batch) {
+		for (int j = 0; j < batch; j++) {
+			QString uid = "leak-" + QString::number(i + j);
+			UnixSocketChannelPtr boxClient;
+			SocketChannelPtr boxSocket = testConnect(server, path, boxClient);
+			SharedPtr<StdPeer> stdPeer = new StdPeer(boxSocket, JSON);
+			// Followed by a message to return without waiting for more data
+			boxClient->write(QByteArray("{\"type\":\"request\",\"object\":\"Proxy\",\"method\":\"register\",\"parameters\":{\"uid\":\"")
+				+ uid.toUtf8() + "\"}}\n{\"type\":\"message\",\"object\":\"Proxy\"}\n");
+			stdPeer->process();
+			if (StdPeer::get(uid) != stdPeer) {
+				throw Exception("Box not registered");
+			}
+			UnixSocketChannelPtr httpClient;
+			SocketChannelPtr httpSocket = testConnect(server, path, httpClient);
+			SharedPtr<HttpPeer> httpPeer = new HttpPeer(httpSocket);
+			QByteArray body("{\"type\":\"request\",\"object\":\"Box\",\"method\":\"ping\"}");
+			httpClient->write("POST /" + uid.toUtf8() + " HTTP/1.1\r\nContent-Type: application/json\r\nContent-Length: "
+				+ QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+			// Forwarded to the box, left pending
+			httpPeer->process();
+			boxSocket->registerTo(*selector, SelectionKey::OP_READ, stdPeer);
+			httpSocket->registerTo(*selector, SelectionKey::OP_READ, httpPeer);
+			boxClient->close();
+			httpClient->close();
+		}
+		waitHangUps(selector, 2 * batch);
+	}
+	Logger::setLevel(level);
+	leaked = Census::liveCount() - initial;
+	logInfo() << boxes << " boxes with a pending request churned, " << leaked << " shared data leaked";
+	if (leaked != 0 || StdPeer::getCount() != 0) {
+		throw Exception("Box graph leak");
+	}
+	delete selector;
+	logInfo() << "DONE!";
+}
+
+#endif // NODEBUS_TEST_NIO
+
 // void testSelect() {
 // 	Selector selector;
 // 	SharedPtr<ServerSocketChannel> server = new ServerSocketChannel("::1", 3333);
@@ -140,6 +779,27 @@ int main(int argc, char **argv) {
 // 			throw Exception("Missing filename");
 // 		}
 // 		testIDLCompile(argv[1]);
+		testWeakPtr();
+		testCensus();
+		testMPSCQueue();
+		testConcurrentHash();
+		testIdTable();
+		benchExecutor();
+		benchPinning();
+#ifdef NODEBUS_COROUTINES
+		testTask();
+#endif // NODEBUS_COROUTINES
+#ifdef NODEBUS_TEST_NIO
+		benchStreamChannel();
+		benchOutputQueue();
+		benchSelector(Selector::EPOLL);
+		benchSelector(Selector::URING);
+		testTimerWheel();
+		testAdmission();
+		testUnixSocketChannel(UnixSocketChannel::STREAM);
+		testUnixSocketChannel(UnixSocketChannel::SEQPACKET);
+		testConnectionLeak();
+#endif // NODEBUS_TEST_NIO
 		testBCONParser();
 // 		testBSONParser();
 	} catch (Exception &e) {